@@ -0,0 +1,96 @@
+/*
+ * admin_unit_bench.c -- user space benchmark of the admin_unit core
+ *
+ * Copyright (C) 2024 Feng Liu
+ *
+ * Runs the chunk sweep and full ctx reads and writes of
+ * libadmin_unit_core.a against the fake device, without the module:
+ *
+ *	./admin_unit_bench [ctx_kb [iters]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "admin_unit_core.h"
+
+static u64 bench_xfer(struct admin_unit_fake_dev *dev, bool wr, int iters)
+{
+	struct admin_unit_xfer x;
+	u64 size, start;
+	int i, ret;
+
+	start = admin_unit_now_ns();
+	for (i = 0; i < iters; i++) {
+		if (wr) {
+			/* restart the device side restore */
+			admin_unit_fake_discard(&dev->fk);
+		} else {
+			ret = admin_unit_fake_dev_ops.ctx_sz_get(dev, &size);
+			if (ret)
+				return 0;
+		}
+		ret = admin_unit_core_xfer(&admin_unit_fake_dev_ops, dev, wr, 0,
+					   dev->size, ADMIN_UNIT_CTX_WIN, &x);
+		if (ret || x.bytes != dev->size) {
+			fprintf(stderr, "%s failed: %d, %llu of %llu bytes\n",
+				wr ? "ctx_wr" : "ctx_rd", ret,
+				(unsigned long long)x.bytes,
+				(unsigned long long)dev->size);
+			return 0;
+		}
+	}
+	return (admin_unit_now_ns() - start) / iters;
+}
+
+int main(int argc, char **argv)
+{
+	struct admin_unit_chunk_res res[ADMIN_UNIT_CHUNK_STEPS];
+	struct admin_unit_fake_dev dev = {};
+	unsigned long ctx_kb = 64, iters = 100;
+	struct admin_unit_chunk_res *r;
+	int i, nr, best;
+	u64 ns;
+
+	if (argc > 1)
+		ctx_kb = strtoul(argv[1], NULL, 0);
+	if (argc > 2)
+		iters = strtoul(argv[2], NULL, 0);
+	if (!ctx_kb || !iters) {
+		fprintf(stderr, "usage: %s [ctx_kb [iters]]\n", argv[0]);
+		return 1;
+	}
+
+	dev.size = (u64)ctx_kb << 10;
+	dev.ctx = malloc(dev.size);
+	if (!dev.ctx)
+		return 1;
+
+	best = admin_unit_core_chunk_sweep(&admin_unit_fake_dev_ops, &dev,
+					   res, &nr);
+	for (i = 0; i < nr; i++) {
+		r = &res[i];
+		printf("chunk %6u cmds %8u %8llu MB/s %8llu ns/cmd%s\n",
+		       r->size, r->cmds,
+		       (unsigned long long)(r->bytes * 1000 / r->ns),
+		       (unsigned long long)(r->ns / r->cmds),
+		       i == best ? " *" : "");
+	}
+	if (best < 0) {
+		fprintf(stderr, "chunk sweep failed: %d\n", best);
+		free(dev.ctx);
+		return 1;
+	}
+
+	ns = bench_xfer(&dev, false, iters);
+	printf("ctx_rd_full %llu KB %llu ns\n", (unsigned long long)ctx_kb,
+	       (unsigned long long)ns);
+	if (ns) {
+		ns = bench_xfer(&dev, true, iters);
+		printf("ctx_wr_full %llu KB %llu ns\n",
+		       (unsigned long long)ctx_kb, (unsigned long long)ns);
+	}
+
+	free(dev.ctx);
+	return ns ? 0 : 1;
+}
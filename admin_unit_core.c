@@ -0,0 +1,427 @@
+/*
+ * admin_unit_core.c -- transport-agnostic core of admin_unit_test
+ *
+ * Copyright (C) 2024 Feng Liu
+ */
+
+#include "admin_unit_core.h"
+
+/*
+ * Move [off, off + len) of the ctx, at most win bytes per command.  A
+ * read advances by what the device returned and stops early once the
+ * device has nothing left; a short read while more is left is -EIO.
+ */
+int admin_unit_core_xfer(const struct admin_unit_core_ops *ops, void *priv,
+			 bool wr, u64 off, u64 len, u32 win,
+			 struct admin_unit_xfer *x)
+{
+	u32 n, rd_sz, remaining;
+	int ret = 0;
+
+	x->bytes = 0;
+	x->cmds = 0;
+	while (len) {
+		n = min_t(u64, len, win);
+		if (wr) {
+			ret = ops->ctx_wr(priv, off, n);
+			rd_sz = n;
+		} else {
+			rd_sz = 0;
+			remaining = 0;
+			ret = ops->ctx_rd(priv, off, n, &rd_sz, &remaining);
+			if (!ret && (rd_sz > n || (rd_sz < n && remaining)))
+				ret = -EIO;
+		}
+		if (ret)
+			break;
+		x->cmds++;
+		x->bytes += rd_sz;
+		off += rd_sz;
+		len -= rd_sz;
+		if (!wr && !remaining)
+			break;
+	}
+	return ret;
+}
+
+/*
+ * One partial read or write: move the next sz bytes of the ctx at the
+ * cursor, or with all everything left, and advance the cursor by what
+ * was moved.  Once everything was asked for the cursor rewinds to the
+ * start of the ctx, for the next full pass.
+ */
+int admin_unit_core_partial(const struct admin_unit_core_ops *ops, void *priv,
+			    struct admin_unit_cursor *c, bool wr, u64 sz,
+			    bool all, u32 win, struct admin_unit_xfer *x)
+{
+	u64 len;
+	int ret;
+
+	len = all ? c->left : min_t(u64, sz, c->left);
+	ret = admin_unit_core_xfer(ops, priv, wr, c->off, len, win, x);
+	c->off += x->bytes;
+	c->left -= x->bytes;
+	if (all)
+		admin_unit_cursor_init(c, c->size);
+	return ret;
+}
+
+/* time a full ctx read in chunks of sz */
+int admin_unit_core_chunk_measure(const struct admin_unit_core_ops *ops,
+				  void *priv, u32 sz,
+				  struct admin_unit_chunk_res *r)
+{
+	struct admin_unit_xfer x;
+	u64 size, start;
+	int ret;
+
+	/* restart the device side ctx stream */
+	ret = ops->ctx_sz_get(priv, &size);
+	if (ret)
+		return ret;
+	if (!size)
+		return -ENODATA;
+
+	memset(r, 0, sizeof(*r));
+	r->size = sz;
+	start = admin_unit_now_ns();
+	ret = admin_unit_core_xfer(ops, priv, false, 0, size, sz, &x);
+	if (ret)
+		return ret;
+	r->cmds = x.cmds;
+	r->bytes = x.bytes;
+	r->ns = max_t(u64, admin_unit_now_ns() - start, 1);
+	return 0;
+}
+
+/*
+ * Sweep the chunk sizes into res[ADMIN_UNIT_CHUNK_STEPS], *nr of them
+ * measured.  Returns the index of the fastest, or -errno when none
+ * could be measured.
+ */
+int admin_unit_core_chunk_sweep(const struct admin_unit_core_ops *ops,
+				void *priv, struct admin_unit_chunk_res *res,
+				int *nr)
+{
+	struct admin_unit_chunk_res *r;
+	int i, sz, best = -1, ret = 0;
+
+	*nr = 0;
+	for (i = 0, sz = ADMIN_UNIT_CHUNK_MIN;
+	     i < ADMIN_UNIT_CHUNK_STEPS && sz <= ADMIN_UNIT_CHUNK_MAX;
+	     i++, sz <<= 1) {
+		r = &res[i];
+		ret = admin_unit_core_chunk_measure(ops, priv, sz, r);
+		if (ret)
+			break;
+		(*nr)++;
+
+		/* bytes/ns, compared without dividing */
+		if (best < 0 || r->bytes * res[best].ns > res[best].bytes * r->ns)
+			best = i;
+		/* a single command already moves the whole ctx */
+		if (r->cmds == 1)
+			break;
+	}
+	return best >= 0 ? best : ret;
+}
+
+u32 admin_unit_core_le32(const u8 *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (u32)p[3] << 24;
+}
+
+u64 admin_unit_core_le64(const u8 *p)
+{
+	return admin_unit_core_le32(p) | (u64)admin_unit_core_le32(p + 4) << 32;
+}
+
+/*
+ * Parse the TLV header hdr found at pos of a size byte ctx.  -EINVAL
+ * when the header or its value runs past the end; the next field
+ * starts at f->off + f->len.
+ */
+int admin_unit_core_tlv_parse(const u8 *hdr, u64 pos, u64 size,
+			      struct admin_unit_tlv *f)
+{
+	if (pos > size || size - pos < ADMIN_UNIT_TLV_HDR_SZ)
+		return -EINVAL;
+	f->type = admin_unit_core_le32(hdr);
+	f->off = pos + ADMIN_UNIT_TLV_HDR_SZ;
+	f->len = admin_unit_core_le64(hdr + 8);
+	if (f->len > size - f->off)
+		return -EINVAL;
+	return 0;
+}
+
+/* a decimal of at most max at *s, advancing *s past it */
+static int admin_unit_core_parse_uint(const char **s, u32 max, u32 *v)
+{
+	const char *p = *s;
+	u64 n = 0;
+
+	if (*p < '0' || *p > '9')
+		return -EINVAL;
+	for (; *p >= '0' && *p <= '9'; p++) {
+		n = n * 10 + (*p - '0');
+		if (n > max)
+			return -ERANGE;
+	}
+	*v = n;
+	*s = p;
+	return 0;
+}
+
+/*
+ * Parse a VF written as "<pf>:<vf>", or as a bare "<vf>" on PF 0,
+ * ignoring trailing blanks.
+ */
+int admin_unit_core_vf_id_parse(const char *s, u32 *pf, u32 *vf)
+{
+	u32 a, b = 0;
+	int ret;
+
+	ret = admin_unit_core_parse_uint(&s, ADMIN_UNIT_PF_MAX, &a);
+	if (!ret && *s == ':') {
+		s++;
+		ret = admin_unit_core_parse_uint(&s, ADMIN_UNIT_VF_MAX, &b);
+	} else if (!ret) {
+		/* bare, a is the VF */
+		b = a;
+		a = 0;
+		if (b > ADMIN_UNIT_VF_MAX)
+			ret = -ERANGE;
+	}
+	if (ret)
+		return ret;
+	while (*s == ' ' || *s == '\t' || *s == '\n')
+		s++;
+	if (*s)
+		return -EINVAL;
+	*pf = a;
+	*vf = b;
+	return 0;
+}
+
+/* bytes of x that are not zero */
+static inline unsigned int admin_unit_nonzero_bytes(u64 x)
+{
+	const u64 lo7 = 0x7f7f7f7f7f7f7f7fULL;
+
+	/* the top bit of each byte of x set iff that byte is non zero */
+	x = ((x & lo7) + lo7) | x;
+	return admin_unit_popcount64(x & ~lo7);
+}
+
+/*
+ * Count the bytes that differ between a and b, a word at a time.  *first
+ * is the offset of the first differing byte, len when they are equal.
+ */
+size_t admin_unit_core_diff(const u8 *a, const u8 *b, size_t len,
+			    size_t *first)
+{
+	size_t i = 0, j, bytes = 0;
+	u64 wa, wb, x;
+
+	*first = len;
+	for (; i + sizeof(u64) <= len; i += sizeof(u64)) {
+		memcpy(&wa, a + i, sizeof(wa));
+		memcpy(&wb, b + i, sizeof(wb));
+		x = wa ^ wb;
+		if (!x)
+			continue;
+		if (*first == len) {
+			j = i;
+			while (a[j] == b[j])
+				j++;
+			*first = j;
+		}
+		bytes += admin_unit_nonzero_bytes(x);
+	}
+	for (; i < len; i++) {
+		if (a[i] == b[i])
+			continue;
+		if (*first == len)
+			*first = i;
+		bytes++;
+	}
+	return bytes;
+}
+
+/* bucket of ns: its top three significant bits, exact below 4 */
+static int admin_unit_hist_bucket(u64 ns)
+{
+	int msb;
+
+	if (ns < 4)
+		return ns;
+	msb = admin_unit_fls64(ns) - 1;
+	return (msb - 1) * 4 + ((ns >> (msb - 2)) & 3);
+}
+
+/* smallest ns falling into bucket b */
+static u64 admin_unit_hist_floor(int b)
+{
+	if (b < 4)
+		return b;
+	return (u64)(4 + b % 4) << (b / 4 - 1);
+}
+
+void admin_unit_hist_add(struct admin_unit_hist *h, u64 ns)
+{
+	h->cnt[admin_unit_hist_bucket(ns)]++;
+	h->n++;
+	h->sum += ns;
+	if (ns > h->max)
+		h->max = ns;
+}
+
+void admin_unit_hist_merge(struct admin_unit_hist *h,
+			   const struct admin_unit_hist *from)
+{
+	int i;
+
+	for (i = 0; i < ADMIN_UNIT_HIST_BUCKETS; i++)
+		h->cnt[i] += from->cnt[i];
+	h->n += from->n;
+	h->sum += from->sum;
+	if (from->max > h->max)
+		h->max = from->max;
+}
+
+/* upper bound of the permille-th percentile, 0 when empty */
+u64 admin_unit_hist_pct(const struct admin_unit_hist *h, u32 permille)
+{
+	u64 cum = 0;
+	int i;
+
+	for (i = 0; i < ADMIN_UNIT_HIST_BUCKETS - 1; i++) {
+		cum += h->cnt[i];
+		/* cum / n >= permille / 1000, without dividing */
+		if (cum && cum * 1000 >= h->n * permille)
+			return min_t(u64, admin_unit_hist_floor(i + 1) - 1,
+				     h->max);
+	}
+	return h->max;
+}
+
+void admin_unit_fake_fill(u8 *p, size_t len, u64 off)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		p[i] = admin_unit_fake_byte(off + i);
+}
+
+bool admin_unit_fake_check(const u8 *p, size_t len, u64 off)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		if (p[i] != admin_unit_fake_byte(off + i))
+			return false;
+	return true;
+}
+
+/* count a command, failing every fail_every-th one with -EIO */
+int admin_unit_fake_cmd(struct admin_unit_fake *fk, u32 fail_every)
+{
+	fk->cmds++;
+	if (fail_every && !(fk->cmds % fail_every))
+		return -EIO;
+	return 0;
+}
+
+int admin_unit_fake_mode_set(struct admin_unit_fake *fk, u8 mode, u8 max_mode)
+{
+	if (mode > max_mode)
+		return -EINVAL;
+	fk->mode = mode;
+	/* a restore starts over on every mode change */
+	fk->wr_off = 0;
+	return 0;
+}
+
+void admin_unit_fake_size_get(struct admin_unit_fake *fk)
+{
+	fk->rd_off = 0;
+}
+
+/* read up to *len bytes of a size byte ctx, returns the ctx offset read at */
+u64 admin_unit_fake_rd(struct admin_unit_fake *fk, u64 size, u64 *len)
+{
+	u64 off = min_t(u64, fk->rd_off, size);
+
+	*len = min_t(u64, *len, size - off);
+	fk->rd_off = off + *len;
+	return off;
+}
+
+/* a write of len bytes must fit; the caller checks it at wr_off, then advances */
+int admin_unit_fake_wr_room(struct admin_unit_fake *fk, u64 size, u64 len)
+{
+	return fk->wr_off + len > size ? -EINVAL : 0;
+}
+
+void admin_unit_fake_discard(struct admin_unit_fake *fk)
+{
+	fk->rd_off = 0;
+	fk->wr_off = 0;
+}
+
+static int admin_unit_fake_dev_sz_get(void *priv, u64 *size)
+{
+	struct admin_unit_fake_dev *dev = priv;
+	int ret;
+
+	ret = admin_unit_fake_cmd(&dev->fk, dev->fail_every);
+	if (ret)
+		return ret;
+	admin_unit_fake_size_get(&dev->fk);
+	*size = dev->size;
+	return 0;
+}
+
+static int admin_unit_fake_dev_rd(void *priv, u64 off, u32 len, u32 *rd_sz,
+				  u32 *remaining)
+{
+	struct admin_unit_fake_dev *dev = priv;
+	u64 n = len, at;
+	int ret;
+
+	ret = admin_unit_fake_cmd(&dev->fk, dev->fail_every);
+	if (ret)
+		return ret;
+	if (off + len > dev->size)
+		return -EINVAL;
+	at = admin_unit_fake_rd(&dev->fk, dev->size, &n);
+	admin_unit_fake_fill(dev->ctx + off, n, at);
+	*rd_sz = n;
+	*remaining = dev->size - dev->fk.rd_off;
+	return 0;
+}
+
+static int admin_unit_fake_dev_wr(void *priv, u64 off, u32 len)
+{
+	struct admin_unit_fake_dev *dev = priv;
+	int ret;
+
+	ret = admin_unit_fake_cmd(&dev->fk, dev->fail_every);
+	if (ret)
+		return ret;
+	if (off + len > dev->size)
+		return -EINVAL;
+	ret = admin_unit_fake_wr_room(&dev->fk, dev->size, len);
+	if (ret)
+		return ret;
+	if (!admin_unit_fake_check(dev->ctx + off, len, dev->fk.wr_off))
+		return -EIO;
+	dev->fk.wr_off += len;
+	return 0;
+}
+
+const struct admin_unit_core_ops admin_unit_fake_dev_ops = {
+	.ctx_sz_get	= admin_unit_fake_dev_sz_get,
+	.ctx_rd		= admin_unit_fake_dev_rd,
+	.ctx_wr		= admin_unit_fake_dev_wr,
+};
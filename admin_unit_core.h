@@ -0,0 +1,214 @@
+/*
+ * admin_unit_core.h -- transport-agnostic core of admin_unit_test
+ *
+ * Copyright (C) 2024 Feng Liu
+ *
+ * Ctx windowing, chunk size calibration and the fake device model.
+ * Nothing here knows about pci_dev, virtqueues or proc: commands reach
+ * the device through struct admin_unit_core_ops.  Built into the module,
+ * and without __KERNEL__ into libadmin_unit_core.a, so the same code
+ * runs under perf, valgrind or a benchmark harness in user space.
+ */
+
+#ifndef _ADMIN_UNIT_CORE_H
+#define _ADMIN_UNIT_CORE_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/string.h>
+#include <linux/ktime.h>
+#include <linux/bitops.h>
+
+static inline u64 admin_unit_now_ns(void)
+{
+	return ktime_get_ns();
+}
+
+#define admin_unit_popcount64(x)	hweight64(x)
+#define admin_unit_fls64(x)		fls64(x)
+#else
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#define min_t(type, a, b)	((type)(a) < (type)(b) ? (type)(a) : (type)(b))
+#define max_t(type, a, b)	((type)(a) > (type)(b) ? (type)(a) : (type)(b))
+
+#define admin_unit_popcount64(x)	__builtin_popcountll(x)
+#define admin_unit_fls64(x)		((x) ? 64 - __builtin_clzll(x) : 0)
+
+static inline u64 admin_unit_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+/*
+ * Chunk size of the partial ctx read/write commands: the legacy 200
+ * bytes until the PF has been calibrated with chunk_tune, which sweeps
+ * powers of two between CHUNK_MIN and CHUNK_MAX.
+ */
+#define ADMIN_UNIT_CHUNK_AUTO	(0)
+#define ADMIN_UNIT_CHUNK_DEF	(200)
+#define ADMIN_UNIT_CHUNK_MIN	(256)
+#define ADMIN_UNIT_CHUNK_MAX	(64 * 1024)
+#define ADMIN_UNIT_CHUNK_STEPS	(9)
+
+/* a saved ctx moves at most one window per admin command */
+#define ADMIN_UNIT_CTX_WIN	(1024 * 1024)
+
+/*
+ * Ctx commands of one device.  ctx_rd and ctx_wr move [off, off + len)
+ * of the caller's ctx; ctx_rd also reports the bytes the device actually
+ * returned and what is left on it, and ctx_sz_get restarts the device
+ * side read stream.
+ */
+struct admin_unit_core_ops {
+	int (*ctx_sz_get)(void *priv, u64 *size);
+	int (*ctx_rd)(void *priv, u64 off, u32 len, u32 *rd_sz,
+		      u32 *remaining);
+	int (*ctx_wr)(void *priv, u64 off, u32 len);
+};
+
+struct admin_unit_xfer {
+	u64 bytes;
+	u32 cmds;
+};
+
+/*
+ * Cursor of the partial ctx read/write commands over a size byte ctx:
+ * the next command moves from off, and left bytes are still to move.
+ */
+struct admin_unit_cursor {
+	u64 size;
+	u64 off;
+	u64 left;
+};
+
+static inline void admin_unit_cursor_init(struct admin_unit_cursor *c,
+					  u64 size)
+{
+	c->size = size;
+	c->off = 0;
+	c->left = size;
+}
+
+/* one point of a chunk_tune sweep */
+struct admin_unit_chunk_res {
+	u32 size;
+	u32 cmds;
+	u64 bytes;
+	u64 ns;
+};
+
+int admin_unit_core_xfer(const struct admin_unit_core_ops *ops, void *priv,
+			 bool wr, u64 off, u64 len, u32 win,
+			 struct admin_unit_xfer *x);
+int admin_unit_core_partial(const struct admin_unit_core_ops *ops, void *priv,
+			    struct admin_unit_cursor *c, bool wr, u64 sz,
+			    bool all, u32 win, struct admin_unit_xfer *x);
+int admin_unit_core_chunk_measure(const struct admin_unit_core_ops *ops,
+				  void *priv, u32 sz,
+				  struct admin_unit_chunk_res *r);
+int admin_unit_core_chunk_sweep(const struct admin_unit_core_ops *ops,
+				void *priv, struct admin_unit_chunk_res *res,
+				int *nr);
+
+/*
+ * Layout of a saved ctx, as in the virtio device context: a le32 field
+ * count, then the fields back to back, each a TLV header (le32 type,
+ * le32 reserved, le64 length) followed by length bytes of value.
+ */
+#define ADMIN_UNIT_CTX_HDR_SZ	4
+#define ADMIN_UNIT_TLV_HDR_SZ	16
+
+struct admin_unit_tlv {
+	u32 type;
+	/* the value, in bytes from the start of the ctx */
+	u64 off;
+	u64 len;
+};
+
+u32 admin_unit_core_le32(const u8 *p);
+u64 admin_unit_core_le64(const u8 *p);
+int admin_unit_core_tlv_parse(const u8 *hdr, u64 pos, u64 size,
+			      struct admin_unit_tlv *f);
+
+/* VFs are named "<pf>:<vf>", the id packing both in 16 bits each */
+#define ADMIN_UNIT_PF_MAX	0xffff
+#define ADMIN_UNIT_VF_MAX	0xffff
+
+int admin_unit_core_vf_id_parse(const char *s, u32 *pf, u32 *vf);
+
+size_t admin_unit_core_diff(const u8 *a, const u8 *b, size_t len,
+			    size_t *first);
+
+/*
+ * Latency histogram with four buckets per power of two, so percentiles
+ * come out within 25% without keeping the samples.
+ */
+#define ADMIN_UNIT_HIST_BUCKETS	256
+
+struct admin_unit_hist {
+	u64 cnt[ADMIN_UNIT_HIST_BUCKETS];
+	u64 n;
+	u64 sum;
+	u64 max;
+};
+
+void admin_unit_hist_add(struct admin_unit_hist *h, u64 ns);
+void admin_unit_hist_merge(struct admin_unit_hist *h,
+			   const struct admin_unit_hist *from);
+u64 admin_unit_hist_pct(const struct admin_unit_hist *h, u32 permille);
+
+/*
+ * The fake device model: a ctx of a fixed pattern that reads stream out
+ * and writes are checked against, so a wrong offset shows up as -EIO.
+ * Callers serialize access to a struct admin_unit_fake.
+ */
+struct admin_unit_fake {
+	u8 mode;
+	u64 rd_off;
+	u64 wr_off;
+	u64 cmds;
+};
+
+static inline u8 admin_unit_fake_byte(u64 off)
+{
+	return (u8)(off * 31 + 7);
+}
+
+void admin_unit_fake_fill(u8 *p, size_t len, u64 off);
+bool admin_unit_fake_check(const u8 *p, size_t len, u64 off);
+int admin_unit_fake_cmd(struct admin_unit_fake *fk, u32 fail_every);
+int admin_unit_fake_mode_set(struct admin_unit_fake *fk, u8 mode, u8 max_mode);
+void admin_unit_fake_size_get(struct admin_unit_fake *fk);
+u64 admin_unit_fake_rd(struct admin_unit_fake *fk, u64 size, u64 *len);
+int admin_unit_fake_wr_room(struct admin_unit_fake *fk, u64 size, u64 len);
+void admin_unit_fake_discard(struct admin_unit_fake *fk);
+
+/* a fake device behind admin_unit_fake_dev_ops, for user space harnesses */
+struct admin_unit_fake_dev {
+	struct admin_unit_fake fk;
+	u64 size;
+	u32 fail_every;
+	/* host side ctx, size bytes */
+	u8 *ctx;
+};
+
+extern const struct admin_unit_core_ops admin_unit_fake_dev_ops;
+
+#endif /* _ADMIN_UNIT_CORE_H */
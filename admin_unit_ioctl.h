@@ -0,0 +1,106 @@
+/*
+ * admin_unit_ioctl.h -- binary interface of /dev/admin_unit
+ *
+ * Copyright (C) 2024 Feng Liu
+ *
+ * Shared between the admin_unit_test module and user space tools.
+ */
+
+#ifndef _ADMIN_UNIT_IOCTL_H
+#define _ADMIN_UNIT_IOCTL_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+enum admin_unit_op {
+	ADMIN_UNIT_OP_LIST_QUERY = 1,	/* addr/len: op list bitmap out */
+	ADMIN_UNIT_OP_MODE_GET,		/* addr/len: dev mode out */
+	ADMIN_UNIT_OP_MODE_SET,		/* arg: VIRTIO_ADMIN_DEV_MODE_* */
+	ADMIN_UNIT_OP_CTX_SZ_GET,	/* arg out: ctx size */
+	ADMIN_UNIT_OP_CTX_RD,		/* addr/len: ctx out, written by the
+					 * device in place, up to the PF's
+					 * ctx window (at most 1 MB),
+					 * len out: read, arg out: remaining */
+	ADMIN_UNIT_OP_CTX_WR,		/* addr/len: ctx in, read by the
+					 * device in place, up to 1 GB */
+	ADMIN_UNIT_OP_FIELD_QUERY,	/* addr/len: supported fields out */
+	ADMIN_UNIT_OP_DISCARD,
+	ADMIN_UNIT_OP_MAX,
+};
+
+/* admin_unit_cmd_desc.flags */
+#define ADMIN_UNIT_DESC_F_FREEZE	(1 << 0)	/* CTX_SZ_GET in freeze mode */
+
+/* VF address, same "<pf>:<vf>" numbering as /proc/admin_unit/devices */
+#define ADMIN_UNIT_VF(pf, vf)		(((__u32)(pf) << 16) | ((vf) & 0xffff))
+
+struct admin_unit_cmd_desc {
+	__u16 opcode;		/* enum admin_unit_op */
+	__u16 flags;
+	__u32 vf;		/* ADMIN_UNIT_VF(pf, vf) */
+	__u64 addr;		/* user buffer */
+	__u64 len;
+	__u64 arg;
+	__s32 status;		/* out: 0 or -errno */
+	__u32 rsvd;
+	__u64 latency_ns;	/* out: time spent in the admin command */
+};
+
+/* admin_unit_cmd_vec.flags */
+#define ADMIN_UNIT_VEC_F_STOP_ON_ERR	(1 << 0)
+
+#define ADMIN_UNIT_VEC_MAX		1024
+
+struct admin_unit_cmd_vec {
+	__u64 descs;		/* array of struct admin_unit_cmd_desc */
+	__u32 nr;
+	__u32 flags;
+};
+
+#define ADMIN_UNIT_IOC_MAGIC		'V'
+
+/* returns the number of descriptors executed */
+#define ADMIN_UNIT_IOC_SUBMIT		_IOW(ADMIN_UNIT_IOC_MAGIC, 1, \
+					     struct admin_unit_cmd_vec)
+
+/*
+ * IORING_OP_URING_CMD with cmd_op ADMIN_UNIT_URING_CMD_DESC: the SQE cmd
+ * area holds the address of one struct admin_unit_cmd_desc, which is
+ * updated like an ioctl descriptor before the CQE is posted; cqe->res
+ * is the descriptor status.
+ */
+struct admin_unit_uring_sqe {
+	__u64 desc;
+};
+
+#define ADMIN_UNIT_URING_CMD_DESC	_IOW(ADMIN_UNIT_IOC_MAGIC, 2, \
+					     struct admin_unit_cmd_desc)
+
+/*
+ * Command trace, as read from and written back to /proc/admin_unit/trace:
+ * a struct admin_unit_trace_hdr, then hdr.nr records in issue order.
+ */
+#define ADMIN_UNIT_TRACE_MAGIC		0x52545541	/* "AUTR" */
+#define ADMIN_UNIT_TRACE_VERSION	1
+
+struct admin_unit_trace_hdr {
+	__u32 magic;
+	__u16 version;
+	__u16 rec_size;		/* sizeof(struct admin_unit_trace_rec) */
+	__u32 nr;
+	__u32 dropped;		/* older records overwritten in the ring */
+};
+
+struct admin_unit_trace_rec {
+	__u64 ts_ns;		/* issue time, from the start of the trace */
+	__u64 arg;		/* data of at most 8 bytes: the mode, freeze flag */
+	__u32 vf;		/* ADMIN_UNIT_VF(pf, vf) */
+	__u32 lat_ns;		/* including the PF scheduler, saturated */
+	__u32 in_len;		/* data bytes to the device */
+	__u32 out_len;		/* result bytes from the device */
+	__u16 opcode;		/* VIRTIO_ADMIN_CMD_* */
+	__u16 rsvd;
+	__s32 status;
+};
+
+#endif /* _ADMIN_UNIT_IOCTL_H */
@@ -0,0 +1,378 @@
+/*
+ * admin_unit_kunit.c -- KUnit suite of the admin_unit core
+ *
+ * Copyright (C) 2024 Feng Liu
+ *
+ * Runs the transport-agnostic core against the fake device model through
+ * admin_unit_core_ops, with no pci_dev or virtqueue: windowed ctx reads
+ * and writes, the partial read/write cursor, short and failing device
+ * commands, the chunk sweep, TLV parsing, ctx diff, the latency
+ * histogram and VF id parsing.  Every case builds its own fake device,
+ * so nothing is shared with the module or with other cases.
+ *
+ * Only what lives in admin_unit_core is covered.  The opcode handlers
+ * of admin_unit_main.c, their virtqueue commands and proc parsing are
+ * not, beyond the cursor they move through admin_unit_core_partial();
+ * neither are the timing baselines, which the in-module selftest checks
+ * with fake_transport=1.
+ *
+ * Built as admin_unit_kunit.ko with "make ADMIN_UNIT_KUNIT=m", or in
+ * tree through CONFIG_ADMIN_UNIT_KUNIT_TEST:
+ *
+ *	./tools/testing/kunit/kunit.py run --kunitconfig=<this dir>
+ */
+
+#include <kunit/test.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+
+/* the core is linked into the test module, not taken from the module */
+#include "admin_unit_core.c"
+
+/* not a multiple of any window, so the last command is a short one */
+#define ADMIN_UNIT_KT_CTX_SZ	(64 * 1024 + 100)
+#define ADMIN_UNIT_KT_WIN	4096
+
+static struct admin_unit_fake_dev *admin_unit_kt_dev(struct kunit *test)
+{
+	struct admin_unit_fake_dev *dev;
+
+	dev = kunit_kzalloc(test, sizeof(*dev), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, dev);
+	dev->size = ADMIN_UNIT_KT_CTX_SZ;
+	dev->ctx = kunit_kzalloc(test, dev->size, GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, dev->ctx);
+	return dev;
+}
+
+static void admin_unit_kt_rd_full(struct kunit *test)
+{
+	struct admin_unit_fake_dev *dev = admin_unit_kt_dev(test);
+	struct admin_unit_xfer x;
+	u64 size;
+
+	KUNIT_ASSERT_EQ(test, admin_unit_fake_dev_ops.ctx_sz_get(dev, &size), 0);
+	KUNIT_EXPECT_EQ(test, size, dev->size);
+	KUNIT_EXPECT_EQ(test, admin_unit_core_xfer(&admin_unit_fake_dev_ops, dev,
+						   false, 0, size,
+						   ADMIN_UNIT_KT_WIN, &x), 0);
+	KUNIT_EXPECT_EQ(test, x.bytes, size);
+	KUNIT_EXPECT_EQ(test, x.cmds, DIV_ROUND_UP_ULL(size, ADMIN_UNIT_KT_WIN));
+	KUNIT_EXPECT_TRUE(test, admin_unit_fake_check(dev->ctx, size, 0));
+	KUNIT_EXPECT_EQ(test, dev->fk.rd_off, size);
+}
+
+static void admin_unit_kt_wr_full(struct kunit *test)
+{
+	struct admin_unit_fake_dev *dev = admin_unit_kt_dev(test);
+	struct admin_unit_xfer x;
+
+	admin_unit_fake_fill(dev->ctx, dev->size, 0);
+	KUNIT_EXPECT_EQ(test, admin_unit_core_xfer(&admin_unit_fake_dev_ops, dev,
+						   true, 0, dev->size,
+						   ADMIN_UNIT_KT_WIN, &x), 0);
+	KUNIT_EXPECT_EQ(test, x.bytes, dev->size);
+	KUNIT_EXPECT_EQ(test, dev->fk.wr_off, dev->size);
+
+	/* a corrupted byte is caught at its offset */
+	admin_unit_fake_discard(&dev->fk);
+	dev->ctx[dev->size / 2] ^= 0xff;
+	KUNIT_EXPECT_EQ(test, admin_unit_core_xfer(&admin_unit_fake_dev_ops, dev,
+						   true, 0, dev->size,
+						   ADMIN_UNIT_KT_WIN, &x), -EIO);
+	KUNIT_EXPECT_EQ(test, x.bytes,
+			round_down(dev->size / 2, ADMIN_UNIT_KT_WIN));
+}
+
+/*
+ * The cursor of dev_ctx_rd_partial and _wr_partial, which both move it
+ * through admin_unit_core_partial().
+ */
+static void admin_unit_kt_partial(struct kunit *test)
+{
+	struct admin_unit_fake_dev *dev = admin_unit_kt_dev(test);
+	struct admin_unit_cursor cur;
+	struct admin_unit_xfer x;
+	u32 chunk = 1000;
+	u64 size;
+	int i;
+
+	KUNIT_ASSERT_EQ(test, admin_unit_fake_dev_ops.ctx_sz_get(dev, &size), 0);
+	admin_unit_cursor_init(&cur, size);
+	for (i = 1; i <= 3; i++) {
+		KUNIT_ASSERT_EQ(test,
+			admin_unit_core_partial(&admin_unit_fake_dev_ops, dev,
+						&cur, false, chunk, false,
+						ADMIN_UNIT_KT_WIN, &x), 0);
+		KUNIT_EXPECT_EQ(test, x.bytes, chunk);
+		KUNIT_EXPECT_EQ(test, cur.off, i * chunk);
+		KUNIT_EXPECT_EQ(test, cur.left, size - i * chunk);
+	}
+	/* the rest, after which the cursor rewinds for the next pass */
+	KUNIT_ASSERT_EQ(test, admin_unit_core_partial(&admin_unit_fake_dev_ops,
+						      dev, &cur, false, chunk,
+						      true, ADMIN_UNIT_KT_WIN,
+						      &x), 0);
+	KUNIT_EXPECT_EQ(test, x.bytes, size - 3 * chunk);
+	KUNIT_EXPECT_EQ(test, cur.off, 0);
+	KUNIT_EXPECT_EQ(test, cur.left, size);
+	KUNIT_EXPECT_TRUE(test, admin_unit_fake_check(dev->ctx, size, 0));
+
+	/* writes move the cursor and the device offset alike */
+	for (i = 1; cur.left > chunk; i++) {
+		KUNIT_ASSERT_EQ(test,
+			admin_unit_core_partial(&admin_unit_fake_dev_ops, dev,
+						&cur, true, chunk, false,
+						ADMIN_UNIT_KT_WIN, &x), 0);
+		KUNIT_EXPECT_EQ(test, cur.off, i * chunk);
+		KUNIT_EXPECT_EQ(test, dev->fk.wr_off, cur.off);
+	}
+	/* the last chunk is short */
+	KUNIT_ASSERT_EQ(test, admin_unit_core_partial(&admin_unit_fake_dev_ops,
+						      dev, &cur, true, chunk,
+						      false, ADMIN_UNIT_KT_WIN,
+						      &x), 0);
+	KUNIT_EXPECT_EQ(test, x.bytes, size % chunk);
+	KUNIT_EXPECT_EQ(test, cur.left, 0);
+	KUNIT_EXPECT_EQ(test, dev->fk.wr_off, size);
+	/* nothing left to write is not an error */
+	KUNIT_EXPECT_EQ(test, admin_unit_core_partial(&admin_unit_fake_dev_ops,
+						      dev, &cur, true, chunk,
+						      false, ADMIN_UNIT_KT_WIN,
+						      &x), 0);
+	KUNIT_EXPECT_EQ(test, x.cmds, 0);
+}
+
+/* a failing command leaves the cursor after what did move */
+static void admin_unit_kt_partial_error(struct kunit *test)
+{
+	struct admin_unit_fake_dev *dev = admin_unit_kt_dev(test);
+	struct admin_unit_cursor cur;
+	struct admin_unit_xfer x;
+	u64 size;
+
+	/* the size get is command 1, the third window command 4 */
+	dev->fail_every = 4;
+	KUNIT_ASSERT_EQ(test, admin_unit_fake_dev_ops.ctx_sz_get(dev, &size), 0);
+	admin_unit_cursor_init(&cur, size);
+	KUNIT_EXPECT_EQ(test, admin_unit_core_partial(&admin_unit_fake_dev_ops,
+						      dev, &cur, false,
+						      4 * ADMIN_UNIT_KT_WIN,
+						      false, ADMIN_UNIT_KT_WIN,
+						      &x), -EIO);
+	KUNIT_EXPECT_EQ(test, cur.off, 2 * ADMIN_UNIT_KT_WIN);
+	KUNIT_EXPECT_EQ(test, cur.left, size - 2 * ADMIN_UNIT_KT_WIN);
+}
+
+/* a read of more than is left on the device stops where the ctx ends */
+static void admin_unit_kt_rd_end(struct kunit *test)
+{
+	struct admin_unit_fake_dev *dev = admin_unit_kt_dev(test);
+	struct admin_unit_xfer x;
+	u64 size, half;
+
+	KUNIT_ASSERT_EQ(test, admin_unit_fake_dev_ops.ctx_sz_get(dev, &size), 0);
+	half = size / 2;
+	KUNIT_ASSERT_EQ(test, admin_unit_core_xfer(&admin_unit_fake_dev_ops, dev,
+						   false, 0, half,
+						   ADMIN_UNIT_CTX_WIN, &x), 0);
+	/* the device streams on from half, the caller asks from 0 again */
+	KUNIT_EXPECT_EQ(test, admin_unit_core_xfer(&admin_unit_fake_dev_ops, dev,
+						   false, 0, size,
+						   ADMIN_UNIT_CTX_WIN, &x), 0);
+	KUNIT_EXPECT_EQ(test, x.bytes, size - half);
+	KUNIT_EXPECT_EQ(test, x.cmds, 1);
+	KUNIT_EXPECT_TRUE(test, admin_unit_fake_check(dev->ctx, size - half,
+						      half));
+}
+
+/* returns half of each window while the device still has more */
+static int admin_unit_kt_short_rd(void *priv, u64 off, u32 len, u32 *rd_sz,
+				  u32 *remaining)
+{
+	return admin_unit_fake_dev_ops.ctx_rd(priv, off, len / 2, rd_sz,
+					      remaining);
+}
+
+/* claims one byte more than the window it was given */
+static int admin_unit_kt_over_rd(void *priv, u64 off, u32 len, u32 *rd_sz,
+				 u32 *remaining)
+{
+	int ret;
+
+	ret = admin_unit_fake_dev_ops.ctx_rd(priv, off, len, rd_sz, remaining);
+	(*rd_sz)++;
+	return ret;
+}
+
+static void admin_unit_kt_bad_rd(struct kunit *test)
+{
+	struct admin_unit_fake_dev *dev = admin_unit_kt_dev(test);
+	struct admin_unit_core_ops ops = admin_unit_fake_dev_ops;
+	struct admin_unit_xfer x;
+	u64 size;
+
+	ops.ctx_rd = admin_unit_kt_short_rd;
+	KUNIT_ASSERT_EQ(test, ops.ctx_sz_get(dev, &size), 0);
+	KUNIT_EXPECT_EQ(test, admin_unit_core_xfer(&ops, dev, false, 0, size,
+						   ADMIN_UNIT_KT_WIN, &x), -EIO);
+	KUNIT_EXPECT_EQ(test, x.cmds, 0);
+
+	ops.ctx_rd = admin_unit_kt_over_rd;
+	KUNIT_ASSERT_EQ(test, ops.ctx_sz_get(dev, &size), 0);
+	KUNIT_EXPECT_EQ(test, admin_unit_core_xfer(&ops, dev, false, 0, size,
+						   ADMIN_UNIT_KT_WIN, &x), -EIO);
+	KUNIT_EXPECT_EQ(test, x.bytes, 0);
+}
+
+static void admin_unit_kt_dev_error(struct kunit *test)
+{
+	struct admin_unit_fake_dev *dev = admin_unit_kt_dev(test);
+	struct admin_unit_xfer x;
+	u64 size;
+
+	/* the size get is command 1, the third window command 4 */
+	dev->fail_every = 4;
+	KUNIT_ASSERT_EQ(test, admin_unit_fake_dev_ops.ctx_sz_get(dev, &size), 0);
+	KUNIT_EXPECT_EQ(test, admin_unit_core_xfer(&admin_unit_fake_dev_ops, dev,
+						   false, 0, size,
+						   ADMIN_UNIT_KT_WIN, &x), -EIO);
+	KUNIT_EXPECT_EQ(test, x.cmds, 2);
+	KUNIT_EXPECT_EQ(test, x.bytes, 2 * ADMIN_UNIT_KT_WIN);
+}
+
+static void admin_unit_kt_chunk_sweep(struct kunit *test)
+{
+	struct admin_unit_fake_dev *dev = admin_unit_kt_dev(test);
+	struct admin_unit_chunk_res res[ADMIN_UNIT_CHUNK_STEPS];
+	int i, nr, best;
+
+	best = admin_unit_core_chunk_sweep(&admin_unit_fake_dev_ops, dev, res,
+					   &nr);
+	KUNIT_ASSERT_GE(test, best, 0);
+	KUNIT_ASSERT_LT(test, best, nr);
+	for (i = 0; i < nr; i++) {
+		KUNIT_EXPECT_EQ(test, res[i].bytes, dev->size);
+		KUNIT_EXPECT_EQ(test, res[i].cmds,
+				DIV_ROUND_UP_ULL(dev->size, res[i].size));
+	}
+
+	/* nothing to read */
+	dev->size = 0;
+	KUNIT_EXPECT_EQ(test, admin_unit_core_chunk_sweep(&admin_unit_fake_dev_ops,
+							  dev, res, &nr),
+			-ENODATA);
+	KUNIT_EXPECT_EQ(test, nr, 0);
+}
+
+static void admin_unit_kt_tlv(struct kunit *test)
+{
+	u8 hdr[ADMIN_UNIT_TLV_HDR_SZ] = {
+		0x34, 0x12, 0, 0,	/* type */
+		0, 0, 0, 0,		/* reserved */
+		0x20, 0, 0, 0, 0, 0, 0, 0,	/* length */
+	};
+	struct admin_unit_tlv f;
+
+	KUNIT_ASSERT_EQ(test, admin_unit_core_tlv_parse(hdr, 4, 52, &f), 0);
+	KUNIT_EXPECT_EQ(test, f.type, 0x1234);
+	KUNIT_EXPECT_EQ(test, f.off, 20);
+	KUNIT_EXPECT_EQ(test, f.len, 0x20);
+	/* the value runs one byte past the end */
+	KUNIT_EXPECT_EQ(test, admin_unit_core_tlv_parse(hdr, 4, 51, &f), -EINVAL);
+	/* the header itself does not fit */
+	KUNIT_EXPECT_EQ(test, admin_unit_core_tlv_parse(hdr, 40, 52, &f), -EINVAL);
+}
+
+static void admin_unit_kt_diff(struct kunit *test)
+{
+	u8 a[37], b[37];
+	size_t first;
+
+	admin_unit_fake_fill(a, sizeof(a), 0);
+	memcpy(b, a, sizeof(b));
+	KUNIT_EXPECT_EQ(test, admin_unit_core_diff(a, b, sizeof(a), &first), 0);
+	KUNIT_EXPECT_EQ(test, first, sizeof(a));
+
+	/* one byte inside a word, two in the unaligned tail */
+	b[9] ^= 1;
+	b[33] ^= 1;
+	b[36] ^= 0x80;
+	KUNIT_EXPECT_EQ(test, admin_unit_core_diff(a, b, sizeof(a), &first), 3);
+	KUNIT_EXPECT_EQ(test, first, 9);
+}
+
+static void admin_unit_kt_hist(struct kunit *test)
+{
+	struct admin_unit_hist *h, *m;
+	int i;
+
+	h = kunit_kzalloc(test, sizeof(*h), GFP_KERNEL);
+	m = kunit_kzalloc(test, sizeof(*m), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, h);
+	KUNIT_ASSERT_NOT_NULL(test, m);
+
+	KUNIT_EXPECT_EQ(test, admin_unit_hist_pct(h, 500), 0);
+	for (i = 1; i <= 1000; i++)
+		admin_unit_hist_add(h, i * 1000);
+	KUNIT_EXPECT_EQ(test, h->n, 1000);
+	KUNIT_EXPECT_EQ(test, h->max, 1000000);
+	/* within the 25% of one bucket above the exact percentile */
+	KUNIT_EXPECT_GE(test, admin_unit_hist_pct(h, 500), 500000);
+	KUNIT_EXPECT_LE(test, admin_unit_hist_pct(h, 500), 625000);
+	KUNIT_EXPECT_EQ(test, admin_unit_hist_pct(h, 1000), 1000000);
+
+	admin_unit_hist_add(m, 5000000);
+	admin_unit_hist_merge(h, m);
+	KUNIT_EXPECT_EQ(test, h->n, 1001);
+	KUNIT_EXPECT_EQ(test, h->max, 5000000);
+}
+
+static void admin_unit_kt_vf_id(struct kunit *test)
+{
+	u32 pf, vf;
+
+	KUNIT_ASSERT_EQ(test, admin_unit_core_vf_id_parse("2:5", &pf, &vf), 0);
+	KUNIT_EXPECT_EQ(test, pf, 2);
+	KUNIT_EXPECT_EQ(test, vf, 5);
+	/* a bare VF is on PF 0, not PF <vf> */
+	KUNIT_ASSERT_EQ(test, admin_unit_core_vf_id_parse("3\n", &pf, &vf), 0);
+	KUNIT_EXPECT_EQ(test, pf, 0);
+	KUNIT_EXPECT_EQ(test, vf, 3);
+
+	KUNIT_EXPECT_EQ(test, admin_unit_core_vf_id_parse("", &pf, &vf), -EINVAL);
+	KUNIT_EXPECT_EQ(test, admin_unit_core_vf_id_parse("1:", &pf, &vf),
+			-EINVAL);
+	KUNIT_EXPECT_EQ(test, admin_unit_core_vf_id_parse("1:2x", &pf, &vf),
+			-EINVAL);
+	KUNIT_EXPECT_EQ(test, admin_unit_core_vf_id_parse("0:65536", &pf, &vf),
+			-ERANGE);
+	KUNIT_EXPECT_EQ(test, admin_unit_core_vf_id_parse("65536", &pf, &vf),
+			-ERANGE);
+}
+
+static struct kunit_case admin_unit_core_cases[] = {
+	KUNIT_CASE(admin_unit_kt_rd_full),
+	KUNIT_CASE(admin_unit_kt_wr_full),
+	KUNIT_CASE(admin_unit_kt_partial),
+	KUNIT_CASE(admin_unit_kt_partial_error),
+	KUNIT_CASE(admin_unit_kt_rd_end),
+	KUNIT_CASE(admin_unit_kt_bad_rd),
+	KUNIT_CASE(admin_unit_kt_dev_error),
+	KUNIT_CASE(admin_unit_kt_chunk_sweep),
+	KUNIT_CASE(admin_unit_kt_tlv),
+	KUNIT_CASE(admin_unit_kt_diff),
+	KUNIT_CASE(admin_unit_kt_hist),
+	KUNIT_CASE(admin_unit_kt_vf_id),
+	{}
+};
+
+static struct kunit_suite admin_unit_core_suite = {
+	.name = "admin_unit_core",
+	.test_cases = admin_unit_core_cases,
+};
+
+kunit_test_suite(admin_unit_core_suite);
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("KUnit suite of the admin_unit core");
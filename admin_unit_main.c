@@ -0,0 +1,7183 @@
+/*
+ * admin_unit_main.c -- virtio admin command unit test module
+ *
+ * Copyright (C) 2001,2024 Feng Liu
+ *
+ * The source code in this file can be freely used, adapted,
+ * and redistributed in source or binary form, so long as an
+ * acknowledgment appears in derived source files.  The citation
+ * should list that the code comes from the book "Linux Device
+ * Drivers" by Alessandro Rubini and Jonathan Corbet, published
+ * by O'Reilly & Associates.   No warranty is attached;
+ * we cannot take responsibility for errors or fitness for use.
+ *
+ * $Id: admin_unit_test.c,v 0.10 2023/09/25 07:02:43 Feng Liu $
+ */
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/init.h>
+
+#include <linux/time.h>
+#include <linux/kernel.h>
+#include <linux/proc_fs.h>
+#include <linux/types.h>
+#include <linux/spinlock.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/xarray.h>
+#include <linux/atomic.h>
+#include <linux/topology.h>
+#include <linux/mm.h>
+#include <linux/scatterlist.h>
+#include <linux/notifier.h>
+#include <linux/srcu.h>
+#include <linux/list.h>
+#include <linux/shrinker.h>
+#include <linux/miscdevice.h>
+#include <linux/uaccess.h>
+#include <linux/workqueue.h>
+#include <linux/wait.h>
+#include <linux/jiffies.h>
+#include <linux/io_uring/cmd.h>
+#include <linux/crc32.h>
+#include <linux/hashtable.h>
+#include <linux/xxhash.h>
+#include <linux/sort.h>
+
+#include <linux/virtio.h>
+#include <linux/virtio_pci.h>
+#include <linux/pci.h>
+
+#include "admin_unit_ioctl.h"
+#include "admin_unit_core.h"
+
+/* Increment MAX_OPCODE to next value when new opcode is added */
+#define VIRTIO_ADMIN_MAX_CMD_OPCODE			0x11
+
+static struct proc_dir_entry *admin_unit_dir = NULL;
+
+MODULE_AUTHOR("Feng Liu <feliu@nvidia.com>");
+MODULE_LICENSE("Dual BSD/GPL");
+
+#define DEP_MOD_NUM	(2)
+#define ADMIN_UNIT_MAX_PAIRS	(64)
+
+/*
+ * A VF is addressed as "<pf>:<vf>": the index of its PF in discovery
+ * order and its SR-IOV VF number on that PF.  Packed into a u32 for
+ * records and binary interfaces.
+ */
+#define ADMIN_VF_ID(pf, vf)	(((u32)(pf) << 16) | ((vf) & 0xffff))
+#define ADMIN_VF_PF(id)		((id) >> 16)
+#define ADMIN_VF_NR(id)		((id) & 0xffff)
+
+static int ignore_cvq_vf = -1;
+module_param(ignore_cvq_vf, int, 0444);
+MODULE_PARM_DESC(ignore_cvq_vf,
+		 "VF number on PF 0 that is a fake device and must not get cvq (-1: none)");
+
+static int sched_inflight = 1;
+module_param(sched_inflight, int, 0444);
+MODULE_PARM_DESC(sched_inflight,
+		 "Admin commands in flight per PF, others wait in the scheduler");
+
+static unsigned int mem_cap_kb;
+module_param(mem_cap_kb, uint, 0644);
+MODULE_PARM_DESC(mem_cap_kb,
+		 "Cap on memory held for saved ctx and caches, in KB (0: no cap)");
+
+static unsigned int ctx_pool_kb = 16384;
+module_param(ctx_pool_kb, uint, 0644);
+MODULE_PARM_DESC(ctx_pool_kb,
+		 "Freed ctx pages each PF keeps for reuse, in KB (0: no pool)");
+
+static bool mig_verify;
+module_param(mig_verify, bool, 0644);
+MODULE_PARM_DESC(mig_verify,
+		 "Diff the restored ctx against a read back of the destination before it is resumed");
+
+static bool mig_stream;
+module_param(mig_stream, bool, 0644);
+MODULE_PARM_DESC(mig_stream,
+		 "Stream the ctx from source to destination in mig_pairs instead of saving it whole");
+
+static unsigned int query_cache_ms;
+module_param(query_cache_ms, uint, 0644);
+MODULE_PARM_DESC(query_cache_ms,
+		 "How long a mode, op list or field query result is reused, in ms (0: only share in-flight queries)");
+
+static bool fake_transport;
+module_param(fake_transport, bool, 0444);
+MODULE_PARM_DESC(fake_transport,
+		 "Answer admin commands from a software model instead of the device, set at load");
+
+static bool ctx_dedup;
+module_param(ctx_dedup, bool, 0644);
+MODULE_PARM_DESC(ctx_dedup,
+		 "Share identical pages between saved ctx and restored snapshots");
+
+static unsigned int fake_ctx_kb = 64;
+module_param(fake_ctx_kb, uint, 0644);
+MODULE_PARM_DESC(fake_ctx_kb, "Ctx size of every VF in the fake transport, in KB");
+
+static unsigned int fake_fail_every;
+module_param(fake_fail_every, uint, 0644);
+MODULE_PARM_DESC(fake_fail_every,
+		 "Fail every Nth fake admin command of a VF with -EIO (0: never)");
+
+static unsigned int selftest_slack_pct = 25;
+module_param(selftest_slack_pct, uint, 0644);
+MODULE_PARM_DESC(selftest_slack_pct,
+		 "Allowed selftest benchmark slowdown over its baseline, in percent");
+
+enum admin_cmd_files {
+	ADMIN_CMD_LIST_QUERY,
+	ADMIN_CMD_MAX
+};
+
+
+/*
+ * Migration downtime timeline.
+ *
+ * Every mode set / ctx size get / ctx read / ctx write handler stamps the
+ * phase it belongs to on the VF it ran against.  A phase may span several
+ * admin commands (partial reads and writes), so we keep the first start,
+ * the last end and the summed command time.  When a destination VF goes
+ * back to ACTIVE after a ctx write, the source and destination timelines
+ * are folded into one migration record.
+ */
+enum admin_unit_mig_phase {
+	MIG_PHASE_STOP,
+	MIG_PHASE_FREEZE,
+	MIG_PHASE_CTX_SZ_GET,
+	MIG_PHASE_CTX_RD,
+	MIG_PHASE_CTX_WR,
+	MIG_PHASE_ACTIVE,
+	MIG_PHASE_MAX
+};
+
+static const char * const mig_phase_name[MIG_PHASE_MAX] = {
+	[MIG_PHASE_STOP]	= "stop",
+	[MIG_PHASE_FREEZE]	= "freeze",
+	[MIG_PHASE_CTX_SZ_GET]	= "ctx_sz_get",
+	[MIG_PHASE_CTX_RD]	= "ctx_rd",
+	[MIG_PHASE_CTX_WR]	= "ctx_wr",
+	[MIG_PHASE_ACTIVE]	= "active",
+};
+
+struct admin_unit_tl {
+	ktime_t start[MIG_PHASE_MAX];
+	ktime_t end[MIG_PHASE_MAX];
+	u64 busy_ns[MIG_PHASE_MAX];
+	u32 cmds[MIG_PHASE_MAX];
+};
+
+struct admin_pf;
+
+/*
+ * A saved device ctx.  Held as an array of pages so its size is not
+ * bounded by the largest contiguous allocation; it is moved to and from
+ * the device one window of at most admin_pf.win bytes per admin command.
+ * CTX_WIN_PAGES sg entries cover the largest window at any page offset.
+ */
+#define ADMIN_UNIT_CTX_WIN_PAGES	(ADMIN_UNIT_CTX_WIN / PAGE_SIZE + 1)
+
+/* sg entries of an admin command besides the ctx: header, data, status */
+#define ADMIN_UNIT_AVQ_HDR_SG		3
+
+struct admin_unit_ctx {
+	u64 size;
+	unsigned long nr_pages;
+	struct page **pages;
+	/* the PF whose pool the pages go back to, NULL for pinned user pages */
+	struct admin_pf *pf;
+	/* pages owned by the dedupe table */
+	unsigned long nr_shared;
+	/* bytes of size not charged to the VF, as their pages are shared */
+	u64 uncharged;
+};
+
+/*
+ * Read-only queries of a VF.  Identical queries in flight share one
+ * device command, and the result is reused for query_cache_ms unless
+ * a command that changes it, like DEV_MODE_SET for the mode, comes
+ * first.
+ */
+enum admin_unit_qop {
+	ADMIN_UNIT_Q_LIST,
+	ADMIN_UNIT_Q_MODE,
+	ADMIN_UNIT_Q_FIELDS,
+	ADMIN_UNIT_Q_MAX
+};
+
+/* the largest result, MAX_SUPPORT_FIELD supported fields */
+#define ADMIN_UNIT_QUERY_SZ	128
+
+struct admin_unit_query {
+	/* one device command at a time, its waiters take the result */
+	struct mutex lock;
+	/* the rest under admin_vf.query_lock */
+	u64 seq;
+	u64 gen;
+	bool valid;
+	unsigned long expires;
+	u8 data[ADMIN_UNIT_QUERY_SZ];
+};
+
+/* a VF's place in its PF's admin queue scheduler, under sched.lock */
+struct admin_vf_sched {
+	/* on admin_unit_sched.active while tickets are queued */
+	struct list_head node;
+	struct list_head tickets;
+	int weight;
+	int credit;
+};
+
+/*
+ * Per-VF overrides of module params.  The selftest sets them on its own
+ * two VFs, so a run changes neither the params nor any other VF.  A
+ * negative value means the module param applies.
+ */
+struct admin_unit_vf_opts {
+	int fake_fail_every;
+	int mem_cap_kb;
+	int ctx_dedup;
+	int mig_verify;
+	int mig_stream;
+	int query_cache_ms;
+};
+
+#define admin_unit_vf_opt(vf, param)					\
+	(READ_ONCE((vf)->opts.param) >= 0 ?				\
+	 (unsigned int)READ_ONCE((vf)->opts.param) :			\
+	 (unsigned int)READ_ONCE(param))
+
+/* per-VF state, allocated on first use of the VF */
+struct admin_vf {
+	u32 id;
+	char name[16];
+	struct admin_pf *pf;
+	int vf_id;
+	struct pci_dev *pdev;
+	/* protects the saved ctx below */
+	struct mutex lock;
+
+	struct admin_unit_ctx *ctx;
+	/* size of the ctx, and the cursor of the partial read/write commands */
+	struct admin_unit_cursor cur;
+	/* last ctx restored from this VF, kept until reclaimed */
+	struct admin_unit_ctx *restored;
+	/* bytes of ctx and restored charged to this VF */
+	atomic64_t mem;
+
+	/* migration timeline, under admin_unit_tl_lock */
+	struct admin_unit_tl tl;
+	/* id of the source whose ctx was written into this VF */
+	bool mig_linked;
+	u32 mig_src;
+	struct admin_unit_tl mig_src_tl;
+
+	struct admin_vf_sched sched;
+	/* cached read-only query results */
+	spinlock_t query_lock;
+	struct admin_unit_query query[ADMIN_UNIT_Q_MAX];
+	/* the VF as seen by the fake transport, under fake_lock */
+	spinlock_t fake_lock;
+	struct admin_unit_fake fake;
+	struct admin_unit_vf_opts opts;
+};
+
+/*
+ * Cross-node accounting.  Context bytes moved by a CPU on another node
+ * than the PF, and buffers the allocator could not place on the PF node,
+ * both pay the interconnect on every byte.
+ */
+struct admin_pf_numa_stats {
+	atomic64_t local_bytes;
+	atomic64_t remote_bytes;
+	atomic64_t remote_cmds;
+	atomic64_t remote_allocs;
+};
+
+/*
+ * Recycled ctx pages of a PF.  Every migration cycle saves a ctx and
+ * frees it after the restore; its pages come back here, up to
+ * ctx_pool_kb, and the next ctx of the PF takes them before the page
+ * allocator.  Pages a device read fills are only zeroed past the bytes
+ * it returned.  Pooled pages are charged against mem_cap_kb and linked
+ * through page->lru; reclaim drains the pools before it drops any
+ * restored snapshot.
+ */
+struct admin_unit_pool {
+	spinlock_t lock;
+	struct list_head pages;
+	unsigned long nr;
+	/* high-water mark of nr */
+	unsigned long max_nr;
+	u64 hits;
+	u64 misses;
+	/* pages freed to the allocator, over the cap or drained */
+	u64 released;
+};
+
+/*
+ * Scheduling classes.  CRIT are the commands on the guest downtime path
+ * (mode set to STOP/FREEZE, ctx size get in freeze mode); they always
+ * take the next free slot, ahead of anything queued.  BULK are ctx
+ * transfers, NORMAL everything else.
+ */
+enum admin_unit_prio {
+	ADMIN_UNIT_PRIO_CRIT,
+	ADMIN_UNIT_PRIO_NORMAL,
+	ADMIN_UNIT_PRIO_BULK,
+	ADMIN_UNIT_PRIO_MAX
+};
+
+static const char * const admin_unit_prio_name[ADMIN_UNIT_PRIO_MAX] = {
+	[ADMIN_UNIT_PRIO_CRIT]		= "crit",
+	[ADMIN_UNIT_PRIO_NORMAL]	= "normal",
+	[ADMIN_UNIT_PRIO_BULK]		= "bulk",
+};
+
+/* queue wait plus device time of the commands of one class */
+struct admin_unit_prio_stats {
+	u64 cmds;
+	u64 lat_ns;
+	u64 max_lat_ns;
+};
+
+/*
+ * All VFs of a PF share its admin vq.  At most sched_inflight commands
+ * run at a time; the rest wait in per-VF FIFOs served weighted
+ * round-robin, so a VF streaming a large ctx only gets its share of the
+ * queue and small commands of other VFs are not stuck behind it.
+ */
+struct admin_unit_sched {
+	spinlock_t lock;
+	int inflight;
+	/* CRIT tickets, FIFO, served before any VF of active */
+	struct list_head crit;
+	struct list_head active;
+
+	u32 depth;
+	u32 max_depth;
+	u64 cmds;
+	u64 waited;
+	u64 wait_ns;
+	u64 max_wait_ns;
+	struct admin_unit_prio_stats prio[ADMIN_UNIT_PRIO_MAX];
+};
+
+/* a virtio PF with an admin virtqueue */
+struct admin_pf {
+	int idx;
+	int node;
+	struct pci_dev *pdev;
+	struct virtio_device *vdev;
+	/* VF number -> struct admin_vf, populated lazily */
+	struct xarray vfs;
+
+	struct admin_pf_numa_stats numa;
+	struct admin_unit_sched sched;
+	struct admin_unit_pool pool;
+	/* ctx bytes one admin command may carry on the admin vq */
+	u32 win;
+
+	/* calibrated ctx chunk size, 0 until tuned; under admin_unit_tune_lock */
+	int chunk_sz;
+	int nr_chunk_res;
+	struct admin_unit_chunk_res chunk_res[ADMIN_UNIT_CHUNK_STEPS];
+};
+
+struct dev_mgr_s {
+	/* PF index -> struct admin_pf */
+	struct xarray pfs;
+	int nr_pfs;
+};
+
+struct __packed virtio_admin_cmd_dev_ctx_supported_field {
+	__le16 type;
+	__u8 reserved[2];
+	__le32 length;
+};
+
+struct dev_mgr_s g_dev_mgr;
+
+/*
+ * Memory held by the module.  Saved ctx is charged against mem_cap_kb
+ * when it is allocated; restored snapshots and pooled pages are only a
+ * cache and are dropped first, on demand or by the shrinker under
+ * memory pressure.
+ */
+struct admin_unit_mem {
+	atomic64_t total;
+	atomic64_t restored;
+	atomic64_t pooled;
+	atomic64_t reclaimed;
+	atomic64_t cap_fails;
+	/* ctx pages that are deduped, and the distinct pages behind them */
+	atomic64_t dedup_pages;
+	atomic64_t dedup_unique;
+};
+
+static struct admin_unit_mem g_mem;
+static struct shrinker *admin_unit_shrinker;
+
+static void admin_unit_mem_uncharge(struct admin_vf *vf, u64 size)
+{
+	atomic64_sub(size, &vf->mem);
+	atomic64_sub(size, &g_mem.total);
+}
+
+/* what ctx still has charged to its VF */
+static u64 admin_unit_ctx_charge(struct admin_unit_ctx *ctx)
+{
+	return ctx->size - ctx->uncharged;
+}
+
+/* io_uring commands, the fleet sweep and trace replay run here */
+static struct workqueue_struct *admin_unit_wq;
+
+/*
+ * The PF/VF registry follows PCI hotplug.  Mutations are serialized by
+ * admin_unit_dev_lock; lookups are lockless and every command path runs
+ * inside an admin_unit_srcu read section, so a removed PF or VF is only
+ * freed once no command can still be using it.
+ */
+static DEFINE_MUTEX(admin_unit_dev_lock);
+DEFINE_STATIC_SRCU(admin_unit_srcu);
+
+static struct admin_pf *admin_unit_pf_get(int idx)
+{
+	return xa_load(&g_dev_mgr.pfs, idx);
+}
+
+/* the registered PF whose pci_dev is pdev, or NULL */
+static struct admin_pf *admin_unit_pf_find(struct pci_dev *pdev)
+{
+	struct admin_pf *pf;
+	unsigned long pi;
+
+	xa_for_each(&g_dev_mgr.pfs, pi, pf)
+		if (pf->pdev == pdev)
+			return pf;
+	return NULL;
+}
+
+/* NUMA node of the PF that executes admin commands for pdev */
+static int admin_unit_node(struct pci_dev *pdev)
+{
+	return dev_to_node(&pci_physfn(pdev)->dev);
+}
+
+static void *admin_unit_zalloc(struct admin_pf *pf, size_t size)
+{
+	void *buf = kzalloc_node(size, GFP_KERNEL, pf->node);
+
+	if (buf && pf->node != NUMA_NO_NODE &&
+	    page_to_nid(virt_to_page(buf)) != pf->node)
+		atomic64_inc(&pf->numa.remote_allocs);
+	return buf;
+}
+
+/* account bytes of ctx data moved by the current CPU for pf */
+static void admin_unit_numa_account(struct admin_pf *pf, u64 bytes)
+{
+	if (pf->node == NUMA_NO_NODE || numa_node_id() == pf->node) {
+		atomic64_add(bytes, &pf->numa.local_bytes);
+	} else {
+		atomic64_add(bytes, &pf->numa.remote_bytes);
+		atomic64_inc(&pf->numa.remote_cmds);
+	}
+}
+
+/* a page for a ctx of pf, zeroed unless the device will overwrite it */
+static struct page *admin_unit_pool_get(struct admin_pf *pf, bool zero)
+{
+	struct admin_unit_pool *pool = &pf->pool;
+	struct page *page = NULL;
+
+	spin_lock(&pool->lock);
+	if (pool->nr) {
+		page = list_first_entry(&pool->pages, struct page, lru);
+		list_del(&page->lru);
+		pool->nr--;
+		pool->hits++;
+	} else {
+		pool->misses++;
+	}
+	spin_unlock(&pool->lock);
+
+	if (page) {
+		atomic64_sub(PAGE_SIZE, &g_mem.pooled);
+		atomic64_sub(PAGE_SIZE, &g_mem.total);
+	}
+
+	if (!page)
+		return alloc_pages_node(pf->node,
+					GFP_KERNEL | (zero ? __GFP_ZERO : 0), 0);
+	if (zero)
+		clear_page(page_address(page));
+	return page;
+}
+
+static void admin_unit_pool_put(struct admin_pf *pf, struct page *page)
+{
+	unsigned long cap = READ_ONCE(ctx_pool_kb) >> (PAGE_SHIFT - 10);
+	struct admin_unit_pool *pool = &pf->pool;
+
+	spin_lock(&pool->lock);
+	if (pool->nr < cap) {
+		list_add(&page->lru, &pool->pages);
+		pool->nr++;
+		pool->max_nr = max(pool->max_nr, pool->nr);
+		atomic64_add(PAGE_SIZE, &g_mem.pooled);
+		atomic64_add(PAGE_SIZE, &g_mem.total);
+		page = NULL;
+	} else {
+		pool->released++;
+	}
+	spin_unlock(&pool->lock);
+
+	if (page)
+		__free_page(page);
+}
+
+/* free up to nr pages of the pool of pf, returns how many */
+static unsigned long admin_unit_pool_drain(struct admin_pf *pf,
+					   unsigned long nr)
+{
+	struct admin_unit_pool *pool = &pf->pool;
+	unsigned long freed = 0;
+	struct page *page;
+	LIST_HEAD(list);
+
+	spin_lock(&pool->lock);
+	while (pool->nr && freed < nr) {
+		page = list_first_entry(&pool->pages, struct page, lru);
+		list_move(&page->lru, &list);
+		pool->nr--;
+		freed++;
+	}
+	pool->released += freed;
+	spin_unlock(&pool->lock);
+	atomic64_sub((u64)freed << PAGE_SHIFT, &g_mem.pooled);
+	atomic64_sub((u64)freed << PAGE_SHIFT, &g_mem.total);
+
+	while (!list_empty(&list)) {
+		page = list_first_entry(&list, struct page, lru);
+		list_del(&page->lru);
+		__free_page(page);
+	}
+	return freed;
+}
+
+/*
+ * Page dedupe of saved ctx.  With ctx_dedup, a ctx that is fully read,
+ * and every snapshot kept after a restore, has its pages hashed; a page
+ * whose content is already held by another ctx is dropped in favour of
+ * the held one.  Deduped pages are owned by a struct admin_unit_dpage,
+ * found through page_private(), and refcounted by the ctx using them.
+ * A ctx about to be read into again gets private copies of its deduped
+ * pages first (copy on write).  A deduped page is charged once, to no
+ * VF, while it is in the table; each ctx drops its bytes of the page
+ * from its own charge, and charges them again on copy on write.
+ */
+#define ADMIN_UNIT_DEDUP_BITS	12
+
+struct admin_unit_dpage {
+	struct hlist_node node;
+	u64 hash;
+	struct page *page;
+	/* ctx pages pointing here, under admin_unit_dedup_lock */
+	unsigned int ref;
+};
+
+static DEFINE_HASHTABLE(admin_unit_dedup_ht, ADMIN_UNIT_DEDUP_BITS);
+/* a spinlock: pages are freed under it from the shrinker too */
+static DEFINE_SPINLOCK(admin_unit_dedup_lock);
+
+/* drop a ctx reference to a deduped page, true when it was the last */
+static bool admin_unit_dpage_put(struct page *page)
+{
+	struct admin_unit_dpage *dp = (void *)page_private(page);
+	bool last;
+
+	spin_lock(&admin_unit_dedup_lock);
+	last = !--dp->ref;
+	if (last)
+		hash_del(&dp->node);
+	spin_unlock(&admin_unit_dedup_lock);
+
+	atomic64_dec(&g_mem.dedup_pages);
+	if (!last)
+		return false;
+	atomic64_dec(&g_mem.dedup_unique);
+	atomic64_sub(PAGE_SIZE, &g_mem.total);
+	set_page_private(page, 0);
+	__free_page(page);
+	kfree(dp);
+	return true;
+}
+
+/* bytes of ctx in its page i */
+static u32 admin_unit_ctx_page_bytes(struct admin_unit_ctx *ctx,
+				     unsigned long i)
+{
+	return min_t(u64, PAGE_SIZE, ctx->size - ((u64)i << PAGE_SHIFT));
+}
+
+/* dedupe the pages of ctx, which is charged to vf */
+static void admin_unit_ctx_dedup(struct admin_vf *vf,
+				 struct admin_unit_ctx *ctx)
+{
+	struct admin_unit_dpage *dp, *new = NULL;
+	struct page *page;
+	unsigned long i;
+	u32 bytes;
+	u64 hash;
+
+	for (i = 0; i < ctx->nr_pages; i++) {
+		page = ctx->pages[i];
+		if (page_private(page))
+			continue;
+		if (!new) {
+			new = kzalloc(sizeof(*new), GFP_KERNEL);
+			if (!new)
+				break;
+		}
+		hash = xxh64(page_address(page), PAGE_SIZE, 0);
+
+		spin_lock(&admin_unit_dedup_lock);
+		hash_for_each_possible(admin_unit_dedup_ht, dp, node, hash) {
+			if (dp->hash == hash &&
+			    !memcmp(page_address(dp->page), page_address(page),
+				    PAGE_SIZE))
+				break;
+		}
+		if (dp) {
+			dp->ref++;
+		} else {
+			dp = new;
+			new = NULL;
+			dp->hash = hash;
+			dp->page = page;
+			dp->ref = 1;
+			set_page_private(page, (unsigned long)dp);
+			hash_add(admin_unit_dedup_ht, &dp->node, hash);
+		}
+		spin_unlock(&admin_unit_dedup_lock);
+
+		ctx->nr_shared++;
+		atomic64_inc(&g_mem.dedup_pages);
+		bytes = admin_unit_ctx_page_bytes(ctx, i);
+		ctx->uncharged += bytes;
+		admin_unit_mem_uncharge(vf, bytes);
+		if (dp->page != page) {
+			ctx->pages[i] = dp->page;
+			admin_unit_pool_put(ctx->pf, page);
+		} else {
+			/* the table holds the page now */
+			atomic64_inc(&g_mem.dedup_unique);
+			atomic64_add(PAGE_SIZE, &g_mem.total);
+		}
+		cond_resched();
+	}
+	kfree(new);
+}
+
+/*
+ * Free ctx, its pages into the pool of its PF, or with !pool straight
+ * to the page allocator.  Returns the bytes given back to the allocator
+ * that way; pages of other ctx and pooled pages are not counted.
+ */
+static u64 admin_unit_ctx_free_to(struct admin_unit_ctx *ctx, bool pool)
+{
+	unsigned long i, nr = 0;
+
+	if (!ctx)
+		return 0;
+	for (i = 0; i < ctx->nr_pages; i++) {
+		if (!ctx->pages[i])
+			continue;
+		if (page_private(ctx->pages[i])) {
+			nr += admin_unit_dpage_put(ctx->pages[i]);
+		} else if (pool) {
+			admin_unit_pool_put(ctx->pf, ctx->pages[i]);
+		} else {
+			__free_page(ctx->pages[i]);
+			nr++;
+		}
+		cond_resched();
+	}
+	kvfree(ctx->pages);
+	kfree(ctx);
+	return (u64)nr << PAGE_SHIFT;
+}
+
+static void admin_unit_ctx_free(struct admin_unit_ctx *ctx)
+{
+	admin_unit_ctx_free_to(ctx, true);
+}
+
+/*
+ * A ctx of size bytes for pf.  Without zero, the pages may hold data of
+ * an earlier ctx: the caller overwrites every byte, or zeroes what a
+ * device read did not return with admin_unit_ctx_zero_from().
+ */
+static struct admin_unit_ctx *admin_unit_ctx_alloc(struct admin_pf *pf, u64 size,
+						   bool zero)
+{
+	struct admin_unit_ctx *ctx;
+	bool remote = false;
+	struct page *page;
+	unsigned long i;
+
+	ctx = kzalloc_node(sizeof(*ctx), GFP_KERNEL, pf->node);
+	if (!ctx)
+		return NULL;
+
+	ctx->size = size;
+	ctx->pf = pf;
+	ctx->nr_pages = DIV_ROUND_UP_ULL(size, PAGE_SIZE);
+	ctx->pages = kvzalloc_node(array_size(ctx->nr_pages, sizeof(*ctx->pages)),
+				   GFP_KERNEL, pf->node);
+	if (!ctx->pages) {
+		kfree(ctx);
+		return NULL;
+	}
+
+	for (i = 0; i < ctx->nr_pages; i++) {
+		page = admin_unit_pool_get(pf, zero);
+		if (!page) {
+			admin_unit_ctx_free(ctx);
+			return NULL;
+		}
+		if (pf->node != NUMA_NO_NODE && page_to_nid(page) != pf->node)
+			remote = true;
+		ctx->pages[i] = page;
+		cond_resched();
+	}
+	if (remote)
+		atomic64_inc(&pf->numa.remote_allocs);
+	return ctx;
+}
+
+/*
+ * Zero ctx from off to the end of its last page, for a read that
+ * returned less than the ctx size into unzeroed pages.  Deduped pages
+ * are skipped: they are shared, possibly with ctx of other VFs, and are
+ * never written in place.
+ */
+static void admin_unit_ctx_zero_from(struct admin_unit_ctx *ctx, u64 off)
+{
+	unsigned long i = off >> PAGE_SHIFT;
+	u32 po = offset_in_page(off);
+
+	for (; i < ctx->nr_pages; i++, po = 0) {
+		if (!page_private(ctx->pages[i]))
+			memset(page_address(ctx->pages[i]) + po, 0,
+			       PAGE_SIZE - po);
+	}
+}
+
+/* point sgl at the pages backing [off, off + len) of ctx */
+static void admin_unit_ctx_sg(struct admin_unit_ctx *ctx, u64 off, u32 len,
+			      struct scatterlist *sgl)
+{
+	u32 po, l;
+	int n = 0;
+
+	sg_init_table(sgl, DIV_ROUND_UP(offset_in_page(off) + len, PAGE_SIZE));
+	while (len) {
+		po = offset_in_page(off);
+		l = min_t(u32, len, PAGE_SIZE - po);
+		sg_set_page(&sgl[n++], ctx->pages[off >> PAGE_SHIFT], l, po);
+		off += l;
+		len -= l;
+	}
+}
+
+/* copy [off, off + len) of ctx out to buf */
+static void admin_unit_ctx_copy(struct admin_unit_ctx *ctx, u64 off, void *buf,
+				u32 len)
+{
+	u32 po, l;
+
+	while (len) {
+		po = offset_in_page(off);
+		l = min_t(u32, len, PAGE_SIZE - po);
+		memcpy(buf, page_address(ctx->pages[off >> PAGE_SHIFT]) + po, l);
+		buf += l;
+		off += l;
+		len -= l;
+	}
+}
+
+static u32 admin_unit_ctx_crc(struct admin_unit_ctx *ctx, u64 off, u64 len)
+{
+	u32 crc = ~0, po, l;
+
+	while (len) {
+		po = offset_in_page(off);
+		l = min_t(u64, len, PAGE_SIZE - po);
+		crc = crc32_le(crc, page_address(ctx->pages[off >> PAGE_SHIFT]) + po,
+			       l);
+		off += l;
+		len -= l;
+	}
+	return ~crc;
+}
+
+/* the TLV field whose header is at pos of ctx */
+static int admin_unit_ctx_field(struct admin_unit_ctx *ctx, u64 pos,
+				struct admin_unit_tlv *f)
+{
+	u8 hdr[ADMIN_UNIT_TLV_HDR_SZ];
+
+	if (pos > ctx->size || ctx->size - pos < sizeof(hdr))
+		return -EINVAL;
+	admin_unit_ctx_copy(ctx, pos, hdr, sizeof(hdr));
+	return admin_unit_core_tlv_parse(hdr, pos, ctx->size, f);
+}
+
+static DEFINE_MUTEX(admin_unit_tune_lock);
+
+static int admin_unit_chunk_sz(struct admin_pf *pf)
+{
+	int sz = READ_ONCE(pf->chunk_sz);
+
+	return sz ? sz : ADMIN_UNIT_CHUNK_DEF;
+}
+
+/*
+ * Look a VF up by id, creating its state the first time it is used.  PFs
+ * may carry thousands of VFs, so nothing per-VF is done at load time.
+ */
+static struct admin_vf *admin_unit_vf_get(u32 id)
+{
+	struct admin_pf *pf = admin_unit_pf_get(ADMIN_VF_PF(id));
+	int vf_id = ADMIN_VF_NR(id);
+	struct pci_dev *pdev;
+	struct admin_vf *vf;
+	int i;
+
+	if (!pf)
+		return NULL;
+
+	vf = xa_load(&pf->vfs, vf_id);
+	if (vf)
+		return vf;
+
+	/* slow path, serialized against hot removal of the VF */
+	mutex_lock(&admin_unit_dev_lock);
+	vf = xa_load(&pf->vfs, vf_id);
+	if (vf || vf_id >= pci_num_vf(pf->pdev))
+		goto out;
+
+	pdev = pci_get_domain_bus_and_slot(pci_domain_nr(pf->pdev->bus),
+					   pci_iov_virtfn_bus(pf->pdev, vf_id),
+					   pci_iov_virtfn_devfn(pf->pdev, vf_id));
+	if (!pdev)
+		goto out;
+
+	vf = kzalloc_node(sizeof(*vf), GFP_KERNEL, pf->node);
+	if (!vf) {
+		pci_dev_put(pdev);
+		goto out;
+	}
+	vf->id = id;
+	vf->pf = pf;
+	vf->vf_id = vf_id;
+	vf->pdev = pdev;
+	snprintf(vf->name, sizeof(vf->name), "%u:%u", pf->idx, vf_id);
+	/* every override unset */
+	memset(&vf->opts, 0xff, sizeof(vf->opts));
+	mutex_init(&vf->lock);
+	INIT_LIST_HEAD(&vf->sched.node);
+	INIT_LIST_HEAD(&vf->sched.tickets);
+	vf->sched.weight = 1;
+	spin_lock_init(&vf->query_lock);
+	for (i = 0; i < ADMIN_UNIT_Q_MAX; i++)
+		mutex_init(&vf->query[i].lock);
+	spin_lock_init(&vf->fake_lock);
+
+	if (xa_err(xa_store(&pf->vfs, vf_id, vf, GFP_KERNEL))) {
+		pci_dev_put(pdev);
+		kfree(vf);
+		vf = NULL;
+		goto out;
+	}
+
+	if (pf->idx == 0 && vf_id == ignore_cvq_vf) {
+		/* fake device, dont repsonse cci and cvq */
+		struct virtio_device *vdev = virtio_pci_dev_get_vdev(pdev);
+
+		if (vdev)
+			vdev->ignore_cvq = true;
+	}
+
+	dev_info(&pdev->dev, "vf %s pdev(%s) domain %d bus %#x devfn %#x",
+		vf->name, pci_name(pdev), pci_domain_nr(pdev->bus),
+		pdev->bus->number, pdev->devfn);
+out:
+	mutex_unlock(&admin_unit_dev_lock);
+	return vf;
+}
+
+static void admin_unit_vf_free(struct admin_vf *vf)
+{
+	if (vf->restored)
+		atomic64_sub(vf->restored->size, &g_mem.restored);
+	atomic64_sub(atomic64_read(&vf->mem), &g_mem.total);
+	admin_unit_ctx_free(vf->restored);
+	admin_unit_ctx_free(vf->ctx);
+	pci_dev_put(vf->pdev);
+	kfree(vf);
+}
+
+/* "<pf>:<vf>", or a bare "<vf>" on PF 0 */
+static struct admin_vf *admin_unit_vf_parse(const char *str)
+{
+	u32 pf_idx, vf_id;
+
+	if (admin_unit_core_vf_id_parse(str, &pf_idx, &vf_id))
+		return NULL;
+	return admin_unit_vf_get(ADMIN_VF_ID(pf_idx, vf_id));
+}
+
+#define admin_unit_for_each_vf(pf, vf, pi, vi)			\
+	xa_for_each(&g_dev_mgr.pfs, pi, pf)			\
+		xa_for_each(&(pf)->vfs, vi, vf)
+
+/*
+ * Drop cached data until nr_pages are given back to the page allocator.
+ * Only trylocks, as this also runs from reclaim and from allocation
+ * paths holding a vf->lock.
+ */
+static unsigned long admin_unit_mem_reclaim(unsigned long nr_pages)
+{
+	u64 freed = 0, goal = (u64)nr_pages << PAGE_SHIFT;
+	unsigned long pi, vi;
+	struct admin_unit_ctx *ctx;
+	struct admin_pf *pf;
+	struct admin_vf *vf;
+	int idx;
+	u64 sz;
+
+	idx = srcu_read_lock(&admin_unit_srcu);
+	/* pools first, they only cost a page allocation to refill */
+	xa_for_each(&g_dev_mgr.pfs, pi, pf) {
+		if (freed >= goal)
+			goto out;
+		freed += (u64)admin_unit_pool_drain(pf,
+				DIV_ROUND_UP(goal - freed, PAGE_SIZE)) << PAGE_SHIFT;
+	}
+	/* then snapshots, they cost a device read to get back */
+	admin_unit_for_each_vf(pf, vf, pi, vi) {
+		if (freed >= goal)
+			goto out;
+		if (!READ_ONCE(vf->restored) || !mutex_trylock(&vf->lock))
+			continue;
+		ctx = vf->restored;
+		vf->restored = NULL;
+		mutex_unlock(&vf->lock);
+		if (!ctx)
+			continue;
+
+		sz = ctx->size;
+		admin_unit_mem_uncharge(vf, admin_unit_ctx_charge(ctx));
+		/* into the pool they would only be charged again */
+		freed += admin_unit_ctx_free_to(ctx, false);
+		atomic64_sub(sz, &g_mem.restored);
+	}
+out:
+	srcu_read_unlock(&admin_unit_srcu, idx);
+
+	atomic64_add(freed, &g_mem.reclaimed);
+	return DIV_ROUND_UP(freed, PAGE_SIZE);
+}
+
+/* charge a new saved ctx, making room in cached data if over the cap */
+static int admin_unit_mem_charge(struct admin_vf *vf, u64 size)
+{
+	u64 cap = (u64)admin_unit_vf_opt(vf, mem_cap_kb) << 10;
+	u64 total;
+
+	total = atomic64_add_return(size, &g_mem.total);
+	if (cap && total > cap) {
+		admin_unit_mem_reclaim(DIV_ROUND_UP(total - cap, PAGE_SIZE));
+		if (atomic64_read(&g_mem.total) > cap) {
+			atomic64_sub(size, &g_mem.total);
+			atomic64_inc(&g_mem.cap_fails);
+			pr_err("vf %s: %llu bytes of ctx over mem_cap_kb %llu\n",
+				vf->name, size, cap >> 10);
+			return -ENOSPC;
+		}
+	}
+	atomic64_add(size, &vf->mem);
+	return 0;
+}
+
+/* keep a restored ctx of vf as a discardable snapshot */
+static void admin_unit_vf_keep_restored(struct admin_vf *vf,
+					struct admin_unit_ctx *ctx)
+{
+	struct admin_unit_ctx *old;
+
+	if (admin_unit_vf_opt(vf, ctx_dedup))
+		admin_unit_ctx_dedup(vf, ctx);
+
+	mutex_lock(&vf->lock);
+	old = vf->restored;
+	vf->restored = ctx;
+	mutex_unlock(&vf->lock);
+
+	atomic64_add(ctx->size, &g_mem.restored);
+	if (old) {
+		atomic64_sub(old->size, &g_mem.restored);
+		admin_unit_mem_uncharge(vf, admin_unit_ctx_charge(old));
+		admin_unit_ctx_free(old);
+	}
+}
+
+/* allocate the saved ctx of vf for cur.size bytes, under vf->lock */
+static int admin_unit_vf_ctx_alloc(struct admin_vf *vf, bool zero)
+{
+	int ret;
+
+	if (vf->ctx)
+		return 0;
+
+	ret = admin_unit_mem_charge(vf, vf->cur.size);
+	if (ret)
+		return ret;
+	vf->ctx = admin_unit_ctx_alloc(vf->pf, vf->cur.size, zero);
+	if (!vf->ctx) {
+		admin_unit_mem_uncharge(vf, vf->cur.size);
+		pr_err("Can not alloc memory \n");
+		return -ENOMEM;
+	}
+	vf->cur.off = 0;
+	return 0;
+}
+
+/*
+ * Give ctx, charged to vf, private copies of the deduped pages in
+ * [off, off + len), charging their bytes to vf again.
+ */
+static int admin_unit_ctx_unshare(struct admin_vf *vf,
+				  struct admin_unit_ctx *ctx, u64 off, u64 len)
+{
+	unsigned long i, end;
+	struct page *page;
+	u32 bytes;
+	int ret;
+
+	if (!ctx->nr_shared || !len)
+		return 0;
+
+	end = (off + len - 1) >> PAGE_SHIFT;
+	for (i = off >> PAGE_SHIFT; i <= end; i++) {
+		if (!page_private(ctx->pages[i]))
+			continue;
+		bytes = admin_unit_ctx_page_bytes(ctx, i);
+		ret = admin_unit_mem_charge(vf, bytes);
+		if (ret)
+			return ret;
+		/* overwritten whole by the copy */
+		page = admin_unit_pool_get(ctx->pf, false);
+		if (!page) {
+			admin_unit_mem_uncharge(vf, bytes);
+			return -ENOMEM;
+		}
+		copy_page(page_address(page), page_address(ctx->pages[i]));
+		admin_unit_dpage_put(ctx->pages[i]);
+		ctx->pages[i] = page;
+		ctx->nr_shared--;
+		ctx->uncharged -= bytes;
+	}
+	return 0;
+}
+
+static unsigned long admin_unit_shrink_count(struct shrinker *shrink,
+					     struct shrink_control *sc)
+{
+	unsigned long nr = DIV_ROUND_UP(atomic64_read(&g_mem.restored),
+					PAGE_SIZE);
+	struct admin_pf *pf;
+	unsigned long pi;
+	int idx;
+
+	idx = srcu_read_lock(&admin_unit_srcu);
+	xa_for_each(&g_dev_mgr.pfs, pi, pf)
+		nr += READ_ONCE(pf->pool.nr);
+	srcu_read_unlock(&admin_unit_srcu, idx);
+	return nr ? nr : SHRINK_EMPTY;
+}
+
+static unsigned long admin_unit_shrink_scan(struct shrinker *shrink,
+					    struct shrink_control *sc)
+{
+	unsigned long freed = admin_unit_mem_reclaim(sc->nr_to_scan);
+
+	return freed ? freed : SHRINK_STOP;
+}
+
+struct admin_unit_ticket {
+	struct list_head node;
+	struct completion granted;
+};
+
+/* hand free slots to waiting VFs in weighted round-robin order */
+static void admin_unit_sched_dispatch(struct admin_unit_sched *sched)
+{
+	struct admin_unit_ticket *t;
+	struct admin_vf_sched *vs;
+
+	lockdep_assert_held(&sched->lock);
+	while (sched->inflight < max(sched_inflight, 1)) {
+		if (!list_empty(&sched->crit)) {
+			t = list_first_entry(&sched->crit,
+					     struct admin_unit_ticket, node);
+			list_del(&t->node);
+		} else if (!list_empty(&sched->active)) {
+			vs = list_first_entry(&sched->active,
+					      struct admin_vf_sched, node);
+			t = list_first_entry(&vs->tickets,
+					     struct admin_unit_ticket, node);
+			list_del(&t->node);
+
+			if (list_empty(&vs->tickets)) {
+				list_del_init(&vs->node);
+			} else if (--vs->credit <= 0) {
+				vs->credit = vs->weight;
+				list_move_tail(&vs->node, &sched->active);
+			}
+		} else {
+			break;
+		}
+
+		sched->depth--;
+		sched->inflight++;
+		complete(&t->granted);
+	}
+}
+
+static void admin_unit_sched_get(struct admin_pf *pf, struct admin_vf *vf,
+				 int prio)
+{
+	struct admin_unit_sched *sched = &pf->sched;
+	struct admin_unit_ticket t;
+	ktime_t start;
+	u64 ns;
+
+	spin_lock(&sched->lock);
+	sched->cmds++;
+	if (list_empty(&sched->crit) && list_empty(&sched->active) &&
+	    sched->inflight < max(sched_inflight, 1)) {
+		sched->inflight++;
+		spin_unlock(&sched->lock);
+		return;
+	}
+
+	init_completion(&t.granted);
+	if (prio == ADMIN_UNIT_PRIO_CRIT) {
+		list_add_tail(&t.node, &sched->crit);
+	} else {
+		list_add_tail(&t.node, &vf->sched.tickets);
+		if (list_empty(&vf->sched.node)) {
+			vf->sched.credit = vf->sched.weight;
+			list_add_tail(&vf->sched.node, &sched->active);
+		}
+	}
+	sched->depth++;
+	sched->max_depth = max(sched->max_depth, sched->depth);
+	spin_unlock(&sched->lock);
+
+	start = ktime_get();
+	wait_for_completion(&t.granted);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	spin_lock(&sched->lock);
+	sched->waited++;
+	sched->wait_ns += ns;
+	sched->max_wait_ns = max(sched->max_wait_ns, ns);
+	spin_unlock(&sched->lock);
+}
+
+static void admin_unit_sched_put(struct admin_pf *pf, int prio, ktime_t start)
+{
+	struct admin_unit_sched *sched = &pf->sched;
+	struct admin_unit_prio_stats *ps = &sched->prio[prio];
+	u64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	spin_lock(&sched->lock);
+	sched->inflight--;
+	admin_unit_sched_dispatch(sched);
+
+	ps->cmds++;
+	ps->lat_ns += ns;
+	ps->max_lat_ns = max(ps->max_lat_ns, ns);
+	spin_unlock(&sched->lock);
+}
+
+/*
+ * Admin command transports.  "virtio" is the PF's admin vq.  "fake"
+ * answers from a software model so every command path, its bookkeeping
+ * and its error handling can be driven without the device: each VF has
+ * a ctx of fake_ctx_kb bytes holding a fixed pattern, reads stream it
+ * out and writes are checked against it, so a wrong ctx offset shows up
+ * as -EIO.
+ */
+struct admin_unit_transport {
+	const char *name;
+	int (*exec)(struct admin_vf *vf, struct virtio_device *virtio_dev,
+		    struct virtio_admin_cmd *cmd);
+};
+
+static int admin_unit_virtio_exec(struct admin_vf *vf,
+				  struct virtio_device *virtio_dev,
+				  struct virtio_admin_cmd *cmd)
+{
+	return vp_modern_admin_cmd_exec(virtio_dev, cmd);
+}
+
+static u64 admin_unit_sg_len(struct scatterlist *sgl)
+{
+	struct scatterlist *sg;
+	u64 len = 0;
+	int i;
+
+	for_each_sg(sgl, sg, sg_nents(sgl), i)
+		len += sg->length;
+	return len;
+}
+
+/* fill (or, with check, compare) len bytes of sgl after skip with the pattern at off */
+static bool admin_unit_fake_pattern(struct scatterlist *sgl, u64 skip, u64 len,
+				    u64 off, bool check)
+{
+	struct sg_mapping_iter miter;
+	bool ok = true;
+	size_t l;
+
+	sg_miter_start(&miter, sgl, sg_nents(sgl), SG_MITER_ATOMIC |
+		       (check ? SG_MITER_FROM_SG : SG_MITER_TO_SG));
+	sg_miter_skip(&miter, skip);
+	while (ok && len && sg_miter_next(&miter)) {
+		l = min_t(u64, miter.length, len);
+		if (check)
+			ok = admin_unit_fake_check(miter.addr, l, off);
+		else
+			admin_unit_fake_fill(miter.addr, l, off);
+		miter.consumed = l;
+		off += l;
+		len -= l;
+	}
+	sg_miter_stop(&miter);
+	return ok;
+}
+
+static int admin_unit_fake_exec(struct admin_vf *vf,
+				struct virtio_device *virtio_dev,
+				struct virtio_admin_cmd *cmd)
+{
+	struct virtio_admin_cmd_dev_ctx_supported_field fld[2] = {};
+	struct virtio_admin_cmd_dev_ctx_rd_result rd_res;
+	u64 size = (u64)READ_ONCE(fake_ctx_kb) << 10;
+	struct admin_unit_fake *fk = &vf->fake;
+	struct scatterlist *res = cmd->result_sg;
+	unsigned int fail = admin_unit_vf_opt(vf, fake_fail_every);
+	__le64 ops, sz;
+	u64 len, off;
+	int ret = 0;
+	u8 mode;
+
+	spin_lock(&vf->fake_lock);
+	ret = admin_unit_fake_cmd(fk, fail);
+	if (ret)
+		goto out;
+
+	switch (cmd->opcode) {
+	case VIRTIO_ADMIN_CMD_LIST_QUERY:
+		ops = cpu_to_le64(BIT_ULL(VIRTIO_ADMIN_CMD_LIST_QUERY) |
+				  BIT_ULL(VIRTIO_ADMIN_CMD_DEV_MODE_SET) |
+				  BIT_ULL(VIRTIO_ADMIN_CMD_DEV_MODE_GET) |
+				  BIT_ULL(VIRTIO_ADMIN_CMD_DEV_CTX_SIZE_GET) |
+				  BIT_ULL(VIRTIO_ADMIN_CMD_DEV_CTX_READ) |
+				  BIT_ULL(VIRTIO_ADMIN_CMD_DEV_CTX_WRITE) |
+				  BIT_ULL(VIRTIO_ADMIN_CMD_DEV_CTX_FIELDS_QUERY) |
+				  BIT_ULL(VIRTIO_ADMIN_CMD_DEV_CTX_DISCARD));
+		sg_pcopy_from_buffer(res, sg_nents(res), &ops, sizeof(ops), 0);
+		break;
+	case VIRTIO_ADMIN_CMD_DEV_MODE_GET:
+		sg_pcopy_from_buffer(res, sg_nents(res), &fk->mode, 1, 0);
+		break;
+	case VIRTIO_ADMIN_CMD_DEV_MODE_SET:
+		sg_pcopy_to_buffer(cmd->data_sg, 1, &mode, 1, 0);
+		ret = admin_unit_fake_mode_set(fk, mode,
+					       VIRTIO_ADMIN_DEV_MODE_FREEZE);
+		break;
+	case VIRTIO_ADMIN_CMD_DEV_CTX_SIZE_GET:
+		sz = cpu_to_le64(size);
+		sg_pcopy_from_buffer(res, sg_nents(res), &sz, sizeof(sz), 0);
+		admin_unit_fake_size_get(fk);
+		break;
+	case VIRTIO_ADMIN_CMD_DEV_CTX_READ:
+		len = admin_unit_sg_len(res) - sizeof(rd_res);
+		off = admin_unit_fake_rd(fk, size, &len);
+		admin_unit_fake_pattern(res, sizeof(rd_res), len, off, false);
+		rd_res.size = cpu_to_le32(len);
+		rd_res.remaining_ctx_size = cpu_to_le32(size - fk->rd_off);
+		sg_pcopy_from_buffer(res, sg_nents(res), &rd_res,
+				     sizeof(rd_res), 0);
+		break;
+	case VIRTIO_ADMIN_CMD_DEV_CTX_WRITE:
+		len = admin_unit_sg_len(cmd->data_sg);
+		ret = admin_unit_fake_wr_room(fk, size, len);
+		if (!ret && !admin_unit_fake_pattern(cmd->data_sg, 0, len,
+						     fk->wr_off, true))
+			ret = -EIO;
+		if (!ret)
+			fk->wr_off += len;
+		break;
+	case VIRTIO_ADMIN_CMD_DEV_CTX_FIELDS_QUERY:
+		fld[0].type = cpu_to_le16(0);
+		fld[0].length = cpu_to_le32(size / 2);
+		fld[1].type = cpu_to_le16(1);
+		fld[1].length = cpu_to_le32(size - size / 2);
+		sg_pcopy_from_buffer(res, sg_nents(res), fld, sizeof(fld), 0);
+		break;
+	case VIRTIO_ADMIN_CMD_DEV_CTX_DISCARD:
+		admin_unit_fake_discard(fk);
+		break;
+	default:
+		ret = -EOPNOTSUPP;
+		break;
+	}
+out:
+	spin_unlock(&vf->fake_lock);
+	return ret;
+}
+
+static const struct admin_unit_transport admin_unit_transports[] = {
+	{ .name = "virtio",	.exec = admin_unit_virtio_exec },
+	{ .name = "fake",	.exec = admin_unit_fake_exec },
+};
+
+static const struct admin_unit_transport *admin_unit_transport_get(void)
+{
+	return &admin_unit_transports[READ_ONCE(fake_transport) ? 1 : 0];
+}
+
+struct admin_unit_query_stats {
+	/* device commands, results reused from the cache or in-flight */
+	atomic64_t cmds;
+	atomic64_t cached;
+	atomic64_t shared;
+	atomic64_t invalidated;
+};
+
+static struct admin_unit_query_stats g_query;
+
+/* drop the cached result of op, and of any query of op still in flight */
+static void admin_unit_query_inval(struct admin_vf *vf, int op)
+{
+	struct admin_unit_query *q = &vf->query[op];
+
+	spin_lock(&vf->query_lock);
+	if (q->valid)
+		atomic64_inc(&g_query.invalidated);
+	q->valid = false;
+	q->gen++;
+	spin_unlock(&vf->query_lock);
+}
+
+/*
+ * Command trace.  "trace_start [<records>]" records every command that
+ * goes through admin_unit_exec into a ring keeping the newest records,
+ * "trace_stop" ends it.  /proc/admin_unit/trace exports the ring in the
+ * admin_unit_ioctl.h format, sorted by issue time, and takes a trace
+ * written back to it for "trace_replay".
+ */
+#define ADMIN_UNIT_TRACE_DEF	65536
+#define ADMIN_UNIT_TRACE_MAX	(1 << 22)
+
+struct admin_unit_trace {
+	bool on;
+	ktime_t start;
+	struct admin_unit_trace_rec *rec;
+	u32 size;
+	/* next slot, and records written since the start */
+	u32 pos;
+	u64 total;
+};
+
+static struct admin_unit_trace g_trace;
+/* the records; admin_unit_trace_mutex serializes ring replacement */
+static DEFINE_SPINLOCK(admin_unit_trace_lock);
+static DEFINE_MUTEX(admin_unit_trace_mutex);
+
+static void admin_unit_trace_add(struct admin_vf *vf,
+				 struct virtio_admin_cmd *cmd, ktime_t start,
+				 int ret)
+{
+	u64 lat = ktime_to_ns(ktime_sub(ktime_get(), start));
+	struct admin_unit_trace_rec *r;
+	u32 in_len = 0;
+	u64 arg = 0;
+
+	if (cmd->data_sg) {
+		in_len = admin_unit_sg_len(cmd->data_sg);
+		if (in_len <= sizeof(arg))
+			sg_pcopy_to_buffer(cmd->data_sg, sg_nents(cmd->data_sg),
+					   &arg, in_len, 0);
+	}
+
+	spin_lock(&admin_unit_trace_lock);
+	if (g_trace.on) {
+		r = &g_trace.rec[g_trace.pos];
+		r->ts_ns = ktime_to_ns(ktime_sub(start, g_trace.start));
+		r->arg = arg;
+		r->vf = vf->id;
+		r->lat_ns = min_t(u64, lat, U32_MAX);
+		r->in_len = in_len;
+		r->out_len = cmd->result_sg ? admin_unit_sg_len(cmd->result_sg) : 0;
+		r->opcode = cmd->opcode;
+		r->rsvd = 0;
+		r->status = ret;
+		if (++g_trace.pos == g_trace.size)
+			g_trace.pos = 0;
+		g_trace.total++;
+	}
+	spin_unlock(&admin_unit_trace_lock);
+}
+
+/* every admin command is issued here, through the VF's PF scheduler */
+static int admin_unit_exec(struct pci_dev *pdev, struct virtio_device *virtio_dev,
+			   struct virtio_admin_cmd *cmd, int prio)
+{
+	struct admin_pf *pf = NULL;
+	struct admin_vf *vf = NULL;
+	ktime_t start;
+	int ret;
+
+	/* the VF state may not have been created yet */
+	if (pdev->is_virtfn) {
+		pf = admin_unit_pf_find(pci_physfn(pdev));
+		if (pf)
+			vf = admin_unit_vf_get(ADMIN_VF_ID(pf->idx,
+							   pci_iov_vf_id(pdev)));
+	}
+	if (!vf) {
+		pr_err("%s: not a VF of a registered PF\n", pci_name(pdev));
+		return -ENODEV;
+	}
+
+	start = ktime_get();
+	admin_unit_sched_get(pf, vf, prio);
+	ret = admin_unit_transport_get()->exec(vf, virtio_dev, cmd);
+	admin_unit_sched_put(pf, prio, start);
+	if (READ_ONCE(g_trace.on))
+		admin_unit_trace_add(vf, cmd, start, ret);
+	/* failed or not, the mode may have changed */
+	if (cmd->opcode == VIRTIO_ADMIN_CMD_DEV_MODE_SET)
+		admin_unit_query_inval(vf, ADMIN_UNIT_Q_MODE);
+	return ret;
+}
+
+static int admin_unit_vf_weight_set(struct admin_vf *vf, int weight)
+{
+	if (!vf)
+		return -ENODEV;
+	if (weight < 1 || weight > 64)
+		return -EINVAL;
+
+	spin_lock(&vf->pf->sched.lock);
+	vf->sched.weight = weight;
+	spin_unlock(&vf->pf->sched.lock);
+	return 0;
+}
+
+struct admin_unit_mig_rec {
+	u64 seq;
+	u32 src_vf;
+	u32 dst_vf;
+	struct admin_unit_tl src;
+	struct admin_unit_tl dst;
+	s64 downtime_ns;
+};
+
+struct admin_unit_phase_agg {
+	u64 cnt;
+	u64 sum_ns;
+	u64 min_ns;
+	u64 max_ns;
+};
+
+#define ADMIN_UNIT_MIG_HIST	16
+
+/* result of the last mig_pairs run */
+struct admin_unit_pair_res {
+	u32 src_vf;
+	u32 dst_vf;
+	int ret;
+	u64 bytes;
+	s64 downtime_ns;
+	/* mig_verify only */
+	s64 verify_ns;
+	u64 diff_bytes;
+};
+
+struct admin_unit_mig_run {
+	int nr_pairs;
+	s64 wall_ns;
+	u64 bytes;
+	struct admin_unit_pair_res pair[ADMIN_UNIT_MAX_PAIRS];
+};
+
+struct admin_unit_mig_mgr {
+	u64 mig_seq;
+	struct admin_unit_mig_rec hist[ADMIN_UNIT_MIG_HIST];
+
+	struct admin_unit_phase_agg src_agg[MIG_PHASE_MAX];
+	struct admin_unit_phase_agg dst_agg[MIG_PHASE_MAX];
+	struct admin_unit_phase_agg downtime_agg;
+
+	struct admin_unit_mig_run last_run;
+};
+
+static struct admin_unit_mig_mgr g_mig_mgr;
+static DEFINE_SPINLOCK(admin_unit_tl_lock);
+
+static void admin_unit_agg_add(struct admin_unit_phase_agg *agg, u64 ns)
+{
+	if (!agg->cnt || ns < agg->min_ns)
+		agg->min_ns = ns;
+	if (ns > agg->max_ns)
+		agg->max_ns = ns;
+	agg->sum_ns += ns;
+	agg->cnt++;
+}
+
+static u64 admin_unit_tl_span(struct admin_unit_tl *tl, int phase)
+{
+	if (!tl->cmds[phase])
+		return 0;
+	return ktime_to_ns(ktime_sub(tl->end[phase], tl->start[phase]));
+}
+
+static void admin_unit_tl_mark(struct admin_vf *vf, int phase, ktime_t start)
+{
+	ktime_t end = ktime_get();
+	struct admin_unit_tl *tl;
+
+	spin_lock(&admin_unit_tl_lock);
+	tl = &vf->tl;
+
+	/* STOP opens a new migration cycle on this VF */
+	if (phase == MIG_PHASE_STOP)
+		memset(tl, 0, sizeof(*tl));
+
+	if (!tl->cmds[phase])
+		tl->start[phase] = start;
+	tl->end[phase] = end;
+	tl->busy_ns[phase] += ktime_to_ns(ktime_sub(end, start));
+	tl->cmds[phase]++;
+	spin_unlock(&admin_unit_tl_lock);
+}
+
+/* dst was just written with the ctx saved from src */
+static void admin_unit_tl_link(struct admin_vf *dst, struct admin_vf *src)
+{
+	spin_lock(&admin_unit_tl_lock);
+	dst->mig_linked = true;
+	dst->mig_src = src->id;
+	dst->mig_src_tl = src->tl;
+	spin_unlock(&admin_unit_tl_lock);
+}
+
+/* dst reached ACTIVE: close the migration record if one is pending */
+static void admin_unit_tl_finish(struct admin_vf *dst)
+{
+	struct admin_unit_mig_rec *rec;
+	ktime_t begin;
+	int i;
+
+	spin_lock(&admin_unit_tl_lock);
+	if (!dst->mig_linked)
+		goto out;
+
+	rec = &g_mig_mgr.hist[g_mig_mgr.mig_seq % ADMIN_UNIT_MIG_HIST];
+	rec->seq = g_mig_mgr.mig_seq++;
+	rec->src_vf = dst->mig_src;
+	rec->dst_vf = dst->id;
+	rec->src = dst->mig_src_tl;
+	rec->dst = dst->tl;
+
+	/* guest downtime: source stops (or freezes) until destination is active */
+	if (rec->src.cmds[MIG_PHASE_STOP])
+		begin = rec->src.start[MIG_PHASE_STOP];
+	else
+		begin = rec->src.start[MIG_PHASE_FREEZE];
+	rec->downtime_ns = begin ?
+		ktime_to_ns(ktime_sub(rec->dst.end[MIG_PHASE_ACTIVE], begin)) : 0;
+
+	for (i = 0; i < MIG_PHASE_MAX; i++) {
+		if (rec->src.cmds[i])
+			admin_unit_agg_add(&g_mig_mgr.src_agg[i],
+					   admin_unit_tl_span(&rec->src, i));
+		if (rec->dst.cmds[i])
+			admin_unit_agg_add(&g_mig_mgr.dst_agg[i],
+					   admin_unit_tl_span(&rec->dst, i));
+	}
+	if (rec->downtime_ns > 0)
+		admin_unit_agg_add(&g_mig_mgr.downtime_agg, rec->downtime_ns);
+
+	dst->mig_linked = false;
+out:
+	spin_unlock(&admin_unit_tl_lock);
+}
+
+static void admin_unit_tl_reset(void)
+{
+	unsigned long pi, vi;
+	struct admin_pf *pf;
+	struct admin_vf *vf;
+
+	spin_lock(&admin_unit_tl_lock);
+	memset(&g_mig_mgr, 0, sizeof(g_mig_mgr));
+	admin_unit_for_each_vf(pf, vf, pi, vi) {
+		memset(&vf->tl, 0, sizeof(vf->tl));
+		vf->mig_linked = false;
+	}
+	spin_unlock(&admin_unit_tl_lock);
+}
+
+static void admin_unit_tl_show_one(struct seq_file *m, const char *role,
+				   struct admin_unit_tl *tl)
+{
+	int i;
+
+	for (i = 0; i < MIG_PHASE_MAX; i++) {
+		if (!tl->cmds[i])
+			continue;
+		seq_printf(m, "  %s %-10s start %lld end %lld span %llu busy %llu cmds %u\n",
+			   role, mig_phase_name[i],
+			   ktime_to_ns(tl->start[i]), ktime_to_ns(tl->end[i]),
+			   admin_unit_tl_span(tl, i), tl->busy_ns[i], tl->cmds[i]);
+	}
+}
+
+static void admin_unit_agg_show(struct seq_file *m, const char *name,
+				struct admin_unit_phase_agg *agg)
+{
+	if (!agg->cnt)
+		return;
+	seq_printf(m, "  %-14s cnt %llu avg %llu min %llu max %llu\n",
+		   name, agg->cnt, div64_u64(agg->sum_ns, agg->cnt),
+		   agg->min_ns, agg->max_ns);
+}
+
+static int admin_unit_mig_tl_proc_show(struct seq_file *m, void *v)
+{
+	struct admin_unit_mig_mgr *mm;
+	struct admin_unit_mig_rec *rec;
+	struct admin_unit_mig_run *run;
+	char name[32];
+	u64 i, first;
+
+	/* snapshot so the spinlock is not held across seq_printf */
+	mm = kmalloc(sizeof(*mm), GFP_KERNEL);
+	if (!mm)
+		return -ENOMEM;
+	spin_lock(&admin_unit_tl_lock);
+	*mm = g_mig_mgr;
+	spin_unlock(&admin_unit_tl_lock);
+
+	first = mm->mig_seq > ADMIN_UNIT_MIG_HIST ?
+		mm->mig_seq - ADMIN_UNIT_MIG_HIST : 0;
+	for (i = first; i < mm->mig_seq; i++) {
+		rec = &mm->hist[i % ADMIN_UNIT_MIG_HIST];
+		seq_printf(m, "mig %llu: vf %u:%u -> vf %u:%u downtime %lld ns\n",
+			   rec->seq,
+			   ADMIN_VF_PF(rec->src_vf), ADMIN_VF_NR(rec->src_vf),
+			   ADMIN_VF_PF(rec->dst_vf), ADMIN_VF_NR(rec->dst_vf),
+			   rec->downtime_ns);
+		admin_unit_tl_show_one(m, "src", &rec->src);
+		admin_unit_tl_show_one(m, "dst", &rec->dst);
+	}
+
+	seq_printf(m, "aggregate (ns) over %llu migrations:\n", mm->mig_seq);
+	admin_unit_agg_show(m, "downtime", &mm->downtime_agg);
+	for (i = 0; i < MIG_PHASE_MAX; i++) {
+		snprintf(name, sizeof(name), "src_%s", mig_phase_name[i]);
+		admin_unit_agg_show(m, name, &mm->src_agg[i]);
+		snprintf(name, sizeof(name), "dst_%s", mig_phase_name[i]);
+		admin_unit_agg_show(m, name, &mm->dst_agg[i]);
+	}
+
+	run = &mm->last_run;
+	if (run->nr_pairs) {
+		seq_printf(m, "last mig_pairs: %d pairs %llu bytes in %lld ns (%llu KB/s)\n",
+			   run->nr_pairs, run->bytes, run->wall_ns,
+			   run->wall_ns > 0 ?
+			   div64_u64(run->bytes * (NSEC_PER_SEC / 1024),
+				     run->wall_ns) : 0);
+		for (i = 0; i < run->nr_pairs; i++)
+			seq_printf(m, "  vf %u:%u -> vf %u:%u ret %d bytes %llu downtime %lld ns verify %lld ns diff %llu\n",
+				   ADMIN_VF_PF(run->pair[i].src_vf),
+				   ADMIN_VF_NR(run->pair[i].src_vf),
+				   ADMIN_VF_PF(run->pair[i].dst_vf),
+				   ADMIN_VF_NR(run->pair[i].dst_vf),
+				   run->pair[i].ret, run->pair[i].bytes,
+				   run->pair[i].downtime_ns,
+				   run->pair[i].verify_ns,
+				   run->pair[i].diff_bytes);
+	}
+
+	kfree(mm);
+	return 0;
+}
+
+static int admin_unit_mig_tl_proc_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, admin_unit_mig_tl_proc_show, NULL);
+}
+
+static const struct proc_ops admin_unit_mig_tl_proc_fops = {
+	.proc_open	= admin_unit_mig_tl_proc_open,
+	.proc_read	= seq_read,
+	.proc_lseek	= seq_lseek,
+	.proc_release	= single_release,
+};
+
+static int admin_unit_cmd_proc_show(struct seq_file *m, void *v)
+{
+	pr_err("godfeng %s:%d\n",__func__, __LINE__);
+	return 0;
+}
+
+static int admin_unit_cmd_proc_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, admin_unit_cmd_proc_show, NULL);
+}
+
+static int admin_unit_cmd_list_query(struct pci_dev *pdev,
+				     u8 *buf, int buf_size)
+{
+	struct virtio_device *virtio_dev = virtio_pci_vf_get_pf_dev(pdev);
+	struct virtio_admin_cmd cmd = {};
+	struct scatterlist out_sg;
+
+	if (!virtio_dev)
+		return -ENOTCONN;
+
+	dev_info(&pdev->dev, "Vf pdev(%s) domain %d bus %#x devfn %#x",
+		pci_name(pdev),
+		pci_domain_nr(pdev->bus),
+		pdev->bus->number, pdev->devfn);
+	dev_info(&virtio_dev->dev, "Find out PF(%s)\n", dev_name(&virtio_dev->dev));
+
+	sg_init_one(&out_sg, buf, buf_size);
+	cmd.opcode = VIRTIO_ADMIN_CMD_LIST_QUERY;
+	cmd.group_type = VIRTIO_ADMIN_GROUP_TYPE_SRIOV;
+	cmd.result_sg = &out_sg;
+
+	return admin_unit_exec(pdev, virtio_dev, &cmd, ADMIN_UNIT_PRIO_NORMAL);
+}
+
+static int admin_unit_cmd_dev_mode_get(struct pci_dev *pdev,
+				       u8 *buf, int buf_size)
+{
+	struct virtio_device *virtio_dev = virtio_pci_vf_get_pf_dev(pdev);
+	struct virtio_admin_cmd cmd = {};
+	struct scatterlist out_sg;
+
+	if (!virtio_dev)
+		return -ENOTCONN;
+
+	if (!pdev->is_virtfn)
+		pr_err("pdev should be a Virtual Function.\n");
+
+	dev_info(&pdev->dev, "Vf pdev(%s) domain %d bus %#x devfn %#x",
+		pci_name(pdev),
+		pci_domain_nr(pdev->bus),
+		pdev->bus->number, pdev->devfn);
+
+	dev_info(&virtio_dev->dev, "Use PF(%s) send cmd for VF id (%d)\n",
+		dev_name(&virtio_dev->dev),
+		pci_iov_vf_id(pdev));
+
+	sg_init_one(&out_sg, buf, buf_size);
+	cmd.opcode = VIRTIO_ADMIN_CMD_DEV_MODE_GET;
+	cmd.group_type = VIRTIO_ADMIN_GROUP_TYPE_SRIOV;
+	cmd.group_member_id = pci_iov_vf_id(pdev) + 1;
+	cmd.result_sg = &out_sg;
+
+	return admin_unit_exec(pdev, virtio_dev, &cmd, ADMIN_UNIT_PRIO_NORMAL);
+}
+
+static int admin_unit_cmd_dev_mode_set(struct pci_dev *pdev, uint8_t mode)
+{
+	struct virtio_device *virtio_dev = virtio_pci_vf_get_pf_dev(pdev);
+	struct virtio_admin_cmd_dev_mode *in;
+	struct virtio_admin_cmd cmd = {};
+	struct scatterlist in_sg;
+	int prio, ret;
+
+	if (!virtio_dev)
+		return -ENOTCONN;
+
+	if (!pdev->is_virtfn)
+		pr_err("pdev should be a Virtual Function.\n");
+
+	dev_info(&pdev->dev, "Vf pdev(%s) domain %d bus %#x devfn %#x",
+		pci_name(pdev),
+		pci_domain_nr(pdev->bus),
+		pdev->bus->number, pdev->devfn);
+
+	dev_info(&virtio_dev->dev, "Use PF(%s) send cmd for VF id (%d)\n",
+		dev_name(&virtio_dev->dev),
+		pci_iov_vf_id(pdev));
+
+	in = kzalloc_node(sizeof(*in), GFP_KERNEL, admin_unit_node(pdev));
+	if (!in)
+		return -ENOMEM;
+	in->mode = mode;
+	sg_init_one(&in_sg, in, sizeof(*in));
+	cmd.opcode = VIRTIO_ADMIN_CMD_DEV_MODE_SET;
+	cmd.group_type = VIRTIO_ADMIN_GROUP_TYPE_SRIOV;
+	cmd.group_member_id = pci_iov_vf_id(pdev) + 1;
+	cmd.data_sg = &in_sg;
+
+	/* leaving ACTIVE is on the downtime path, resuming is not */
+	prio = mode == VIRTIO_ADMIN_DEV_MODE_ACTIVE ?
+	       ADMIN_UNIT_PRIO_NORMAL : ADMIN_UNIT_PRIO_CRIT;
+	ret = admin_unit_exec(pdev, virtio_dev, &cmd, prio);
+	kfree(in);
+	return ret;
+}
+
+static int admin_unit_cmd_dev_mode_set_proc(struct admin_vf *vf, uint8_t mode)
+{
+	ktime_t start;
+	int ret = 0;
+
+	if (!vf)
+		return -ENODEV;
+
+	pr_err("%s:%d: exec dev_mode_set \n",__func__, __LINE__);
+
+	start = ktime_get();
+	ret = admin_unit_cmd_dev_mode_set(vf->pdev, mode);
+	if (ret)
+		pr_err("Failed to run admin_unit_cmd_dev_mode_set ret(%d)\n",
+			ret);
+
+	switch (mode) {
+	case VIRTIO_ADMIN_DEV_MODE_STOP:
+		admin_unit_tl_mark(vf, MIG_PHASE_STOP, start);
+		break;
+	case VIRTIO_ADMIN_DEV_MODE_FREEZE:
+		admin_unit_tl_mark(vf, MIG_PHASE_FREEZE, start);
+		break;
+	case VIRTIO_ADMIN_DEV_MODE_ACTIVE:
+		admin_unit_tl_mark(vf, MIG_PHASE_ACTIVE, start);
+		if (!ret)
+			admin_unit_tl_finish(vf);
+		break;
+	}
+
+	pr_err("Dump out ret = %#x\n", ret);
+	return ret;
+}
+
+
+static int
+admin_unit_cmd_dev_ctx_sz_get(struct pci_dev *pdev, uint8_t freeze_mode,
+			      u8 *buf, int buf_size)
+{
+	struct virtio_device *virtio_dev = virtio_pci_vf_get_pf_dev(pdev);
+	struct virtio_admin_cmd_dev_ctx_size_get_data *in;
+	struct scatterlist in_sg, out_sg;
+	struct virtio_admin_cmd cmd = {};
+	int prio, ret;
+
+	if (!virtio_dev)
+		return -ENOTCONN;
+
+	if (!pdev->is_virtfn)
+		pr_err("pdev should be a Virtual Function.\n");
+
+	dev_info(&pdev->dev, "Vf pdev(%s) domain %d bus %#x devfn %#x",
+		pci_name(pdev),
+		pci_domain_nr(pdev->bus),
+		pdev->bus->number, pdev->devfn);
+
+	dev_info(&virtio_dev->dev, "Use PF(%s) send cmd for VF id (%d)\n",
+		dev_name(&virtio_dev->dev),
+		pci_iov_vf_id(pdev));
+
+	in = kzalloc_node(sizeof(*in), GFP_KERNEL, admin_unit_node(pdev));
+	if (!in)
+		return -ENOMEM;
+	in->freeze_mode = freeze_mode;
+
+	sg_init_one(&in_sg, in, sizeof(*in));
+	sg_init_one(&out_sg, buf, buf_size);
+
+	cmd.opcode = VIRTIO_ADMIN_CMD_DEV_CTX_SIZE_GET;
+	cmd.group_type = VIRTIO_ADMIN_GROUP_TYPE_SRIOV;
+	cmd.group_member_id = pci_iov_vf_id(pdev) + 1;
+	cmd.data_sg = &in_sg;
+	cmd.result_sg = &out_sg;
+
+	/* the final, freeze mode size get happens with the guest stopped */
+	prio = freeze_mode ? ADMIN_UNIT_PRIO_CRIT : ADMIN_UNIT_PRIO_NORMAL;
+	ret = admin_unit_exec(pdev, virtio_dev, &cmd, prio);
+	kfree(in);
+	return ret;
+}
+
+static int
+admin_unit_cmd_dev_ctx_sz_get_proc(struct admin_vf *vf, uint8_t freeze_mode)
+{
+	struct virtio_admin_cmd_dev_ctx_size_get_result *res;
+	ktime_t start;
+	int ret = 0;
+
+	if (!vf)
+		return -ENODEV;
+
+	res = kzalloc_node(sizeof(*res), GFP_KERNEL, vf->pf->node);
+	if (!res) {
+		pr_err("Can not alloc memory \n");
+		return -ENOMEM;
+	}
+
+	pr_err("%s:%d: exec dev_ctx_sz_get \n",__func__, __LINE__);
+
+	start = ktime_get();
+	ret = admin_unit_cmd_dev_ctx_sz_get(vf->pdev, freeze_mode,
+					    (u8 *)res, sizeof(*res));
+	admin_unit_tl_mark(vf, MIG_PHASE_CTX_SZ_GET, start);
+	if (ret) {
+		pr_err("Failed to run admin_unit_cmd_dev_ctx_sz_get ret(%d)\n",
+			ret);
+		goto out;
+	}
+
+	mutex_lock(&vf->lock);
+	if (!vf->ctx)
+		vf->cur.size = le64_to_cpu(res->size);
+	vf->cur.left = le64_to_cpu(res->size);
+	mutex_unlock(&vf->lock);
+
+out:
+	pr_err("Dump out ret %d \n", ret);
+	pr_err(" ctx size = %#llx \n", le64_to_cpu(res->size));
+	kfree(res);
+	return ret;
+}
+
+static int
+admin_unit_cmd_dev_ctx_rd_sg(struct pci_dev *pdev, struct scatterlist *data,
+			     u32 *rd_sz, u32 *remaining_sz)
+{
+	struct virtio_device *virtio_dev = virtio_pci_vf_get_pf_dev(pdev);
+	struct virtio_admin_cmd_dev_ctx_rd_result *res = NULL;
+	struct virtio_admin_cmd cmd = {};
+	struct scatterlist sgs[2];
+	int ret = 0;
+
+	if (!virtio_dev)
+		return -ENOTCONN;
+
+	if (!pdev->is_virtfn)
+		pr_err("pdev should be a Virtual Function.\n");
+
+	dev_info(&pdev->dev, "Vf pdev(%s) domain %d bus %#x devfn %#x",
+		pci_name(pdev),
+		pci_domain_nr(pdev->bus),
+		pdev->bus->number, pdev->devfn);
+
+	dev_info(&virtio_dev->dev, "Use PF(%s) send cmd for VF id (%d)\n",
+		dev_name(&virtio_dev->dev),
+		pci_iov_vf_id(pdev));
+
+	res = kzalloc_node(sizeof(struct virtio_admin_cmd_dev_ctx_rd_result),
+			   GFP_KERNEL, admin_unit_node(pdev));
+	if (!res) {
+		dev_err(&virtio_dev->dev,
+			"Failed to alloc result header size(%lu)\n",
+			sizeof(struct virtio_admin_cmd_dev_ctx_rd_result));
+		return -ENOMEM;
+	}
+
+	/* result header, followed by the caller's data list */
+	sg_init_table(sgs, 2);
+	sg_set_buf(&sgs[0], res, sizeof(struct virtio_admin_cmd_dev_ctx_rd_result));
+	sg_chain(sgs, 2, data);
+
+	cmd.opcode = VIRTIO_ADMIN_CMD_DEV_CTX_READ;
+	cmd.group_type = VIRTIO_ADMIN_GROUP_TYPE_SRIOV;
+	cmd.group_member_id = pci_iov_vf_id(pdev) + 1;
+	cmd.result_sg = sgs;
+	ret = admin_unit_exec(pdev, virtio_dev, &cmd, ADMIN_UNIT_PRIO_BULK);
+	if (ret) {
+		dev_err(&virtio_dev->dev,
+			"Failed to run command ret(%d)\n", ret);
+		goto out;
+	}
+
+	*rd_sz = le32_to_cpu(res->size);
+	*remaining_sz = le32_to_cpu(res->remaining_ctx_size);
+
+out:
+	if (res)
+		kfree(res);
+	return ret;
+}
+
+static int
+admin_unit_cmd_dev_ctx_rd(struct pci_dev *pdev, u8 *buf, u32 buf_size,
+			  u32 *rd_sz, u32 *remaining_sz)
+{
+	struct scatterlist sg;
+
+	sg_init_one(&sg, buf, buf_size);
+	return admin_unit_cmd_dev_ctx_rd_sg(pdev, &sg, rd_sz, remaining_sz);
+}
+
+static int
+admin_unit_cmd_dev_ctx_wr_sg(struct pci_dev *pdev, struct scatterlist *data)
+{
+	struct virtio_device *virtio_dev = virtio_pci_vf_get_pf_dev(pdev);
+	struct virtio_admin_cmd cmd = {};
+	int ret;
+
+	if (!virtio_dev)
+		return -ENOTCONN;
+
+	if (!pdev->is_virtfn)
+		pr_err("pdev should be a Virtual Function.\n");
+
+	dev_info(&pdev->dev, "Vf pdev(%s) domain %d bus %#x devfn %#x",
+		pci_name(pdev),
+		pci_domain_nr(pdev->bus),
+		pdev->bus->number, pdev->devfn);
+
+	dev_info(&virtio_dev->dev, "Use PF(%s) send cmd for VF id (%d)\n",
+		dev_name(&virtio_dev->dev),
+		pci_iov_vf_id(pdev));
+
+	cmd.opcode = VIRTIO_ADMIN_CMD_DEV_CTX_WRITE;
+	cmd.group_type = VIRTIO_ADMIN_GROUP_TYPE_SRIOV;
+	cmd.group_member_id = pci_iov_vf_id(pdev) + 1;
+	cmd.data_sg = data;
+	ret = admin_unit_exec(pdev, virtio_dev, &cmd, ADMIN_UNIT_PRIO_BULK);
+	return ret;
+}
+
+/*
+ * admin_unit_core_ops of one VF, moving ctx windows through sgl, or for
+ * chunk_tune, reading into the flat buf when there is no ctx.
+ */
+struct admin_unit_io {
+	struct admin_vf *vf;
+	struct admin_unit_ctx *ctx;
+	u8 *buf;
+	struct scatterlist *sgl;
+};
+
+static int admin_unit_io_sz_get(void *priv, u64 *size)
+{
+	struct virtio_admin_cmd_dev_ctx_size_get_result *res;
+	struct admin_unit_io *io = priv;
+	int ret;
+
+	res = kzalloc_node(sizeof(*res), GFP_KERNEL, io->vf->pf->node);
+	if (!res)
+		return -ENOMEM;
+	ret = admin_unit_cmd_dev_ctx_sz_get(io->vf->pdev, 0, (u8 *)res,
+					    sizeof(*res));
+	*size = le64_to_cpu(res->size);
+	kfree(res);
+	return ret;
+}
+
+static int admin_unit_io_rd(void *priv, u64 off, u32 len, u32 *rd_sz,
+			    u32 *remaining)
+{
+	struct admin_unit_io *io = priv;
+
+	if (!io->ctx)
+		return admin_unit_cmd_dev_ctx_rd(io->vf->pdev, io->buf, len,
+						 rd_sz, remaining);
+	admin_unit_ctx_sg(io->ctx, off, len, io->sgl);
+	return admin_unit_cmd_dev_ctx_rd_sg(io->vf->pdev, io->sgl, rd_sz,
+					    remaining);
+}
+
+static int admin_unit_io_wr(void *priv, u64 off, u32 len)
+{
+	struct admin_unit_io *io = priv;
+
+	admin_unit_ctx_sg(io->ctx, off, len, io->sgl);
+	return admin_unit_cmd_dev_ctx_wr_sg(io->vf->pdev, io->sgl);
+}
+
+static const struct admin_unit_core_ops admin_unit_io_ops = {
+	.ctx_sz_get	= admin_unit_io_sz_get,
+	.ctx_rd		= admin_unit_io_rd,
+	.ctx_wr		= admin_unit_io_wr,
+};
+
+/*
+ * Move [off, off + len) of ctx from (read) or to (write) the device of
+ * vf, one window per admin command.  *done is the bytes transferred.
+ */
+static int admin_unit_ctx_xfer(struct admin_vf *vf, struct admin_unit_ctx *ctx,
+			       u64 off, u64 len, bool wr, u64 *done)
+{
+	struct admin_unit_io io = { .vf = vf, .ctx = ctx };
+	struct admin_unit_xfer x;
+	int ret;
+
+	*done = 0;
+	if (!wr) {
+		ret = admin_unit_ctx_unshare(vf, ctx, off, len);
+		if (ret)
+			return ret;
+	}
+	io.sgl = kmalloc_array_node(ADMIN_UNIT_CTX_WIN_PAGES, sizeof(*io.sgl),
+				    GFP_KERNEL, vf->pf->node);
+	if (!io.sgl)
+		return -ENOMEM;
+
+	ret = admin_unit_core_xfer(&admin_unit_io_ops, &io, wr, off, len,
+				   vf->pf->win, &x);
+	*done = x.bytes;
+
+	kfree(io.sgl);
+	return ret;
+}
+
+/*
+ * The next partial read into, or write from, ctx at cur on the device
+ * of vf: sz bytes, or with all the rest of the ctx.  See
+ * admin_unit_core_partial() for how cur moves.
+ */
+static int admin_unit_ctx_partial(struct admin_vf *vf,
+				  struct admin_unit_ctx *ctx,
+				  struct admin_unit_cursor *cur, bool wr,
+				  u64 sz, bool all, u64 *done)
+{
+	struct admin_unit_io io = { .vf = vf, .ctx = ctx };
+	struct admin_unit_xfer x;
+	int ret;
+
+	*done = 0;
+	if (!wr) {
+		ret = admin_unit_ctx_unshare(vf, ctx, cur->off,
+					     all ? cur->left :
+						   min(sz, cur->left));
+		if (ret)
+			return ret;
+	}
+	io.sgl = kmalloc_array_node(ADMIN_UNIT_CTX_WIN_PAGES, sizeof(*io.sgl),
+				    GFP_KERNEL, vf->pf->node);
+	if (!io.sgl)
+		return -ENOMEM;
+
+	ret = admin_unit_core_partial(&admin_unit_io_ops, &io, cur, wr, sz,
+				      all, vf->pf->win, &x);
+	*done = x.bytes;
+
+	kfree(io.sgl);
+	return ret;
+}
+
+static int
+admin_unit_cmd_dev_ctx_rd_proc(struct admin_vf *vf)
+{
+	ktime_t start;
+	u64 done = 0;
+	int ret = 0;
+
+	if (!vf)
+		return -ENODEV;
+
+	mutex_lock(&vf->lock);
+	if (!vf->cur.size){
+		pr_err("Should read ctx sz first");
+		ret = -EINVAL;
+		goto out;
+	}
+
+	ret = admin_unit_vf_ctx_alloc(vf, false);
+	if (ret)
+		goto out;
+
+	pr_err("%s:%d: exec dev ctx read on vf %s\n",__func__, __LINE__, vf->name);
+
+	start = ktime_get();
+	ret = admin_unit_ctx_xfer(vf, vf->ctx, 0, vf->cur.size, false, &done);
+	admin_unit_tl_mark(vf, MIG_PHASE_CTX_RD, start);
+	admin_unit_numa_account(vf->pf, done);
+	if (ret)
+		pr_err("Failed to run admin_unit_cmd_dev_ctx_rd ret(%d)\n",
+			ret);
+	/* the pages past what the device returned may hold an older ctx */
+	if (done < vf->cur.size)
+		admin_unit_ctx_zero_from(vf->ctx, done);
+
+	admin_unit_cursor_init(&vf->cur, vf->cur.size);
+	if (!ret && admin_unit_vf_opt(vf, ctx_dedup))
+		admin_unit_ctx_dedup(vf, vf->ctx);
+
+	pr_err("Dump out ret %d \n", ret);
+	pr_err("rd_sz = %#llx \n", done);
+out:
+	mutex_unlock(&vf->lock);
+	return ret;
+}
+
+static int
+admin_unit_cmd_dev_ctx_rd_partial_proc(struct admin_vf *vf, u64 sz, bool left)
+{
+	ktime_t start;
+	u64 done = 0;
+	int ret = 0;
+
+	if (!vf)
+		return -ENODEV;
+
+	mutex_lock(&vf->lock);
+	if (!vf->cur.left){
+		pr_err("Should read ctx sz first");
+		ret = -EINVAL;
+		goto out;
+	}
+
+	ret = admin_unit_vf_ctx_alloc(vf, true);
+	if (ret)
+		goto out;
+
+	if (sz == ADMIN_UNIT_CHUNK_AUTO)
+		sz = admin_unit_chunk_sz(vf->pf);
+
+	pr_err("%s:%d: exec dev ctx read at %llu on vf %s\n",
+		__func__, __LINE__, vf->cur.off, vf->name);
+
+	start = ktime_get();
+	/* only what the device returned is in vf->ctx */
+	ret = admin_unit_ctx_partial(vf, vf->ctx, &vf->cur, false, sz, left,
+				     &done);
+	admin_unit_tl_mark(vf, MIG_PHASE_CTX_RD, start);
+	admin_unit_numa_account(vf->pf, done);
+	if (ret)
+		pr_err("Failed to run admin_unit_cmd_dev_ctx_rd ret(%d)\n",
+			ret);
+	pr_err("vf %s ctx_left = %#llx \n", vf->name, vf->cur.left);
+
+	pr_err("Dump out ret %d \n", ret);
+	pr_err("rd_sz = %#llx \n", done);
+
+	/* the cursor was reset after read all */
+	if (left && !ret && admin_unit_vf_opt(vf, ctx_dedup))
+		admin_unit_ctx_dedup(vf, vf->ctx);
+out:
+	mutex_unlock(&vf->lock);
+	return ret;
+}
+
+/* take the ctx saved from vf, NULL when there is none */
+static struct admin_unit_ctx *admin_unit_vf_ctx_take(struct admin_vf *vf)
+{
+	struct admin_unit_ctx *ctx;
+
+	mutex_lock(&vf->lock);
+	ctx = vf->ctx;
+	if (ctx) {
+		vf->ctx = NULL;
+		admin_unit_cursor_init(&vf->cur, 0);
+	}
+	mutex_unlock(&vf->lock);
+	return ctx;
+}
+
+/*
+ * Take the ctx saved from vf only if it is whole: -EBUSY while partial
+ * reads or writes are part way through it, *ctx NULL when there is none.
+ */
+static int admin_unit_vf_ctx_take_whole(struct admin_vf *vf,
+					struct admin_unit_ctx **ctx)
+{
+	int ret = 0;
+
+	mutex_lock(&vf->lock);
+	*ctx = vf->ctx;
+	if (*ctx && vf->cur.off && vf->cur.left) {
+		*ctx = NULL;
+		ret = -EBUSY;
+	} else if (*ctx) {
+		vf->ctx = NULL;
+		admin_unit_cursor_init(&vf->cur, 0);
+	}
+	mutex_unlock(&vf->lock);
+	return ret;
+}
+
+/* give a taken ctx back to vf, unless a new one was saved meanwhile */
+static void admin_unit_vf_ctx_untake(struct admin_vf *vf,
+				     struct admin_unit_ctx *ctx)
+{
+	mutex_lock(&vf->lock);
+	if (!vf->ctx) {
+		vf->ctx = ctx;
+		admin_unit_cursor_init(&vf->cur, ctx->size);
+		ctx = NULL;
+	}
+	mutex_unlock(&vf->lock);
+
+	if (ctx) {
+		admin_unit_mem_uncharge(vf, admin_unit_ctx_charge(ctx));
+		admin_unit_ctx_free(ctx);
+	}
+}
+
+/* take the last restored snapshot of vf, only on explicit request */
+static struct admin_unit_ctx *admin_unit_vf_restored_take(struct admin_vf *vf)
+{
+	struct admin_unit_ctx *ctx;
+
+	mutex_lock(&vf->lock);
+	ctx = vf->restored;
+	if (ctx) {
+		vf->restored = NULL;
+		atomic64_sub(ctx->size, &g_mem.restored);
+	}
+	mutex_unlock(&vf->lock);
+	return ctx;
+}
+
+/*
+ * Restore the ctx saved from src into dst.  src and dst may be any two
+ * registered VFs, on the same PF or not: each command is routed through
+ * the PF owning its own VF.
+ */
+static int
+admin_unit_cmd_dev_ctx_wr_proc(struct admin_vf *dst, struct admin_vf *src)
+{
+	struct admin_unit_ctx *ctx;
+	ktime_t start;
+	u64 done = 0;
+	int ret = 0;
+
+	if (!dst || !src || dst == src)
+		return -EINVAL;
+
+	ctx = admin_unit_vf_ctx_take(src);
+	if (!ctx){
+		pr_err("Should read vf %s dev ctx first", src->name);
+		return -EINVAL;
+	}
+
+	pr_err("%s:%d: exec dev ctx write vf %s -> vf %s\n",
+		__func__, __LINE__, src->name, dst->name);
+
+	start = ktime_get();
+	ret = admin_unit_ctx_xfer(dst, ctx, 0, ctx->size, true, &done);
+	if (ret)
+		pr_err("Failed to run admin_unit_cmd_dev_ctx_wr ret(%d)\n",
+			ret);
+	admin_unit_tl_mark(dst, MIG_PHASE_CTX_WR, start);
+	admin_unit_numa_account(dst->pf, done);
+	admin_unit_tl_link(dst, src);
+
+	/* a failed restore can be retried from the same save */
+	if (!ret)
+		admin_unit_vf_keep_restored(src, ctx);
+	else
+		admin_unit_vf_ctx_untake(src, ctx);
+	return ret;
+}
+
+static int
+admin_unit_cmd_dev_ctx_wr_partial_proc(struct admin_vf *dst, struct admin_vf *src,
+				       u64 sz, bool left)
+{
+	struct admin_unit_ctx *ctx, *total = NULL;
+	ktime_t start;
+	u64 done = 0;
+	int ret = 0;
+
+	if (!dst || !src || dst == src)
+		return -EINVAL;
+
+	/* src->lock keeps the saved ctx alive while dst consumes it */
+	mutex_lock(&src->lock);
+	ctx = src->ctx;
+	if (!ctx){
+		pr_err("Should read vf %s dev ctx first", src->name);
+		ret = -EINVAL;
+		goto out;
+	}
+	if (sz == ADMIN_UNIT_CHUNK_AUTO)
+		sz = admin_unit_chunk_sz(dst->pf);
+
+	pr_err("%s:%d: exec dev ctx write at %llu vf %s -> vf %s\n",
+		__func__, __LINE__, src->cur.off, src->name, dst->name);
+
+	start = ktime_get();
+	ret = admin_unit_ctx_partial(dst, ctx, &src->cur, true, sz, left,
+				     &done);
+	if (ret)
+		pr_err("Failed to run admin_unit_cmd_dev_ctx_wr ret(%d)\n",
+			ret);
+	admin_unit_tl_mark(dst, MIG_PHASE_CTX_WR, start);
+	admin_unit_numa_account(dst->pf, done);
+	admin_unit_tl_link(dst, src);
+
+	/* the rest went to dst, src keeps it as a restored snapshot */
+	if (left && !ret) {
+		total = ctx;
+		src->ctx = NULL;
+		admin_unit_cursor_init(&src->cur, 0);
+	}
+
+out:
+	mutex_unlock(&src->lock);
+	if (total)
+		admin_unit_vf_keep_restored(src, total);
+	return ret;
+}
+
+/*
+ * Streaming copy of the ctx of src into dst, without saving it: a
+ * reader kthread next to the source PF fills a ring of small slots
+ * while the caller writes the filled ones to dst, so slot i is written
+ * while slot i + 1 is read.  Only the ring is held, charged to src
+ * against mem_cap_kb, and the copy takes about the longer of the read
+ * and the write instead of their sum.
+ */
+#define ADMIN_UNIT_STREAM_SLOTS		4
+#define ADMIN_UNIT_STREAM_SLOT		(256 * 1024)
+#define ADMIN_UNIT_STREAM_SG		(ADMIN_UNIT_STREAM_SLOT / PAGE_SIZE + 1)
+
+struct admin_unit_stream {
+	struct admin_vf *src;
+	u64 size;
+	/* bytes per slot command, within both admin vqs */
+	u32 win;
+	struct admin_unit_ctx *slot[ADMIN_UNIT_STREAM_SLOTS];
+	u32 len[ADMIN_UNIT_STREAM_SLOTS];
+	/* the ring is charged to src */
+	bool charged;
+	struct scatterlist *rd_sgl;
+	struct scatterlist *wr_sgl;
+	/* slots filled by the reader and drained by the writer */
+	unsigned int head;
+	unsigned int tail;
+	/* the reader is done, rd_ret is its result */
+	bool eof;
+	/* the writer failed, the reader stops */
+	bool abort;
+	int rd_ret;
+	u64 rd_bytes;
+	wait_queue_head_t wait;
+	struct completion done;
+};
+
+static int admin_unit_stream_rd_thread(void *data)
+{
+	struct admin_unit_stream *s = data;
+	struct admin_unit_io io = { .vf = s->src, .sgl = s->rd_sgl };
+	ktime_t start = ktime_get();
+	unsigned int head = 0;
+	u32 n, rd_sz, remaining = 1;
+	u64 off = 0;
+	int ret = 0;
+
+	while (off < s->size && remaining) {
+		wait_event(s->wait,
+			   head - smp_load_acquire(&s->tail) < ADMIN_UNIT_STREAM_SLOTS ||
+			   READ_ONCE(s->abort));
+		if (READ_ONCE(s->abort))
+			break;
+
+		n = min_t(u64, s->size - off, s->win);
+		io.ctx = s->slot[head % ADMIN_UNIT_STREAM_SLOTS];
+		rd_sz = 0;
+		remaining = 0;
+		ret = admin_unit_io_rd(&io, 0, n, &rd_sz, &remaining);
+		if (!ret && (rd_sz > n || (rd_sz < n && remaining)))
+			ret = -EIO;
+		if (ret || !rd_sz)
+			break;
+		s->len[head % ADMIN_UNIT_STREAM_SLOTS] = rd_sz;
+		off += rd_sz;
+		/* publish the slot before the new head */
+		smp_store_release(&s->head, ++head);
+		wake_up(&s->wait);
+	}
+	admin_unit_tl_mark(s->src, MIG_PHASE_CTX_RD, start);
+
+	s->rd_ret = ret;
+	s->rd_bytes = off;
+	smp_store_release(&s->eof, true);
+	wake_up(&s->wait);
+	complete(&s->done);
+	return 0;
+}
+
+static void admin_unit_stream_free(struct admin_unit_stream *s)
+{
+	int i;
+
+	for (i = 0; i < ADMIN_UNIT_STREAM_SLOTS; i++)
+		admin_unit_ctx_free(s->slot[i]);
+	if (s->charged)
+		admin_unit_mem_uncharge(s->src, ADMIN_UNIT_STREAM_SLOTS *
+					ADMIN_UNIT_STREAM_SLOT);
+	kfree(s->wr_sgl);
+	kfree(s->rd_sgl);
+	kfree(s);
+}
+
+static struct admin_unit_stream *admin_unit_stream_alloc(struct admin_vf *src)
+{
+	int node = src->pf->node;
+	struct admin_unit_stream *s;
+	int i, ret;
+
+	s = kzalloc_node(sizeof(*s), GFP_KERNEL, node);
+	if (!s)
+		return ERR_PTR(-ENOMEM);
+	s->src = src;
+	init_waitqueue_head(&s->wait);
+	init_completion(&s->done);
+
+	ret = admin_unit_mem_charge(src, ADMIN_UNIT_STREAM_SLOTS *
+				    ADMIN_UNIT_STREAM_SLOT);
+	if (ret)
+		goto err;
+	s->charged = true;
+
+	ret = -ENOMEM;
+	s->rd_sgl = kmalloc_array_node(ADMIN_UNIT_STREAM_SG, sizeof(*s->rd_sgl),
+				       GFP_KERNEL, node);
+	s->wr_sgl = kmalloc_array_node(ADMIN_UNIT_STREAM_SG, sizeof(*s->wr_sgl),
+				       GFP_KERNEL, node);
+	if (!s->rd_sgl || !s->wr_sgl)
+		goto err;
+	for (i = 0; i < ADMIN_UNIT_STREAM_SLOTS; i++) {
+		s->slot[i] = admin_unit_ctx_alloc(src->pf, ADMIN_UNIT_STREAM_SLOT,
+						   false);
+		if (!s->slot[i])
+			goto err;
+	}
+	return s;
+err:
+	admin_unit_stream_free(s);
+	return ERR_PTR(ret);
+}
+
+/*
+ * Copy the ctx of the frozen src into dst through the ring.  The size
+ * get restarts the source read stream; *bytes is what reached dst.
+ */
+static int admin_unit_stream_copy(struct admin_vf *src, struct admin_vf *dst,
+				  u64 *bytes)
+{
+	struct admin_unit_io io = { .vf = src };
+	struct admin_unit_stream *s;
+	struct task_struct *task;
+	unsigned int tail = 0;
+	ktime_t start, t;
+	s64 wr_busy_ns = 0;
+	u32 len;
+	int node, ret;
+
+	*bytes = 0;
+	if (!src || !dst || src == dst)
+		return -EINVAL;
+
+	s = admin_unit_stream_alloc(src);
+	if (IS_ERR(s))
+		return PTR_ERR(s);
+
+	/* src->lock keeps the ctx commands of src out of the stream */
+	mutex_lock(&src->lock);
+	start = ktime_get();
+	ret = admin_unit_io_sz_get(&io, &s->size);
+	admin_unit_tl_mark(src, MIG_PHASE_CTX_SZ_GET, start);
+	if (!ret && !s->size)
+		ret = -ENODATA;
+	if (ret)
+		goto out;
+	s->win = min_t(u32, min(src->pf->win, dst->pf->win),
+		       ADMIN_UNIT_STREAM_SLOT);
+
+	node = src->pf->node;
+	task = kthread_create_on_node(admin_unit_stream_rd_thread, s, node,
+				      "admin_stream");
+	if (IS_ERR(task)) {
+		ret = PTR_ERR(task);
+		goto out;
+	}
+	if (node != NUMA_NO_NODE)
+		set_cpus_allowed_ptr(task, cpumask_of_node(node));
+	wake_up_process(task);
+
+	pr_debug("%s:%d: stream dev ctx %#llx bytes vf %s -> vf %s\n",
+		__func__, __LINE__, s->size, src->name, dst->name);
+
+	start = ktime_get();
+	io.vf = dst;
+	io.sgl = s->wr_sgl;
+	for (;;) {
+		wait_event(s->wait, smp_load_acquire(&s->head) != tail ||
+				    smp_load_acquire(&s->eof));
+		if (smp_load_acquire(&s->head) == tail)
+			break;
+
+		io.ctx = s->slot[tail % ADMIN_UNIT_STREAM_SLOTS];
+		len = s->len[tail % ADMIN_UNIT_STREAM_SLOTS];
+		t = ktime_get();
+		ret = admin_unit_io_wr(&io, 0, len);
+		wr_busy_ns += ktime_to_ns(ktime_sub(ktime_get(), t));
+		if (ret) {
+			WRITE_ONCE(s->abort, true);
+			wake_up(&s->wait);
+			break;
+		}
+		*bytes += len;
+		smp_store_release(&s->tail, ++tail);
+		wake_up(&s->wait);
+	}
+	wait_for_completion(&s->done);
+	if (!ret)
+		ret = s->rd_ret;
+	if (ret)
+		pr_err("Failed to stream ctx vf %s -> vf %s ret(%d)\n",
+			src->name, dst->name, ret);
+
+	admin_unit_tl_mark(dst, MIG_PHASE_CTX_WR, start);
+	admin_unit_numa_account(src->pf, s->rd_bytes);
+	admin_unit_numa_account(dst->pf, *bytes);
+	admin_unit_tl_link(dst, src);
+
+	pr_debug("stream vf %s -> vf %s: %llu bytes in %lld ns, writes busy %lld ns\n",
+		src->name, dst->name, *bytes,
+		ktime_to_ns(ktime_sub(ktime_get(), start)), wr_busy_ns);
+out:
+	mutex_unlock(&src->lock);
+	admin_unit_stream_free(s);
+	return ret;
+}
+
+static int
+admin_unit_cmd_sprt_field_query(struct pci_dev *pdev,
+				u8 *buf, int buf_size)
+{
+	struct virtio_device *virtio_dev = virtio_pci_vf_get_pf_dev(pdev);
+	struct scatterlist out_sg;
+	struct virtio_admin_cmd cmd = {};
+	int ret;
+
+	if (!virtio_dev)
+		return -ENOTCONN;
+
+	if (!pdev->is_virtfn)
+		pr_err("pdev should be a Virtual Function.\n");
+
+	dev_info(&pdev->dev, "Vf pdev(%s) domain %d bus %#x devfn %#x",
+		pci_name(pdev),
+		pci_domain_nr(pdev->bus),
+		pdev->bus->number, pdev->devfn);
+
+	dev_info(&virtio_dev->dev, "Use PF(%s) send cmd for VF id (%d)\n",
+		dev_name(&virtio_dev->dev),
+		pci_iov_vf_id(pdev));
+
+	sg_init_one(&out_sg, buf, buf_size);
+
+	cmd.opcode = VIRTIO_ADMIN_CMD_DEV_CTX_FIELDS_QUERY;
+	cmd.group_type = VIRTIO_ADMIN_GROUP_TYPE_SRIOV;
+	cmd.group_member_id = pci_iov_vf_id(pdev) + 1;
+	cmd.result_sg = &out_sg;
+
+	ret = admin_unit_exec(pdev, virtio_dev, &cmd, ADMIN_UNIT_PRIO_NORMAL);
+	return ret;
+}
+
+#define MAX_SUPPORT_FIELD	15
+
+struct admin_unit_query_op {
+	int size;
+	int (*exec)(struct pci_dev *pdev, u8 *buf, int buf_size);
+};
+
+static const struct admin_unit_query_op admin_unit_query_ops[ADMIN_UNIT_Q_MAX] = {
+	[ADMIN_UNIT_Q_LIST] = {
+		.size	= DIV_ROUND_UP(VIRTIO_ADMIN_MAX_CMD_OPCODE, 64) * 8,
+		.exec	= admin_unit_cmd_list_query,
+	},
+	[ADMIN_UNIT_Q_MODE] = {
+		.size	= sizeof(struct virtio_admin_cmd_dev_mode),
+		.exec	= admin_unit_cmd_dev_mode_get,
+	},
+	[ADMIN_UNIT_Q_FIELDS] = {
+		.size	= MAX_SUPPORT_FIELD *
+			  sizeof(struct virtio_admin_cmd_dev_ctx_supported_field),
+		.exec	= admin_unit_cmd_sprt_field_query,
+	},
+};
+
+/*
+ * Run query op of vf into the first len bytes of buf.  A caller that
+ * finds the same query in flight waits for it and takes its result,
+ * so pollers of one VF cost one device command between them.
+ */
+static int admin_unit_query(struct admin_vf *vf, int op, u8 *buf, int len)
+{
+	const struct admin_unit_query_op *qo = &admin_unit_query_ops[op];
+	struct admin_unit_query *q = &vf->query[op];
+	u64 seq, gen;
+	u8 *res;
+	int ret;
+
+	BUILD_BUG_ON(MAX_SUPPORT_FIELD *
+		     sizeof(struct virtio_admin_cmd_dev_ctx_supported_field) >
+		     ADMIN_UNIT_QUERY_SZ);
+
+	/* more than a full result is only known to the device */
+	if (len > qo->size)
+		return qo->exec(vf->pdev, buf, len);
+
+	spin_lock(&vf->query_lock);
+	seq = q->seq;
+	if (q->valid && time_before(jiffies, q->expires)) {
+		memcpy(buf, q->data, len);
+		spin_unlock(&vf->query_lock);
+		atomic64_inc(&g_query.cached);
+		return 0;
+	}
+	spin_unlock(&vf->query_lock);
+
+	mutex_lock(&q->lock);
+	spin_lock(&vf->query_lock);
+	/* a command completed while this caller waited for it */
+	if (q->valid && q->seq != seq) {
+		memcpy(buf, q->data, len);
+		spin_unlock(&vf->query_lock);
+		mutex_unlock(&q->lock);
+		atomic64_inc(&g_query.shared);
+		return 0;
+	}
+	gen = q->gen;
+	spin_unlock(&vf->query_lock);
+
+	res = kzalloc_node(qo->size, GFP_KERNEL, vf->pf->node);
+	if (!res) {
+		mutex_unlock(&q->lock);
+		return -ENOMEM;
+	}
+	ret = qo->exec(vf->pdev, res, qo->size);
+	atomic64_inc(&g_query.cmds);
+
+	spin_lock(&vf->query_lock);
+	q->seq++;
+	/* invalidated while in flight, the result may predate the change */
+	q->valid = !ret && q->gen == gen;
+	if (q->valid) {
+		memcpy(q->data, res, qo->size);
+		q->expires = jiffies +
+			     msecs_to_jiffies(admin_unit_vf_opt(vf, query_cache_ms));
+	}
+	spin_unlock(&vf->query_lock);
+	mutex_unlock(&q->lock);
+
+	if (!ret)
+		memcpy(buf, res, len);
+	kfree(res);
+	return ret;
+}
+
+static int admin_unit_cmd_list_query_proc(struct admin_vf *vf)
+{
+	int i, size = admin_unit_query_ops[ADMIN_UNIT_Q_LIST].size;
+	u8 buf[ADMIN_UNIT_QUERY_SZ];
+	int ret = 0;
+
+	if (!vf)
+		return -ENODEV;
+
+	pr_err("%s:%d: exec list_query \n",__func__, __LINE__);
+	ret = admin_unit_query(vf, ADMIN_UNIT_Q_LIST, buf, size);
+	if (ret) {
+		pr_err("Failed to run virtiovf_cmd_list_query ret(%d)\n",
+			ret);
+		return ret;
+	}
+
+	pr_err("Dump out oplist \n");
+	for (i = 0; i < size; i++) {
+		pr_err("op_list[%d] = %#x\n",
+			i, buf[i]);
+	}
+	return ret;
+}
+
+static int admin_unit_cmd_dev_mode_get_proc(struct admin_vf *vf)
+{
+	struct virtio_admin_cmd_dev_mode dev_mode;
+	int ret = 0;
+
+	if (!vf)
+		return -ENODEV;
+
+	pr_err("%s:%d: exec dev_mode_get \n",__func__, __LINE__);
+
+	ret = admin_unit_query(vf, ADMIN_UNIT_Q_MODE, (u8 *)&dev_mode,
+			       sizeof(dev_mode));
+	if (ret) {
+		pr_err("Failed to run virtiovf_cmd_list_query ret(%d)\n",
+			ret);
+		return ret;
+	}
+
+	pr_err("Dump out dev_mode \n");
+	pr_err("dev_mode = %#x\n", dev_mode.mode);
+	return ret;
+}
+
+static int
+admin_unit_cmd_sprt_field_query_proc(struct admin_vf *vf)
+{
+	struct virtio_admin_cmd_dev_ctx_supported_field fld[MAX_SUPPORT_FIELD];
+	int ret = 0, i;
+
+	if (!vf)
+		return -ENODEV;
+
+	pr_err("%s:%d: exec supported field query on vf %s\n",
+						__func__, __LINE__, vf->name);
+
+	ret = admin_unit_query(vf, ADMIN_UNIT_Q_FIELDS, (u8 *)fld, sizeof(fld));
+	if (ret) {
+		pr_err("Failed to run admin_unit_cmd_sprt_field_query ret(%d)\n",
+			ret);
+		return ret;
+	}
+
+	for (i = 0; i < MAX_SUPPORT_FIELD; i++) {
+		pr_err("supported_field[%d] type(%#x), length(%d)",
+			i, fld[i].type, fld[i].length);
+	}
+
+	print_hex_dump(KERN_ERR, "", DUMP_PREFIX_NONE, 16, 4, fld,
+		       sizeof(fld), true);
+	return ret;
+}
+
+static int
+admin_unit_cmd_discard(struct pci_dev *pdev)
+{
+	struct virtio_device *virtio_dev = virtio_pci_vf_get_pf_dev(pdev);
+	struct virtio_admin_cmd cmd = {};
+	int ret;
+
+	if (!virtio_dev)
+		return -ENOTCONN;
+
+	if (!pdev->is_virtfn)
+		pr_err("pdev should be a Virtual Function.\n");
+
+	dev_info(&pdev->dev, "Vf pdev(%s) domain %d bus %#x devfn %#x",
+		pci_name(pdev),
+		pci_domain_nr(pdev->bus),
+		pdev->bus->number, pdev->devfn);
+
+	dev_info(&virtio_dev->dev, "Use PF(%s) send cmd for VF id (%d)\n",
+		dev_name(&virtio_dev->dev),
+		pci_iov_vf_id(pdev));
+
+	cmd.opcode = VIRTIO_ADMIN_CMD_DEV_CTX_DISCARD;
+	cmd.group_type = VIRTIO_ADMIN_GROUP_TYPE_SRIOV;
+	cmd.group_member_id = pci_iov_vf_id(pdev) + 1;
+
+	ret = admin_unit_exec(pdev, virtio_dev, &cmd, ADMIN_UNIT_PRIO_NORMAL);
+	return ret;
+}
+
+static int
+admin_unit_cmd_discard_proc(struct admin_vf *vf)
+{
+	int ret = 0;
+
+	if (!vf)
+		return -ENODEV;
+
+	pr_err("%s:%d: exec supported field query on vf %s\n",
+						__func__, __LINE__, vf->name);
+
+	ret = admin_unit_cmd_discard(vf->pdev);
+	if (ret)
+		pr_err("Failed to run admin_unit_cmd_sprt_field_query ret(%d)\n",
+			ret);
+
+	// if (vf_idx == 0) {
+	// 	if (g_dev_mgr.vf0_ctx)
+	// 		kfree(g_dev_mgr.vf0_ctx);
+
+	// 	g_dev_mgr.vf0_ctx = NULL;
+	// 	g_dev_mgr.vf0_ctx_pos = NULL;
+	// 	g_dev_mgr.vf0_ctx_sz = 0;
+	// } else {
+	// 	if (g_dev_mgr.vf1_ctx)
+	// 		kfree(g_dev_mgr.vf1_ctx);
+
+	// 	g_dev_mgr.vf1_ctx = NULL;
+	// 	g_dev_mgr.vf1_ctx_pos = NULL;
+	// 	g_dev_mgr.vf1_ctx_sz = 0;
+	// }
+
+	return ret;
+}
+
+/*
+ * Sweep the chunk size against one VF and keep the fastest for its PF.
+ * Only reads the ctx, the VF should be stopped.  The result applies to
+ * the partial reads and writes of every VF of the PF.
+ */
+static int admin_unit_chunk_tune(struct admin_vf *vf)
+{
+	struct admin_unit_io io = { .vf = vf };
+	struct admin_unit_chunk_res *r;
+	struct admin_pf *pf;
+	int i, best, ret = 0;
+
+	if (!vf)
+		return -ENODEV;
+	pf = vf->pf;
+
+	io.buf = admin_unit_zalloc(pf, ADMIN_UNIT_CHUNK_MAX);
+	if (!io.buf)
+		return -ENOMEM;
+
+	mutex_lock(&admin_unit_tune_lock);
+	mutex_lock(&vf->lock);
+	best = admin_unit_core_chunk_sweep(&admin_unit_io_ops, &io,
+					   pf->chunk_res, &pf->nr_chunk_res);
+	mutex_unlock(&vf->lock);
+
+	for (i = 0; i < pf->nr_chunk_res; i++) {
+		r = &pf->chunk_res[i];
+		pr_debug("chunk_tune vf %s size %d cmds %u %llu MB/s %llu ns/cmd\n",
+			vf->name, r->size, r->cmds,
+			div64_u64(r->bytes * 1000, r->ns),
+			div64_u64(r->ns, r->cmds));
+	}
+
+	if (best >= 0) {
+		WRITE_ONCE(pf->chunk_sz, pf->chunk_res[best].size);
+		pr_debug("pf %d chunk size tuned to %d\n", pf->idx,
+			pf->chunk_res[best].size);
+	} else {
+		ret = best;
+	}
+	mutex_unlock(&admin_unit_tune_lock);
+
+	kfree(io.buf);
+	return ret;
+}
+
+/*
+ * Field-aware ctx diff.  Two ctx with the same TLV layout are compared
+ * field by field, each field together with its header, one word at a
+ * time; from the first field whose type or length differs on, the rest
+ * is compared as a single raw region.
+ */
+#define ADMIN_UNIT_DIFF_MAX	32
+#define ADMIN_UNIT_DIFF_RAW	U32_MAX
+
+struct admin_unit_diff_field {
+	u32 idx;
+	/* ADMIN_UNIT_DIFF_RAW past a layout mismatch */
+	u32 type;
+	u64 off;
+	u64 len;
+	u64 bytes;
+	u64 first;
+};
+
+struct admin_unit_diff {
+	char a[32];
+	char b[32];
+	u64 a_size;
+	u64 b_size;
+	/* fields compared by layout, and how many of them differ */
+	u32 nr_fields;
+	u32 nr_differ;
+	u64 bytes;
+	s64 ns;
+	int nr;
+	struct admin_unit_diff_field f[ADMIN_UNIT_DIFF_MAX];
+};
+
+/* differing bytes of [off, off + len) of a and b, *first the first of them */
+static u64 admin_unit_ctx_diff_range(struct admin_unit_ctx *a,
+				     struct admin_unit_ctx *b,
+				     u64 off, u64 len, u64 *first)
+{
+	u64 bytes = 0, end = off + len;
+	u32 po, l;
+	size_t f;
+
+	*first = end;
+	while (off < end) {
+		po = offset_in_page(off);
+		l = min_t(u64, end - off, PAGE_SIZE - po);
+		bytes += admin_unit_core_diff(
+				page_address(a->pages[off >> PAGE_SHIFT]) + po,
+				page_address(b->pages[off >> PAGE_SHIFT]) + po,
+				l, &f);
+		if (f < l && *first == end)
+			*first = off + f;
+		off += l;
+		cond_resched();
+	}
+	return bytes;
+}
+
+static void admin_unit_diff_add(struct admin_unit_diff *d, u32 idx, u32 type,
+				u64 off, u64 len, u64 bytes, u64 first)
+{
+	struct admin_unit_diff_field *df;
+
+	if (!bytes)
+		return;
+	d->nr_differ++;
+	d->bytes += bytes;
+	if (d->nr == ADMIN_UNIT_DIFF_MAX)
+		return;
+	df = &d->f[d->nr++];
+	df->idx = idx;
+	df->type = type;
+	df->off = off;
+	df->len = len;
+	df->bytes = bytes;
+	df->first = first;
+}
+
+static void admin_unit_ctx_diff(struct admin_unit_ctx *a,
+				struct admin_unit_ctx *b,
+				struct admin_unit_diff *d)
+{
+	u8 ha[ADMIN_UNIT_CTX_HDR_SZ], hb[ADMIN_UNIT_CTX_HDR_SZ];
+	u64 size = min(a->size, b->size), pos = 0, bytes, first;
+	struct admin_unit_tlv fa, fb;
+	ktime_t start = ktime_get();
+	u32 i = 0, count = 0;
+
+	d->a_size = a->size;
+	d->b_size = b->size;
+	d->nr_differ = 0;
+	d->bytes = 0;
+	d->nr = 0;
+
+	if (size >= sizeof(ha)) {
+		admin_unit_ctx_copy(a, 0, ha, sizeof(ha));
+		admin_unit_ctx_copy(b, 0, hb, sizeof(hb));
+		if (!memcmp(ha, hb, sizeof(ha))) {
+			count = admin_unit_core_le32(ha);
+			pos = sizeof(ha);
+		}
+	}
+
+	for (; i < count; i++) {
+		if (admin_unit_ctx_field(a, pos, &fa) ||
+		    admin_unit_ctx_field(b, pos, &fb) ||
+		    fa.type != fb.type || fa.len != fb.len)
+			break;
+		bytes = admin_unit_ctx_diff_range(a, b, pos,
+						  fa.off + fa.len - pos, &first);
+		admin_unit_diff_add(d, i, fa.type, pos, fa.off + fa.len - pos,
+				    bytes, first);
+		pos = fa.off + fa.len;
+	}
+	d->nr_fields = i;
+
+	/* the rest, or all of it when the two are not laid out alike */
+	if (pos < size) {
+		bytes = admin_unit_ctx_diff_range(a, b, pos, size - pos, &first);
+		admin_unit_diff_add(d, i, ADMIN_UNIT_DIFF_RAW, pos, size - pos,
+				    bytes, first);
+	}
+	/* what only the larger one has */
+	admin_unit_diff_add(d, i, ADMIN_UNIT_DIFF_RAW, size,
+			    max(a->size, b->size) - size,
+			    max(a->size, b->size) - size, size);
+
+	d->ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+/*
+ * Read the ctx of vf from the device into a new ctx, leaving vf->ctx
+ * alone.  This restarts the device side read stream of the VF.
+ */
+static int admin_unit_ctx_read_fresh(struct admin_vf *vf,
+				     struct admin_unit_ctx **out)
+{
+	struct admin_unit_io io = { .vf = vf };
+	struct admin_unit_ctx *ctx;
+	u64 size, done;
+	int ret;
+
+	mutex_lock(&vf->lock);
+	ret = admin_unit_io_sz_get(&io, &size);
+	if (!ret && !size)
+		ret = -ENODATA;
+	if (ret)
+		goto out;
+
+	ret = admin_unit_mem_charge(vf, size);
+	if (ret)
+		goto out;
+	ctx = admin_unit_ctx_alloc(vf->pf, size, false);
+	if (!ctx) {
+		admin_unit_mem_uncharge(vf, size);
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	ret = admin_unit_ctx_xfer(vf, ctx, 0, size, false, &done);
+	if (ret) {
+		admin_unit_mem_uncharge(vf, size);
+		admin_unit_ctx_free(ctx);
+		goto out;
+	}
+	if (done < size)
+		admin_unit_ctx_zero_from(ctx, done);
+	*out = ctx;
+out:
+	mutex_unlock(&vf->lock);
+	return ret;
+}
+
+static void admin_unit_ctx_free_fresh(struct admin_vf *vf,
+				      struct admin_unit_ctx *ctx)
+{
+	admin_unit_mem_uncharge(vf, admin_unit_ctx_charge(ctx));
+	admin_unit_ctx_free(ctx);
+}
+
+/*
+ * With mig_verify, read back the ctx just restored into the frozen dst
+ * and diff it against the snapshot kept on src, or with stream against
+ * a read back of src.
+ */
+static int admin_unit_mig_verify(struct admin_vf *src, struct admin_vf *dst,
+				 bool stream, struct admin_unit_pair_res *res)
+{
+	struct admin_unit_ctx *fresh, *ref = NULL;
+	struct admin_unit_diff *d;
+	ktime_t start = ktime_get();
+	int ret;
+
+	d = kzalloc(sizeof(*d), GFP_KERNEL);
+	if (!d)
+		return -ENOMEM;
+
+	ret = admin_unit_ctx_read_fresh(dst, &fresh);
+	if (ret)
+		goto out;
+	/* a streamed ctx left no snapshot, read the frozen src again */
+	if (stream) {
+		ret = admin_unit_ctx_read_fresh(src, &ref);
+		if (ret) {
+			admin_unit_ctx_free_fresh(dst, fresh);
+			goto out;
+		}
+	}
+
+	mutex_lock(&src->lock);
+	if (ref)
+		admin_unit_ctx_diff(ref, fresh, d);
+	else if (src->restored)
+		admin_unit_ctx_diff(src->restored, fresh, d);
+	else
+		/* the snapshot was reclaimed meanwhile */
+		ret = -ENODATA;
+	mutex_unlock(&src->lock);
+	admin_unit_ctx_free_fresh(dst, fresh);
+	if (ref)
+		admin_unit_ctx_free_fresh(src, ref);
+
+	res->diff_bytes = d->bytes;
+	if (!ret && d->bytes) {
+		pr_err("vf %s -> vf %s: %llu bytes in %u fields differ after restore\n",
+			src->name, dst->name, d->bytes, d->nr_differ);
+		ret = -EIO;
+	}
+out:
+	res->verify_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	kfree(d);
+	return ret;
+}
+
+/*
+ * Full migration of one src -> dst pair: the destination is parked in
+ * FREEZE first, then the source is stopped, frozen, saved and its ctx
+ * restored into the destination, which is finally made ACTIVE.  With
+ * mig_stream the save and restore overlap through the stream ring.
+ */
+static int admin_unit_mig_pair(struct admin_vf *src, struct admin_vf *dst,
+			       struct admin_unit_pair_res *res)
+{
+	bool stream = admin_unit_vf_opt(src, mig_stream);
+	ktime_t down;
+	int ret;
+
+	res->src_vf = src->id;
+	res->dst_vf = dst->id;
+
+	ret = admin_unit_cmd_dev_mode_set_proc(dst, VIRTIO_ADMIN_DEV_MODE_STOP);
+	if (ret)
+		goto out;
+	ret = admin_unit_cmd_dev_mode_set_proc(dst, VIRTIO_ADMIN_DEV_MODE_FREEZE);
+	if (ret)
+		goto out;
+
+	down = ktime_get();
+	ret = admin_unit_cmd_dev_mode_set_proc(src, VIRTIO_ADMIN_DEV_MODE_STOP);
+	if (ret)
+		goto resume;
+	ret = admin_unit_cmd_dev_mode_set_proc(src, VIRTIO_ADMIN_DEV_MODE_FREEZE);
+	if (ret)
+		goto resume;
+	if (stream) {
+		ret = admin_unit_stream_copy(src, dst, &res->bytes);
+		if (ret)
+			goto resume;
+	} else {
+		ret = admin_unit_cmd_dev_ctx_sz_get_proc(src, 1);
+		if (ret)
+			goto resume;
+		ret = admin_unit_cmd_dev_ctx_rd_proc(src);
+		if (ret)
+			goto resume;
+		res->bytes = src->cur.size;
+		/* on failure the save stays on src */
+		ret = admin_unit_cmd_dev_ctx_wr_proc(dst, src);
+		if (ret)
+			goto resume;
+	}
+	if (admin_unit_vf_opt(src, mig_verify)) {
+		ret = admin_unit_mig_verify(src, dst, stream, res);
+		if (ret)
+			goto resume;
+	}
+	ret = admin_unit_cmd_dev_mode_set_proc(dst, VIRTIO_ADMIN_DEV_MODE_ACTIVE);
+	res->downtime_ns = ktime_to_ns(ktime_sub(ktime_get(), down));
+	goto out;
+
+resume:
+	/* the migration failed, the guest keeps running on src */
+	if (admin_unit_cmd_dev_mode_set_proc(src, VIRTIO_ADMIN_DEV_MODE_ACTIVE))
+		pr_err("vf %s: failed to resume after a failed migration\n",
+		       src->name);
+out:
+	res->ret = ret;
+	return ret;
+}
+
+struct admin_unit_pair_job {
+	struct admin_vf *src;
+	struct admin_vf *dst;
+	struct admin_unit_pair_res res;
+	struct completion done;
+};
+
+static int admin_unit_pair_thread(void *data)
+{
+	struct admin_unit_pair_job *job = data;
+
+	admin_unit_mig_pair(job->src, job->dst, &job->res);
+	complete(&job->done);
+	return 0;
+}
+
+/*
+ * Run independent src -> dst migrations concurrently, one kthread per
+ * pair.  A VF may appear in at most one pair.
+ */
+static int admin_unit_mig_pairs(struct admin_vf **src, struct admin_vf **dst,
+				int nr_pairs)
+{
+	struct admin_unit_pair_job *jobs;
+	struct admin_unit_mig_run *run;
+	struct task_struct *task;
+	ktime_t start;
+	int i, node, ret = 0;
+
+	jobs = kcalloc(nr_pairs, sizeof(*jobs), GFP_KERNEL);
+	run = kzalloc(sizeof(*run), GFP_KERNEL);
+	if (!jobs || !run) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	start = ktime_get();
+	for (i = 0; i < nr_pairs; i++) {
+		jobs[i].src = src[i];
+		jobs[i].dst = dst[i];
+		init_completion(&jobs[i].done);
+		/* run the pair next to the source PF, which moves the ctx */
+		node = src[i]->pf->node;
+		task = kthread_create_on_node(admin_unit_pair_thread, &jobs[i],
+					      node, "admin_mig%d", i);
+		if (!IS_ERR(task)) {
+			if (node != NUMA_NO_NODE)
+				set_cpus_allowed_ptr(task, cpumask_of_node(node));
+			wake_up_process(task);
+		} else {
+			jobs[i].res.src_vf = src[i]->id;
+			jobs[i].res.dst_vf = dst[i]->id;
+			jobs[i].res.ret = PTR_ERR(task);
+			complete(&jobs[i].done);
+		}
+	}
+
+	for (i = 0; i < nr_pairs; i++) {
+		wait_for_completion(&jobs[i].done);
+		run->pair[i] = jobs[i].res;
+		if (!jobs[i].res.ret)
+			run->bytes += jobs[i].res.bytes;
+		else if (!ret)
+			ret = jobs[i].res.ret;
+	}
+	run->wall_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	run->nr_pairs = nr_pairs;
+
+	pr_debug("mig_pairs: %d pairs %llu bytes in %lld ns\n",
+		nr_pairs, run->bytes, run->wall_ns);
+	for (i = 0; i < nr_pairs; i++)
+		pr_debug("  vf %s -> vf %s ret %d downtime %lld ns\n",
+			src[i]->name, dst[i]->name,
+			run->pair[i].ret, run->pair[i].downtime_ns);
+
+	spin_lock(&admin_unit_tl_lock);
+	g_mig_mgr.last_run = *run;
+	spin_unlock(&admin_unit_tl_lock);
+out:
+	kfree(run);
+	kfree(jobs);
+	return ret;
+}
+
+/* "mig_pairs <src>,<dst> [<src>,<dst> ...]", VFs given as <pf>:<vf> */
+static int admin_unit_mig_pairs_parse(const char *args)
+{
+	struct admin_vf **src, **dst;
+	char *dup, *p, *tok, *comma;
+	int i, n = 0, ret = 0;
+
+	dup = kstrdup(args, GFP_KERNEL);
+	src = kcalloc(ADMIN_UNIT_MAX_PAIRS, sizeof(*src), GFP_KERNEL);
+	dst = kcalloc(ADMIN_UNIT_MAX_PAIRS, sizeof(*dst), GFP_KERNEL);
+	if (!dup || !src || !dst) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	p = dup;
+	while ((tok = strsep(&p, " \t\n"))) {
+		if (!*tok)
+			continue;
+		comma = strchr(tok, ',');
+		if (n == ADMIN_UNIT_MAX_PAIRS || !comma) {
+			ret = -EINVAL;
+			goto out;
+		}
+		*comma = '\0';
+		src[n] = admin_unit_vf_parse(tok);
+		dst[n] = admin_unit_vf_parse(comma + 1);
+		if (!src[n] || !dst[n] || src[n] == dst[n]) {
+			pr_err("Invalid mig pair %s,%s\n", tok, comma + 1);
+			ret = -EINVAL;
+			goto out;
+		}
+		/* each VF may take part in one pair only */
+		for (i = 0; i < n; i++) {
+			if (src[i] == src[n] || src[i] == dst[n] ||
+			    dst[i] == src[n] || dst[i] == dst[n]) {
+				pr_err("vf used twice in %s,%s\n", tok, comma + 1);
+				ret = -EINVAL;
+				goto out;
+			}
+		}
+		n++;
+	}
+
+	if (!n) {
+		ret = -EINVAL;
+		goto out;
+	}
+	ret = admin_unit_mig_pairs(src, dst, n);
+out:
+	kfree(dst);
+	kfree(src);
+	kfree(dup);
+	return ret;
+}
+
+#define ADMIN_CMD_LIST_USE			"list_use"
+#define ADMIN_CMD_LIST_QUERY			"list_query"
+
+#define ADMIN_CMD_DEV_MODE_GET_VF0		"dev_mode_get_vf0"
+#define ADMIN_CMD_DEV_MODE_GET_VF1		"dev_mode_get_vf1"
+
+#define ADMIN_CMD_DEV_MODE_SET_VF0_ACTIVE	"dev_mode_set_vf0_active"
+#define ADMIN_CMD_DEV_MODE_SET_VF0_STOP		"dev_mode_set_vf0_stop"
+#define ADMIN_CMD_DEV_MODE_SET_VF0_FREEZE	"dev_mode_set_vf0_freeze"
+#define ADMIN_CMD_DEV_MODE_SET_VF1_ACTIVE	"dev_mode_set_vf1_active"
+#define ADMIN_CMD_DEV_MODE_SET_VF1_STOP		"dev_mode_set_vf1_stop"
+#define ADMIN_CMD_DEV_MODE_SET_VF1_FREEZE	"dev_mode_set_vf1_freeze"
+
+#define ADMIN_CMD_DEV_CTX_SZ_GET_VF0_NOFREEZE	"dev_ctx_get_vf0_nofreeze"
+#define ADMIN_CMD_DEV_CTX_SZ_GET_VF0_FREEZE	"dev_ctx_get_vf0_freeze"
+#define ADMIN_CMD_DEV_CTX_SZ_GET_VF1_NOFREEZE	"dev_ctx_get_vf1_nofreeze"
+#define ADMIN_CMD_DEV_CTX_SZ_GET_VF1_FREEZE	"dev_ctx_get_vf1_freeze"
+
+#define ADMIN_CMD_DEV_CTX_RD_VF0		"dev_ctx_rd_vf0"
+#define ADMIN_CMD_DEV_CTX_RD_VF1		"dev_ctx_rd_vf1"
+#define ADMIN_CMD_DEV_CTX_RD_200B_VF0		"dev_ctx_rd_200B_vf0"
+#define ADMIN_CMD_DEV_CTX_RD_200B_VF1		"dev_ctx_rd_200B_vf1"
+#define ADMIN_CMD_DEV_CTX_RD_LEFT_VF0		"dev_ctx_rd_left_vf0"
+#define ADMIN_CMD_DEV_CTX_RD_LEFT_VF1		"dev_ctx_rd_left_vf1"
+
+#define ADMIN_CMD_DEV_CTX_WR_VF0		"dev_ctx_wr_vf0"
+#define ADMIN_CMD_DEV_CTX_WR_VF1		"dev_ctx_wr_vf1"
+#define ADMIN_CMD_DEV_CTX_WR_200B_VF0		"dev_ctx_wr_200B_vf0"
+#define ADMIN_CMD_DEV_CTX_WR_200B_VF1		"dev_ctx_wr_200B_vf1"
+#define ADMIN_CMD_DEV_CTX_WR_LEFT_VF0		"dev_ctx_wr_left_vf0"
+#define ADMIN_CMD_DEV_CTX_WR_LEFT_VF1		"dev_ctx_wr_left_vf1"
+
+#define ADMIN_CMD_DISCARD_VF0			"dev_discard_vf0"
+#define ADMIN_CMD_DISCARD_VF1			"dev_discard_vf1"
+
+#define ADMIN_CMD_FIELDS_QUERY_VF0		"dev_field_query_vf0"
+#define ADMIN_CMD_FIELDS_QUERY_VF1		"dev_field_query_vf1"
+
+#define ADMIN_CMD_MIG_TIMELINE_RESET		"mig_timeline_reset"
+
+/* "<cmd> <src vf> <dst vf>" */
+#define ADMIN_CMD_DEV_CTX_WR_PAIR_200B		"dev_ctx_wr_pair_200B"
+#define ADMIN_CMD_DEV_CTX_WR_PAIR_LEFT		"dev_ctx_wr_pair_left"
+#define ADMIN_CMD_DEV_CTX_WR_PAIR		"dev_ctx_wr_pair"
+#define ADMIN_CMD_MIG_PAIRS			"mig_pairs"
+
+/* "chunk_tune <vf>", calibrate the ctx chunk size of the VF's PF */
+#define ADMIN_CMD_CHUNK_TUNE			"chunk_tune"
+
+/* "selftest <src> <dst> [record]", needs loading with fake_transport=1 */
+#define ADMIN_CMD_SELFTEST			"selftest"
+
+/* "soak <threads> <seconds> <vf>[,<vf>...] [<op>=<weight> ...] [destructive]" */
+#define ADMIN_CMD_SOAK				"soak"
+
+/* "trace_start [<records>]", "trace_stop", for /proc/admin_unit/trace */
+#define ADMIN_CMD_TRACE_START			"trace_start"
+#define ADMIN_CMD_TRACE_STOP			"trace_stop"
+
+/* "trace_replay [fast] [<pf>:<vf>=<pf>:<vf> ...]", for /proc/admin_unit/replay */
+#define ADMIN_CMD_TRACE_REPLAY			"trace_replay"
+
+/* "ctx_view <vf> [restored] <off> <len> | fields", for /proc/admin_unit/ctx */
+#define ADMIN_CMD_CTX_VIEW			"ctx_view"
+
+/* "ctx_diff <a> [restored] <b> [restored|device]", for /proc/admin_unit/diff */
+#define ADMIN_CMD_CTX_DIFF			"ctx_diff"
+
+/* "stream_copy <src> <dst>": copy a frozen src ctx into dst without saving it */
+#define ADMIN_CMD_STREAM_COPY			"stream_copy"
+
+/* "fanout <src> <dst>[,<dst>...] [restored]", for /proc/admin_unit/fanout */
+#define ADMIN_CMD_FANOUT			"fanout"
+
+/* "vf <pf>:<vf> <op> [arg]", usable on any discovered PF */
+#define ADMIN_CMD_VF				"vf "
+
+/* the vf0/vf1 commands address the first two VFs of PF 0 */
+#define ADMIN_UNIT_LEGACY_VF0			ADMIN_VF_ID(0, 0)
+#define ADMIN_UNIT_LEGACY_VF1			ADMIN_VF_ID(0, 1)
+
+/* "<src> <dst>" */
+static int admin_unit_vf_pair_parse(const char *args, struct admin_vf **src,
+				    struct admin_vf **dst)
+{
+	char s[16], d[16];
+
+	if (sscanf(args, "%15s %15s", s, d) != 2)
+		return -EINVAL;
+	*src = admin_unit_vf_parse(s);
+	*dst = admin_unit_vf_parse(d);
+	if (!*src || !*dst)
+		return -ENODEV;
+	return 0;
+}
+
+static int admin_unit_vf_cmd_process(const char *args)
+{
+	char id[16], op[32], arg[16] = "";
+	struct admin_vf *vf;
+	int weight;
+
+	if (sscanf(args, "%15s %31s %15s", id, op, arg) < 2)
+		return -EINVAL;
+	vf = admin_unit_vf_parse(id);
+	if (!vf) {
+		pr_err("Unknown vf %s\n", id);
+		return -ENODEV;
+	}
+
+	if (!strcmp(op, "list_query"))
+		return admin_unit_cmd_list_query_proc(vf);
+	if (!strcmp(op, "mode_get"))
+		return admin_unit_cmd_dev_mode_get_proc(vf);
+	if (!strcmp(op, "mode_set")) {
+		if (!strcmp(arg, "active"))
+			return admin_unit_cmd_dev_mode_set_proc(vf, VIRTIO_ADMIN_DEV_MODE_ACTIVE);
+		if (!strcmp(arg, "stop"))
+			return admin_unit_cmd_dev_mode_set_proc(vf, VIRTIO_ADMIN_DEV_MODE_STOP);
+		if (!strcmp(arg, "freeze"))
+			return admin_unit_cmd_dev_mode_set_proc(vf, VIRTIO_ADMIN_DEV_MODE_FREEZE);
+		return -EINVAL;
+	}
+	if (!strcmp(op, "ctx_get"))
+		return admin_unit_cmd_dev_ctx_sz_get_proc(vf, !strcmp(arg, "freeze"));
+	if (!strcmp(op, "ctx_rd"))
+		return admin_unit_cmd_dev_ctx_rd_proc(vf);
+	if (!strcmp(op, "ctx_rd_200B"))
+		return admin_unit_cmd_dev_ctx_rd_partial_proc(vf, ADMIN_UNIT_CHUNK_AUTO, false);
+	if (!strcmp(op, "ctx_rd_left"))
+		return admin_unit_cmd_dev_ctx_rd_partial_proc(vf, ADMIN_UNIT_CHUNK_AUTO, true);
+	if (!strcmp(op, "field_query"))
+		return admin_unit_cmd_sprt_field_query_proc(vf);
+	if (!strcmp(op, "discard"))
+		return admin_unit_cmd_discard_proc(vf);
+	if (!strcmp(op, "weight")) {
+		if (kstrtoint(arg, 0, &weight))
+			return -EINVAL;
+		return admin_unit_vf_weight_set(vf, weight);
+	}
+
+	pr_err("Unknow vf op %s \n", op);
+	return -EINVAL;
+}
+
+/*
+ * "ctx_diff <a> [restored] <b> [restored|device]" diffs the saved (or
+ * restored) ctx of VF a against that of VF b, or against a fresh read
+ * of b's device.  The last result is in /proc/admin_unit/diff.
+ */
+static struct admin_unit_diff g_diff;
+static DEFINE_MUTEX(admin_unit_diff_lock);
+
+static int admin_unit_diff_cmd(const char *args)
+{
+	struct admin_unit_ctx *ca, *cb, *fresh = NULL;
+	struct admin_vf *va, *vb, *first, *second;
+	bool ra = false, rb = false, dev = false;
+	char t[4][24] = {};
+	int i = 0, ret = 0;
+
+	if (sscanf(args, "%23s %23s %23s %23s", t[0], t[1], t[2], t[3]) < 2)
+		return -EINVAL;
+	va = admin_unit_vf_parse(t[i++]);
+	if (!strcmp(t[i], "restored")) {
+		ra = true;
+		i++;
+	}
+	vb = admin_unit_vf_parse(t[i++]);
+	if (!strcmp(t[i], "restored"))
+		rb = true;
+	else if (!strcmp(t[i], "device"))
+		dev = true;
+	if (!va || !vb)
+		return -ENODEV;
+	if (va == vb && ra == rb && !dev)
+		return -EINVAL;
+
+	if (dev) {
+		ret = admin_unit_ctx_read_fresh(vb, &fresh);
+		if (ret)
+			return ret;
+	}
+
+	/* lock two VFs in id order */
+	first = va;
+	second = vb != va ? vb : NULL;
+	if (second && second->id < first->id)
+		swap(first, second);
+	mutex_lock(&first->lock);
+	if (second)
+		mutex_lock_nested(&second->lock, SINGLE_DEPTH_NESTING);
+
+	ca = ra ? va->restored : va->ctx;
+	cb = fresh ? fresh : rb ? vb->restored : vb->ctx;
+	if (!ca || !cb) {
+		pr_err("Should read vf %s and vf %s dev ctx first",
+			va->name, vb->name);
+		ret = -EINVAL;
+	} else {
+		mutex_lock(&admin_unit_diff_lock);
+		snprintf(g_diff.a, sizeof(g_diff.a), "%s %s", va->name,
+			 ra ? "restored" : "saved");
+		snprintf(g_diff.b, sizeof(g_diff.b), "%s %s", vb->name,
+			 dev ? "device" : rb ? "restored" : "saved");
+		admin_unit_ctx_diff(ca, cb, &g_diff);
+		pr_err("ctx_diff vf %s vs vf %s: %llu bytes in %u fields differ\n",
+			g_diff.a, g_diff.b, g_diff.bytes, g_diff.nr_differ);
+		mutex_unlock(&admin_unit_diff_lock);
+	}
+
+	if (second)
+		mutex_unlock(&second->lock);
+	mutex_unlock(&first->lock);
+	if (fresh)
+		admin_unit_ctx_free_fresh(vb, fresh);
+	return ret;
+}
+
+static int admin_unit_diff_proc_show(struct seq_file *m, void *v)
+{
+	struct admin_unit_diff_field *df;
+	int i;
+
+	mutex_lock(&admin_unit_diff_lock);
+	if (!g_diff.a[0])
+		goto out;
+	seq_printf(m, "vf %s size %llu vs vf %s size %llu: %s\n",
+		   g_diff.a, g_diff.a_size, g_diff.b, g_diff.b_size,
+		   g_diff.bytes ? "differ" : "equal");
+	seq_printf(m, "  fields %u differ %u bytes %llu ns %lld\n",
+		   g_diff.nr_fields, g_diff.nr_differ, g_diff.bytes, g_diff.ns);
+	for (i = 0; i < g_diff.nr; i++) {
+		df = &g_diff.f[i];
+		if (df->type == ADMIN_UNIT_DIFF_RAW)
+			seq_printf(m, "  raw      off %#llx len %llu", df->off,
+				   df->len);
+		else
+			seq_printf(m, "  field %u type %#x off %#llx len %llu",
+				   df->idx, df->type, df->off, df->len);
+		seq_printf(m, " diff %llu first %#llx\n", df->bytes, df->first);
+	}
+	if (g_diff.nr < g_diff.nr_differ)
+		seq_printf(m, "  %u more not shown\n",
+			   g_diff.nr_differ - g_diff.nr);
+out:
+	mutex_unlock(&admin_unit_diff_lock);
+	return 0;
+}
+
+static int admin_unit_diff_proc_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, admin_unit_diff_proc_show, NULL);
+}
+
+static const struct proc_ops admin_unit_diff_proc_fops = {
+	.proc_open	= admin_unit_diff_proc_open,
+	.proc_read	= seq_read,
+	.proc_lseek	= seq_lseek,
+	.proc_release	= single_release,
+};
+
+/*
+ * Fan-out: "fanout <src> <dst>[,<dst>...] [restored]" restores one ctx
+ * of src into every dst at once, to warm a pool of identical VFs from a
+ * golden device.  The ctx is taken as dev_ctx_wr_pair takes it, saving
+ * src first if it has no save, and every dst writes it from the same
+ * read-only pages in its own work item on admin_unit_wq.  A save that
+ * partial reads or writes are part way through is refused with -EBUSY.
+ * Afterwards the ctx is the restored snapshot of src; "restored" fans
+ * that snapshot out again without a read.  The dsts must be in FREEZE
+ * mode.  Per-dst completion times are in /proc/admin_unit/fanout.
+ */
+#define ADMIN_UNIT_FANOUT_MAX	64
+
+struct admin_unit_fanout_dst {
+	char name[16];
+	int ret;
+	u64 bytes;
+	/* from the start of the writes until this dst is done */
+	s64 ns;
+};
+
+struct admin_unit_fanout_ent {
+	struct work_struct work;
+	struct admin_unit_fanout *fo;
+	struct admin_vf *vf;
+	struct admin_unit_fanout_dst res;
+};
+
+struct admin_unit_fanout {
+	struct admin_vf *src;
+	/* fan out the restored snapshot of src instead of a save */
+	bool restored;
+	struct admin_unit_ctx *ctx;
+	ktime_t start;
+	atomic_t pending;
+	struct completion done;
+	int nr;
+	struct admin_unit_fanout_ent ent[ADMIN_UNIT_FANOUT_MAX];
+};
+
+struct admin_unit_fanout_res {
+	char src[16];
+	u64 size;
+	/* 0 when a saved ctx was fanned out */
+	s64 rd_ns;
+	s64 wall_ns;
+	int nr;
+	int errs;
+	struct admin_unit_fanout_dst dst[ADMIN_UNIT_FANOUT_MAX];
+};
+
+static struct admin_unit_fanout_res g_fanout;
+static DEFINE_MUTEX(admin_unit_fanout_lock);
+
+static void admin_unit_fanout_work(struct work_struct *work)
+{
+	struct admin_unit_fanout_ent *ent =
+		container_of(work, struct admin_unit_fanout_ent, work);
+	struct admin_unit_fanout *fo = ent->fo;
+	ktime_t start = ktime_get();
+
+	ent->res.ret = admin_unit_ctx_xfer(ent->vf, fo->ctx, 0, fo->ctx->size,
+					   true, &ent->res.bytes);
+	if (ent->res.ret)
+		pr_err("Failed to fan out ctx vf %s -> vf %s ret(%d)\n",
+			fo->src->name, ent->vf->name, ent->res.ret);
+	admin_unit_tl_mark(ent->vf, MIG_PHASE_CTX_WR, start);
+	admin_unit_numa_account(ent->vf->pf, ent->res.bytes);
+	admin_unit_tl_link(ent->vf, fo->src);
+	ent->res.ns = ktime_to_ns(ktime_sub(ktime_get(), fo->start));
+
+	if (atomic_dec_and_test(&fo->pending))
+		complete(&fo->done);
+}
+
+static int admin_unit_fanout_run(struct admin_unit_fanout *fo)
+{
+	struct admin_unit_fanout_res *res;
+	struct admin_vf *src = fo->src;
+	ktime_t start = ktime_get();
+	int i, ok = 0, ret = 0;
+	s64 rd_ns = 0;
+
+	if (fo->restored) {
+		fo->ctx = admin_unit_vf_restored_take(src);
+		if (!fo->ctx) {
+			pr_err("No restored ctx of vf %s to fan out", src->name);
+			return -ENODATA;
+		}
+	} else {
+		ret = admin_unit_vf_ctx_take_whole(src, &fo->ctx);
+		if (ret) {
+			pr_err("vf %s: partial save in progress, not fanned out\n",
+			       src->name);
+			return ret;
+		}
+	}
+	if (!fo->ctx) {
+		ret = admin_unit_cmd_dev_ctx_sz_get_proc(src, 1);
+		if (!ret)
+			ret = admin_unit_cmd_dev_ctx_rd_proc(src);
+		if (ret)
+			return ret;
+		fo->ctx = admin_unit_vf_ctx_take(src);
+		if (!fo->ctx)
+			return -ENODATA;
+		rd_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	}
+
+	pr_debug("%s:%d: fan out dev ctx %#llx bytes vf %s -> %d vfs\n",
+		__func__, __LINE__, fo->ctx->size, src->name, fo->nr);
+
+	init_completion(&fo->done);
+	/* held until every work item is queued */
+	atomic_set(&fo->pending, 1);
+	fo->start = ktime_get();
+	for (i = 0; i < fo->nr; i++) {
+		fo->ent[i].fo = fo;
+		INIT_WORK(&fo->ent[i].work, admin_unit_fanout_work);
+		atomic_inc(&fo->pending);
+		queue_work(admin_unit_wq, &fo->ent[i].work);
+	}
+	if (!atomic_dec_and_test(&fo->pending))
+		wait_for_completion(&fo->done);
+
+	res = kzalloc(sizeof(*res), GFP_KERNEL);
+	if (res) {
+		strscpy(res->src, src->name, sizeof(res->src));
+		res->size = fo->ctx->size;
+		res->rd_ns = rd_ns;
+		res->wall_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+		res->nr = fo->nr;
+	}
+	for (i = 0; i < fo->nr; i++) {
+		if (fo->ent[i].res.ret)
+			ret = ret ? ret : fo->ent[i].res.ret;
+		else
+			ok++;
+		if (res) {
+			res->dst[i] = fo->ent[i].res;
+			res->errs += !!fo->ent[i].res.ret;
+		}
+	}
+	if (res) {
+		mutex_lock(&admin_unit_fanout_lock);
+		g_fanout = *res;
+		mutex_unlock(&admin_unit_fanout_lock);
+		kfree(res);
+	}
+
+	/* the ctx is only read by the writes, keep it for the next fan-out */
+	if (ok) {
+		admin_unit_vf_keep_restored(src, fo->ctx);
+	} else {
+		admin_unit_mem_uncharge(src, admin_unit_ctx_charge(fo->ctx));
+		admin_unit_ctx_free(fo->ctx);
+	}
+	return ret;
+}
+
+static int admin_unit_fanout_cmd(const char *args)
+{
+	struct admin_unit_fanout *fo;
+	char *dup, *p, *tok, *v;
+	struct admin_vf *vf;
+	int i, ret = 0;
+
+	dup = kstrdup(args, GFP_KERNEL);
+	fo = kvzalloc(sizeof(*fo), GFP_KERNEL);
+	if (!dup || !fo) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	p = skip_spaces(dup);
+	tok = strsep(&p, " \t\n");
+	fo->src = tok ? admin_unit_vf_parse(tok) : NULL;
+	if (!fo->src)
+		goto inval;
+	p = p ? skip_spaces(p) : NULL;
+	tok = p ? strsep(&p, " \t\n") : NULL;
+	if (!tok || !*tok)
+		goto inval;
+	while ((v = strsep(&tok, ","))) {
+		vf = admin_unit_vf_parse(v);
+		if (!vf || vf == fo->src || fo->nr == ADMIN_UNIT_FANOUT_MAX) {
+			pr_err("Invalid fanout vf %s\n", v);
+			goto inval;
+		}
+		for (i = 0; i < fo->nr; i++)
+			if (fo->ent[i].vf == vf)
+				goto inval;
+		fo->ent[fo->nr].vf = vf;
+		strscpy(fo->ent[fo->nr].res.name, vf->name,
+			sizeof(fo->ent[fo->nr].res.name));
+		fo->nr++;
+	}
+	p = p ? skip_spaces(p) : NULL;
+	tok = p ? strsep(&p, " \t\n") : NULL;
+	if (tok && *tok) {
+		if (strcmp(tok, "restored"))
+			goto inval;
+		fo->restored = true;
+	}
+
+	ret = admin_unit_fanout_run(fo);
+	goto out;
+inval:
+	ret = -EINVAL;
+out:
+	kvfree(fo);
+	kfree(dup);
+	return ret;
+}
+
+static int admin_unit_fanout_proc_show(struct seq_file *m, void *v)
+{
+	struct admin_unit_fanout_dst *d;
+	int i;
+
+	mutex_lock(&admin_unit_fanout_lock);
+	seq_printf(m, "fanout src %s size %llu dsts %d errors %d rd_ns %lld wall_ns %lld\n",
+		   g_fanout.src, g_fanout.size, g_fanout.nr, g_fanout.errs,
+		   g_fanout.rd_ns, g_fanout.wall_ns);
+	seq_puts(m, "vf         ret   bytes        done_ns\n");
+	for (i = 0; i < g_fanout.nr; i++) {
+		d = &g_fanout.dst[i];
+		seq_printf(m, "%-10s %-5d %-12llu %lld\n", d->name, d->ret,
+			   d->bytes, d->ns);
+	}
+	mutex_unlock(&admin_unit_fanout_lock);
+	return 0;
+}
+
+static int admin_unit_fanout_proc_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, admin_unit_fanout_proc_show, NULL);
+}
+
+static const struct proc_ops admin_unit_fanout_proc_fops = {
+	.proc_open	= admin_unit_fanout_proc_open,
+	.proc_read	= seq_read,
+	.proc_lseek	= seq_lseek,
+	.proc_release	= single_release,
+};
+
+/*
+ * Soak: "soak <threads> <seconds> <vf>[,<vf>...] [<op>=<weight> ...]
+ * [destructive]"
+ * runs kthreads that issue a weighted random mix of admin commands to
+ * random VFs of the list until the time is up, then reports ops/s and
+ * per-command latency percentiles and errors in /proc/admin_unit/soak.
+ * Commands go straight to the device, past the query cache.  Mode
+ * sets, ctx writes and discards change the VFs, so without the fake
+ * transport they are left out of the mix unless "destructive" is given
+ * among the weights.  Commands that move the device ctx stream skip,
+ * as busy, a VF whose lock is held or that has a save in progress.
+ */
+#define ADMIN_UNIT_SOAK_THREADS		64
+#define ADMIN_UNIT_SOAK_VFS		64
+#define ADMIN_UNIT_SOAK_SECS_MAX	600
+
+enum admin_unit_soak_op {
+	SOAK_MODE_GET,
+	SOAK_MODE_SET,
+	SOAK_CTX_SZ_GET,
+	SOAK_CTX_RD,
+	SOAK_CTX_WR,
+	SOAK_FIELD_QUERY,
+	SOAK_DISCARD,
+	SOAK_MAX
+};
+
+/* changes the VF: only with the fake transport or "destructive" */
+#define SOAK_F_DESTRUCTIVE	BIT(0)
+/* moves the device ctx stream: kept off VFs being saved */
+#define SOAK_F_CTX		BIT(1)
+
+static const u8 admin_unit_soak_flags[SOAK_MAX] = {
+	[SOAK_MODE_SET]		= SOAK_F_DESTRUCTIVE | SOAK_F_CTX,
+	[SOAK_CTX_SZ_GET]	= SOAK_F_CTX,
+	[SOAK_CTX_RD]		= SOAK_F_CTX,
+	[SOAK_CTX_WR]		= SOAK_F_DESTRUCTIVE | SOAK_F_CTX,
+	[SOAK_DISCARD]		= SOAK_F_DESTRUCTIVE | SOAK_F_CTX,
+};
+
+static const char * const admin_unit_soak_name[SOAK_MAX] = {
+	[SOAK_MODE_GET]		= "mode_get",
+	[SOAK_MODE_SET]		= "mode_set",
+	[SOAK_CTX_SZ_GET]	= "ctx_sz_get",
+	[SOAK_CTX_RD]		= "ctx_rd",
+	[SOAK_CTX_WR]		= "ctx_wr",
+	[SOAK_FIELD_QUERY]	= "field_query",
+	[SOAK_DISCARD]		= "discard",
+};
+
+/* a monitoring-heavy mix */
+static const u32 admin_unit_soak_def_weight[SOAK_MAX] = {
+	[SOAK_MODE_GET]		= 8,
+	[SOAK_MODE_SET]		= 1,
+	[SOAK_CTX_SZ_GET]	= 2,
+	[SOAK_CTX_RD]		= 4,
+	[SOAK_CTX_WR]		= 1,
+	[SOAK_FIELD_QUERY]	= 4,
+	[SOAK_DISCARD]		= 1,
+};
+
+struct admin_unit_soak_op_res {
+	u64 ops;
+	u64 errs;
+	/* skipped, the VF was locked or being saved */
+	u64 busy;
+	struct admin_unit_hist hist;
+};
+
+struct admin_unit_soak_cfg {
+	int nr_threads;
+	int secs;
+	int nr_vfs;
+	bool destructive;
+	struct admin_vf *vf[ADMIN_UNIT_SOAK_VFS];
+	u32 weight[SOAK_MAX];
+	u32 total_weight;
+};
+
+struct admin_unit_soak_job {
+	const struct admin_unit_soak_cfg *cfg;
+	ktime_t end;
+	/* result buffer of every command, PAGE_SIZE */
+	u8 *buf;
+	struct admin_unit_soak_op_res res[SOAK_MAX];
+	struct completion done;
+};
+
+/* result of the last soak */
+struct admin_unit_soak {
+	int nr_threads;
+	int secs;
+	int nr_vfs;
+	bool destructive;
+	u32 weight[SOAK_MAX];
+	s64 wall_ns;
+	u64 ops;
+	u64 errs;
+	/* PF scheduler waits during the run, over all PFs */
+	u64 sched_waited;
+	u64 sched_wait_ns;
+	struct admin_unit_soak_op_res op[SOAK_MAX];
+};
+
+static struct admin_unit_soak g_soak;
+static DEFINE_MUTEX(admin_unit_soak_lock);
+
+static int admin_unit_soak_exec(struct admin_vf *vf, int op, u8 *buf)
+{
+	struct scatterlist sg;
+	u32 rd_sz, remaining;
+
+	switch (op) {
+	case SOAK_MODE_GET:
+		return admin_unit_cmd_dev_mode_get(vf->pdev, buf,
+				sizeof(struct virtio_admin_cmd_dev_mode));
+	case SOAK_MODE_SET:
+		return admin_unit_cmd_dev_mode_set(vf->pdev,
+				get_random_u32_below(VIRTIO_ADMIN_DEV_MODE_FREEZE + 1));
+	case SOAK_CTX_SZ_GET:
+		return admin_unit_cmd_dev_ctx_sz_get(vf->pdev, 0, buf,
+				sizeof(struct virtio_admin_cmd_dev_ctx_size_get_result));
+	case SOAK_CTX_RD:
+		return admin_unit_cmd_dev_ctx_rd(vf->pdev, buf, PAGE_SIZE,
+						 &rd_sz, &remaining);
+	case SOAK_CTX_WR:
+		/* whatever this thread read last */
+		sg_init_one(&sg, buf, PAGE_SIZE);
+		return admin_unit_cmd_dev_ctx_wr_sg(vf->pdev, &sg);
+	case SOAK_FIELD_QUERY:
+		return admin_unit_cmd_sprt_field_query(vf->pdev, buf,
+				admin_unit_query_ops[ADMIN_UNIT_Q_FIELDS].size);
+	case SOAK_DISCARD:
+		return admin_unit_cmd_discard(vf->pdev);
+	}
+	return -EOPNOTSUPP;
+}
+
+/* -EBUSY when op was skipped, as the sweep skips busy VFs */
+static int admin_unit_soak_issue(struct admin_vf *vf, int op, u8 *buf)
+{
+	int ret;
+
+	if (!(admin_unit_soak_flags[op] & SOAK_F_CTX))
+		return admin_unit_soak_exec(vf, op, buf);
+
+	if (!mutex_trylock(&vf->lock))
+		return -EBUSY;
+	if (vf->cur.off || vf->cur.left)
+		ret = -EBUSY;
+	else
+		ret = admin_unit_soak_exec(vf, op, buf);
+	mutex_unlock(&vf->lock);
+	return ret;
+}
+
+static int admin_unit_soak_thread(void *data)
+{
+	struct admin_unit_soak_job *job = data;
+	const struct admin_unit_soak_cfg *cfg = job->cfg;
+	struct admin_unit_soak_op_res *res;
+	struct admin_vf *vf;
+	ktime_t start;
+	u32 r;
+	int op, ret;
+
+	while (ktime_before(ktime_get(), job->end)) {
+		r = get_random_u32_below(cfg->total_weight);
+		for (op = 0; r >= cfg->weight[op]; op++)
+			r -= cfg->weight[op];
+		vf = cfg->vf[get_random_u32_below(cfg->nr_vfs)];
+
+		start = ktime_get();
+		ret = admin_unit_soak_issue(vf, op, job->buf);
+		res = &job->res[op];
+		if (ret == -EBUSY) {
+			res->busy++;
+			cond_resched();
+			continue;
+		}
+		admin_unit_hist_add(&res->hist,
+				    ktime_to_ns(ktime_sub(ktime_get(), start)));
+		res->ops++;
+		if (ret)
+			res->errs++;
+		cond_resched();
+	}
+	complete(&job->done);
+	return 0;
+}
+
+static void admin_unit_soak_sched(u64 *waited, u64 *wait_ns)
+{
+	struct admin_pf *pf;
+	unsigned long pi;
+
+	*waited = 0;
+	*wait_ns = 0;
+	xa_for_each(&g_dev_mgr.pfs, pi, pf) {
+		spin_lock(&pf->sched.lock);
+		*waited += pf->sched.waited;
+		*wait_ns += pf->sched.wait_ns;
+		spin_unlock(&pf->sched.lock);
+	}
+}
+
+static int admin_unit_soak_run(const struct admin_unit_soak_cfg *cfg)
+{
+	struct admin_unit_soak_job *jobs;
+	u64 waited, wait_ns;
+	struct task_struct *task;
+	ktime_t start, end;
+	int i, op, node, ret = 0;
+
+	jobs = kvcalloc(cfg->nr_threads, sizeof(*jobs), GFP_KERNEL);
+	if (!jobs)
+		return -ENOMEM;
+	for (i = 0; i < cfg->nr_threads; i++) {
+		jobs[i].buf = kzalloc(PAGE_SIZE, GFP_KERNEL);
+		if (!jobs[i].buf) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	admin_unit_soak_sched(&waited, &wait_ns);
+	start = ktime_get();
+	end = ktime_add_ms(start, (u64)cfg->secs * MSEC_PER_SEC);
+	for (i = 0; i < cfg->nr_threads; i++) {
+		jobs[i].cfg = cfg;
+		jobs[i].end = end;
+		init_completion(&jobs[i].done);
+		/* spread the threads over the PFs of the VFs */
+		node = cfg->vf[i % cfg->nr_vfs]->pf->node;
+		task = kthread_create_on_node(admin_unit_soak_thread, &jobs[i],
+					      node, "admin_soak%d", i);
+		if (IS_ERR(task)) {
+			ret = PTR_ERR(task);
+			complete(&jobs[i].done);
+			continue;
+		}
+		wake_up_process(task);
+	}
+	for (i = 0; i < cfg->nr_threads; i++)
+		wait_for_completion(&jobs[i].done);
+
+	mutex_lock(&admin_unit_soak_lock);
+	memset(&g_soak, 0, sizeof(g_soak));
+	g_soak.nr_threads = cfg->nr_threads;
+	g_soak.secs = cfg->secs;
+	g_soak.nr_vfs = cfg->nr_vfs;
+	g_soak.destructive = cfg->destructive;
+	memcpy(g_soak.weight, cfg->weight, sizeof(g_soak.weight));
+	g_soak.wall_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	admin_unit_soak_sched(&g_soak.sched_waited, &g_soak.sched_wait_ns);
+	g_soak.sched_waited -= waited;
+	g_soak.sched_wait_ns -= wait_ns;
+	for (i = 0; i < cfg->nr_threads; i++) {
+		for (op = 0; op < SOAK_MAX; op++) {
+			g_soak.op[op].ops += jobs[i].res[op].ops;
+			g_soak.op[op].errs += jobs[i].res[op].errs;
+			g_soak.op[op].busy += jobs[i].res[op].busy;
+			admin_unit_hist_merge(&g_soak.op[op].hist,
+					      &jobs[i].res[op].hist);
+		}
+	}
+	for (op = 0; op < SOAK_MAX; op++) {
+		g_soak.ops += g_soak.op[op].ops;
+		g_soak.errs += g_soak.op[op].errs;
+	}
+	pr_debug("soak: %d threads %d vfs %llu ops %llu errors in %lld ns\n",
+		cfg->nr_threads, cfg->nr_vfs, g_soak.ops, g_soak.errs,
+		g_soak.wall_ns);
+	mutex_unlock(&admin_unit_soak_lock);
+out:
+	for (i = 0; i < cfg->nr_threads; i++)
+		kfree(jobs[i].buf);
+	kvfree(jobs);
+	return ret;
+}
+
+static int admin_unit_soak_cmd(const char *args)
+{
+	struct admin_unit_soak_cfg *cfg;
+	char *dup, *p, *tok, *v, *eq;
+	struct admin_vf *vf;
+	int i, op, ret = 0;
+	u32 w, set = 0;
+
+	dup = kstrdup(args, GFP_KERNEL);
+	cfg = kzalloc(sizeof(*cfg), GFP_KERNEL);
+	if (!dup || !cfg) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	memcpy(cfg->weight, admin_unit_soak_def_weight, sizeof(cfg->weight));
+
+	p = skip_spaces(dup);
+	tok = strsep(&p, " \t\n");
+	if (!tok || kstrtoint(tok, 0, &cfg->nr_threads) ||
+	    cfg->nr_threads < 1 || cfg->nr_threads > ADMIN_UNIT_SOAK_THREADS)
+		goto inval;
+	tok = strsep(&p, " \t\n");
+	if (!tok || kstrtoint(tok, 0, &cfg->secs) ||
+	    cfg->secs < 1 || cfg->secs > ADMIN_UNIT_SOAK_SECS_MAX)
+		goto inval;
+	tok = strsep(&p, " \t\n");
+	if (!tok)
+		goto inval;
+	while ((v = strsep(&tok, ","))) {
+		vf = admin_unit_vf_parse(v);
+		if (!vf || cfg->nr_vfs == ADMIN_UNIT_SOAK_VFS) {
+			pr_err("Invalid soak vf %s\n", v);
+			goto inval;
+		}
+		cfg->vf[cfg->nr_vfs++] = vf;
+	}
+
+	while ((tok = strsep(&p, " \t\n"))) {
+		if (!*tok)
+			continue;
+		if (!strcmp(tok, "destructive")) {
+			cfg->destructive = true;
+			continue;
+		}
+		eq = strchr(tok, '=');
+		if (!eq)
+			goto inval;
+		*eq = '\0';
+		for (op = 0; op < SOAK_MAX; op++)
+			if (!strcmp(tok, admin_unit_soak_name[op]))
+				break;
+		if (op == SOAK_MAX || kstrtou32(eq + 1, 0, &w) || w > 1000) {
+			pr_err("Invalid soak weight %s\n", tok);
+			goto inval;
+		}
+		cfg->weight[op] = w;
+		set |= BIT(op);
+	}
+	if (READ_ONCE(fake_transport))
+		cfg->destructive = true;
+	for (i = 0; i < SOAK_MAX && !cfg->destructive; i++) {
+		if (!(admin_unit_soak_flags[i] & SOAK_F_DESTRUCTIVE))
+			continue;
+		if (set & BIT(i) && cfg->weight[i]) {
+			pr_err("soak %s changes the VFs, add \"destructive\"\n",
+			       admin_unit_soak_name[i]);
+			ret = -EPERM;
+			goto out;
+		}
+		cfg->weight[i] = 0;
+	}
+	for (i = 0; i < SOAK_MAX; i++)
+		cfg->total_weight += cfg->weight[i];
+	if (!cfg->total_weight)
+		goto inval;
+
+	ret = admin_unit_soak_run(cfg);
+	goto out;
+inval:
+	ret = -EINVAL;
+out:
+	kfree(cfg);
+	kfree(dup);
+	return ret;
+}
+
+static int admin_unit_soak_proc_show(struct seq_file *m, void *v)
+{
+	struct admin_unit_soak_op_res *r;
+	int op;
+
+	mutex_lock(&admin_unit_soak_lock);
+	seq_printf(m, "threads %d secs %d vfs %d destructive %d wall_ns %lld ops %llu ops_per_sec %llu errors %llu\n",
+		   g_soak.nr_threads, g_soak.secs, g_soak.nr_vfs,
+		   g_soak.destructive, g_soak.wall_ns, g_soak.ops,
+		   g_soak.wall_ns > 0 ?
+		   div64_u64(g_soak.ops * NSEC_PER_SEC, g_soak.wall_ns) : 0,
+		   g_soak.errs);
+	seq_printf(m, "sched waited %llu avg_wait_ns %llu\n",
+		   g_soak.sched_waited,
+		   g_soak.sched_waited ?
+		   div64_u64(g_soak.sched_wait_ns, g_soak.sched_waited) : 0);
+	for (op = 0; op < SOAK_MAX; op++) {
+		r = &g_soak.op[op];
+		seq_printf(m, "  %-12s weight %u ops %llu errors %llu busy %llu p50 %llu p90 %llu p99 %llu p999 %llu max %llu ns\n",
+			   admin_unit_soak_name[op], g_soak.weight[op],
+			   r->ops, r->errs, r->busy,
+			   admin_unit_hist_pct(&r->hist, 500),
+			   admin_unit_hist_pct(&r->hist, 900),
+			   admin_unit_hist_pct(&r->hist, 990),
+			   admin_unit_hist_pct(&r->hist, 999),
+			   r->hist.max);
+	}
+	mutex_unlock(&admin_unit_soak_lock);
+	return 0;
+}
+
+static int admin_unit_soak_proc_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, admin_unit_soak_proc_show, NULL);
+}
+
+static const struct proc_ops admin_unit_soak_proc_fops = {
+	.proc_open	= admin_unit_soak_proc_open,
+	.proc_read	= seq_read,
+	.proc_lseek	= seq_lseek,
+	.proc_release	= single_release,
+};
+
+/* a copy of a trace, laid out as it is read from /proc/admin_unit/trace */
+struct admin_unit_trace_buf {
+	size_t len;
+	/* bytes written so far, when importing */
+	size_t filled;
+	struct admin_unit_trace_hdr hdr;
+	struct admin_unit_trace_rec rec[];
+};
+
+/* written to /proc/admin_unit/trace, replayed instead of the ring */
+static struct admin_unit_trace_buf *g_trace_import;
+
+static int admin_unit_trace_cmp(const void *a, const void *b)
+{
+	const struct admin_unit_trace_rec *ra = a, *rb = b;
+
+	if (ra->ts_ns != rb->ts_ns)
+		return ra->ts_ns < rb->ts_ns ? -1 : 1;
+	return 0;
+}
+
+static struct admin_unit_trace_buf *admin_unit_trace_alloc(u32 nr)
+{
+	struct admin_unit_trace_buf *tb;
+
+	tb = kvzalloc(struct_size(tb, rec, nr), GFP_KERNEL);
+	if (!tb)
+		return NULL;
+	tb->hdr.magic = ADMIN_UNIT_TRACE_MAGIC;
+	tb->hdr.version = ADMIN_UNIT_TRACE_VERSION;
+	tb->hdr.rec_size = sizeof(struct admin_unit_trace_rec);
+	tb->hdr.nr = nr;
+	tb->len = sizeof(tb->hdr) + (size_t)nr * sizeof(tb->rec[0]);
+	return tb;
+}
+
+/* the ring in issue order; records land in it as the commands complete */
+static struct admin_unit_trace_buf *admin_unit_trace_snap(void)
+{
+	struct admin_unit_trace_buf *tb;
+	u32 nr, first;
+
+	mutex_lock(&admin_unit_trace_mutex);
+	tb = admin_unit_trace_alloc(g_trace.size);
+	if (!tb)
+		goto out;
+
+	spin_lock(&admin_unit_trace_lock);
+	nr = min_t(u64, g_trace.total, g_trace.size);
+	first = g_trace.total > g_trace.size ? g_trace.pos : 0;
+	memcpy(tb->rec, g_trace.rec + first,
+	       (size_t)(nr - first) * sizeof(tb->rec[0]));
+	memcpy(tb->rec + nr - first, g_trace.rec,
+	       (size_t)first * sizeof(tb->rec[0]));
+	tb->hdr.dropped = min_t(u64, g_trace.total - nr, U32_MAX);
+	spin_unlock(&admin_unit_trace_lock);
+
+	tb->hdr.nr = nr;
+	tb->len = sizeof(tb->hdr) + (size_t)nr * sizeof(tb->rec[0]);
+	sort(tb->rec, nr, sizeof(tb->rec[0]), admin_unit_trace_cmp, NULL);
+out:
+	mutex_unlock(&admin_unit_trace_mutex);
+	return tb;
+}
+
+static int admin_unit_trace_start(const char *args)
+{
+	struct admin_unit_trace_rec *rec, *old;
+	u32 size = ADMIN_UNIT_TRACE_DEF;
+	char *p = skip_spaces(args);
+
+	strim(p);
+	if (*p && (kstrtou32(p, 0, &size) || !size ||
+		   size > ADMIN_UNIT_TRACE_MAX))
+		return -EINVAL;
+
+	rec = kvcalloc(size, sizeof(*rec), GFP_KERNEL);
+	if (!rec)
+		return -ENOMEM;
+
+	mutex_lock(&admin_unit_trace_mutex);
+	spin_lock(&admin_unit_trace_lock);
+	old = g_trace.rec;
+	g_trace.rec = rec;
+	g_trace.size = size;
+	g_trace.pos = 0;
+	g_trace.total = 0;
+	g_trace.start = ktime_get();
+	WRITE_ONCE(g_trace.on, true);
+	spin_unlock(&admin_unit_trace_lock);
+	mutex_unlock(&admin_unit_trace_mutex);
+
+	kvfree(old);
+	return 0;
+}
+
+static void admin_unit_trace_stop(void)
+{
+	spin_lock(&admin_unit_trace_lock);
+	WRITE_ONCE(g_trace.on, false);
+	spin_unlock(&admin_unit_trace_lock);
+}
+
+static int admin_unit_trace_proc_open(struct inode *inode, struct file *file)
+{
+	/* writers import a trace, readers get a snapshot of the ring */
+	if (file->f_mode & FMODE_WRITE)
+		return 0;
+	file->private_data = admin_unit_trace_snap();
+	return file->private_data ? 0 : -ENOMEM;
+}
+
+static ssize_t admin_unit_trace_proc_read(struct file *file, char __user *ubuf,
+					  size_t count, loff_t *ppos)
+{
+	struct admin_unit_trace_buf *tb = file->private_data;
+
+	if (!tb)
+		return -EINVAL;
+	return simple_read_from_buffer(ubuf, count, ppos, &tb->hdr, tb->len);
+}
+
+static ssize_t admin_unit_trace_proc_write(struct file *file,
+					   const char __user *ubuf,
+					   size_t count, loff_t *ppos)
+{
+	struct admin_unit_trace_buf *tb = file->private_data;
+	struct admin_unit_trace_hdr hdr;
+	ssize_t ret;
+
+	if (!tb) {
+		/* the header comes first and sizes the trace */
+		if (*ppos || count < sizeof(hdr))
+			return -EINVAL;
+		if (copy_from_user(&hdr, ubuf, sizeof(hdr)))
+			return -EFAULT;
+		if (hdr.magic != ADMIN_UNIT_TRACE_MAGIC ||
+		    hdr.version != ADMIN_UNIT_TRACE_VERSION ||
+		    hdr.rec_size != sizeof(struct admin_unit_trace_rec) ||
+		    hdr.nr > ADMIN_UNIT_TRACE_MAX) {
+			pr_err("Invalid trace header\n");
+			return -EINVAL;
+		}
+		tb = admin_unit_trace_alloc(hdr.nr);
+		if (!tb)
+			return -ENOMEM;
+		file->private_data = tb;
+	}
+
+	if (*ppos != tb->filled)
+		return -EINVAL;
+	ret = simple_write_to_buffer(&tb->hdr, tb->len, ppos, ubuf, count);
+	if (ret > 0)
+		tb->filled = *ppos;
+	return ret;
+}
+
+static int admin_unit_trace_proc_release(struct inode *inode, struct file *file)
+{
+	struct admin_unit_trace_buf *tb = file->private_data;
+
+	if (!(file->f_mode & FMODE_WRITE) || !tb) {
+		kvfree(tb);
+		return 0;
+	}
+	if (tb->filled != tb->len) {
+		pr_err("Short trace, %zu of %zu bytes\n", tb->filled, tb->len);
+		kvfree(tb);
+		return 0;
+	}
+
+	/* the header was read twice from user space, keep what was sized */
+	tb->hdr.nr = (tb->len - sizeof(tb->hdr)) / sizeof(tb->rec[0]);
+	tb->hdr.rec_size = sizeof(tb->rec[0]);
+	sort(tb->rec, tb->hdr.nr, sizeof(tb->rec[0]), admin_unit_trace_cmp,
+	     NULL);
+
+	mutex_lock(&admin_unit_trace_mutex);
+	swap(tb, g_trace_import);
+	mutex_unlock(&admin_unit_trace_mutex);
+	kvfree(tb);
+	return 0;
+}
+
+static const struct proc_ops admin_unit_trace_proc_fops = {
+	.proc_open	= admin_unit_trace_proc_open,
+	.proc_read	= admin_unit_trace_proc_read,
+	.proc_write	= admin_unit_trace_proc_write,
+	.proc_release	= admin_unit_trace_proc_release,
+};
+
+/*
+ * Trace replay.  "trace_replay [fast] [<pf>:<vf>=<pf>:<vf> ...]" issues
+ * the imported trace, or else the ring, again: at the recorded issue
+ * times (open loop, each command on admin_unit_wq so a slow one does not
+ * hold back the next), or with "fast" one after another.  Recorded VFs
+ * are replayed on themselves unless mapped.  ctx writes carry the fake
+ * pattern at the offset the trace has written so far, which the fake
+ * transport accepts and a real device does not; replay those on spare
+ * VFs only.  /proc/admin_unit/replay compares the run with the recording.
+ */
+#define ADMIN_UNIT_REPLAY_VFS	64
+
+enum admin_unit_replay_op {
+	REPLAY_LIST_QUERY,
+	REPLAY_MODE_GET,
+	REPLAY_MODE_SET,
+	REPLAY_CTX_SZ_GET,
+	REPLAY_CTX_RD,
+	REPLAY_CTX_WR,
+	REPLAY_FIELD_QUERY,
+	REPLAY_DISCARD,
+	REPLAY_MAX
+};
+
+static const char * const admin_unit_replay_name[REPLAY_MAX] = {
+	[REPLAY_LIST_QUERY]	= "list_query",
+	[REPLAY_MODE_GET]	= "mode_get",
+	[REPLAY_MODE_SET]	= "mode_set",
+	[REPLAY_CTX_SZ_GET]	= "ctx_sz_get",
+	[REPLAY_CTX_RD]		= "ctx_rd",
+	[REPLAY_CTX_WR]		= "ctx_wr",
+	[REPLAY_FIELD_QUERY]	= "field_query",
+	[REPLAY_DISCARD]	= "discard",
+};
+
+static int admin_unit_replay_op(u16 opcode)
+{
+	switch (opcode) {
+	case VIRTIO_ADMIN_CMD_LIST_QUERY:
+		return REPLAY_LIST_QUERY;
+	case VIRTIO_ADMIN_CMD_DEV_MODE_GET:
+		return REPLAY_MODE_GET;
+	case VIRTIO_ADMIN_CMD_DEV_MODE_SET:
+		return REPLAY_MODE_SET;
+	case VIRTIO_ADMIN_CMD_DEV_CTX_SIZE_GET:
+		return REPLAY_CTX_SZ_GET;
+	case VIRTIO_ADMIN_CMD_DEV_CTX_READ:
+		return REPLAY_CTX_RD;
+	case VIRTIO_ADMIN_CMD_DEV_CTX_WRITE:
+		return REPLAY_CTX_WR;
+	case VIRTIO_ADMIN_CMD_DEV_CTX_FIELDS_QUERY:
+		return REPLAY_FIELD_QUERY;
+	case VIRTIO_ADMIN_CMD_DEV_CTX_DISCARD:
+		return REPLAY_DISCARD;
+	}
+	return -1;
+}
+
+struct admin_unit_replay_tgt {
+	u32 id;			/* as recorded */
+	struct admin_vf *vf;
+	u64 wr_off;		/* ctx written since the last mode change */
+};
+
+struct admin_unit_replay_ent {
+	struct work_struct work;
+	struct admin_unit_replay *rp;
+	const struct admin_unit_trace_rec *rec;
+	struct admin_vf *vf;
+	u64 wr_off;
+	int op;
+	int status;
+	u64 lat_ns;
+};
+
+struct admin_unit_replay {
+	atomic_t pending;
+	struct completion done;
+	struct admin_unit_replay_ent ent[];
+};
+
+struct admin_unit_replay_op_res {
+	u64 nr;
+	u64 rec_errs;
+	u64 errs;
+	u64 status_diff;
+	struct admin_unit_hist rec_hist;
+	struct admin_unit_hist hist;
+};
+
+struct admin_unit_replay_res {
+	bool fast;
+	u32 nr;
+	u32 skipped;
+	u64 span_ns;
+	s64 wall_ns;
+	u64 max_lag_ns;
+	struct admin_unit_replay_op_res op[REPLAY_MAX];
+};
+
+static struct admin_unit_replay_res g_replay;
+static DEFINE_MUTEX(admin_unit_replay_lock);
+
+static int admin_unit_replay_issue(struct admin_unit_replay_ent *ent)
+{
+	const struct admin_unit_trace_rec *rec = ent->rec;
+	struct admin_vf *vf = ent->vf;
+	struct admin_unit_ctx *ctx = NULL;
+	struct scatterlist *sgl = NULL;
+	u32 len = 0, rd_sz, remaining;
+	u8 *buf = NULL;
+	ktime_t start;
+	int ret;
+
+	switch (ent->op) {
+	case REPLAY_CTX_RD:
+		len = rec->out_len -
+		      sizeof(struct virtio_admin_cmd_dev_ctx_rd_result);
+		fallthrough;
+	case REPLAY_CTX_WR:
+		if (ent->op == REPLAY_CTX_WR)
+			len = rec->in_len;
+		/* traced on a PF whose admin vq took a larger window */
+		if (len > vf->pf->win) {
+			ret = -E2BIG;
+			goto out;
+		}
+		/* filled by the read, or with the pattern below */
+		ctx = admin_unit_ctx_alloc(vf->pf, len, false);
+		sgl = kmalloc_array_node(ADMIN_UNIT_CTX_WIN_PAGES, sizeof(*sgl),
+					 GFP_KERNEL, vf->pf->node);
+		if (!ctx || !sgl) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		admin_unit_ctx_sg(ctx, 0, len, sgl);
+		if (ent->op == REPLAY_CTX_WR)
+			admin_unit_fake_pattern(sgl, 0, len, ent->wr_off, false);
+		break;
+	default:
+		buf = kzalloc_node(max_t(u32, rec->out_len, 1), GFP_KERNEL,
+				   vf->pf->node);
+		if (!buf) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		break;
+	}
+
+	start = ktime_get();
+	switch (ent->op) {
+	case REPLAY_LIST_QUERY:
+		ret = admin_unit_cmd_list_query(vf->pdev, buf, rec->out_len);
+		break;
+	case REPLAY_MODE_GET:
+		ret = admin_unit_cmd_dev_mode_get(vf->pdev, buf, rec->out_len);
+		break;
+	case REPLAY_MODE_SET:
+		ret = admin_unit_cmd_dev_mode_set(vf->pdev, *(const u8 *)&rec->arg);
+		break;
+	case REPLAY_CTX_SZ_GET:
+		ret = admin_unit_cmd_dev_ctx_sz_get(vf->pdev,
+						    *(const u8 *)&rec->arg, buf,
+						    rec->out_len);
+		break;
+	case REPLAY_CTX_RD:
+		ret = admin_unit_cmd_dev_ctx_rd_sg(vf->pdev, sgl, &rd_sz,
+						   &remaining);
+		break;
+	case REPLAY_CTX_WR:
+		ret = admin_unit_cmd_dev_ctx_wr_sg(vf->pdev, sgl);
+		break;
+	case REPLAY_FIELD_QUERY:
+		ret = admin_unit_cmd_sprt_field_query(vf->pdev, buf,
+						      rec->out_len);
+		break;
+	case REPLAY_DISCARD:
+		ret = admin_unit_cmd_discard(vf->pdev);
+		break;
+	default:
+		ret = -EOPNOTSUPP;
+		break;
+	}
+	ent->lat_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+out:
+	kfree(sgl);
+	admin_unit_ctx_free(ctx);
+	kfree(buf);
+	return ret;
+}
+
+static void admin_unit_replay_work(struct work_struct *work)
+{
+	struct admin_unit_replay_ent *ent =
+		container_of(work, struct admin_unit_replay_ent, work);
+	struct admin_unit_replay *rp = ent->rp;
+
+	ent->status = admin_unit_replay_issue(ent);
+	if (atomic_dec_and_test(&rp->pending))
+		complete(&rp->done);
+}
+
+/* where rec is replayed, or NULL to skip it */
+static struct admin_unit_replay_tgt *
+admin_unit_replay_tgt(struct admin_unit_replay_tgt *tgt, int *nr_tgt,
+		      const struct admin_unit_trace_rec *rec)
+{
+	struct admin_unit_replay_tgt *t;
+	int i;
+
+	for (i = 0; i < *nr_tgt; i++)
+		if (tgt[i].id == rec->vf)
+			return tgt[i].vf ? &tgt[i] : NULL;
+	if (*nr_tgt == ADMIN_UNIT_REPLAY_VFS)
+		return NULL;
+
+	t = &tgt[(*nr_tgt)++];
+	t->id = rec->vf;
+	t->vf = admin_unit_vf_get(rec->vf);
+	return t->vf ? t : NULL;
+}
+
+/* the command rec describes, or -1 if it cannot be replayed */
+static int admin_unit_replay_check(const struct admin_unit_trace_rec *rec)
+{
+	int op = admin_unit_replay_op(rec->opcode);
+
+	switch (op) {
+	case REPLAY_CTX_RD:
+		if (rec->out_len <= sizeof(struct virtio_admin_cmd_dev_ctx_rd_result) ||
+		    rec->out_len - sizeof(struct virtio_admin_cmd_dev_ctx_rd_result) >
+		    ADMIN_UNIT_CTX_WIN)
+			return -1;
+		break;
+	case REPLAY_CTX_WR:
+		if (!rec->in_len || rec->in_len > ADMIN_UNIT_CTX_WIN)
+			return -1;
+		break;
+	case REPLAY_LIST_QUERY:
+	case REPLAY_MODE_GET:
+	case REPLAY_CTX_SZ_GET:
+	case REPLAY_FIELD_QUERY:
+		if (!rec->out_len || rec->out_len > PAGE_SIZE)
+			return -1;
+		break;
+	}
+	return op;
+}
+
+static void admin_unit_replay_report(struct admin_unit_replay_res *res,
+				     struct admin_unit_replay *rp, u32 nr)
+{
+	const struct admin_unit_trace_rec *rec;
+	struct admin_unit_replay_ent *ent;
+	struct admin_unit_replay_op_res *r;
+	u64 first = 0, last = 0;
+	u32 i;
+
+	for (i = 0; i < nr; i++) {
+		ent = &rp->ent[i];
+		rec = ent->rec;
+		if (!ent->vf) {
+			res->skipped++;
+			continue;
+		}
+		if (!res->nr)
+			first = rec->ts_ns;
+		last = max_t(u64, last, rec->ts_ns + rec->lat_ns);
+		res->nr++;
+
+		r = &res->op[ent->op];
+		r->nr++;
+		r->rec_errs += !!rec->status;
+		r->errs += !!ent->status;
+		r->status_diff += rec->status != ent->status;
+		admin_unit_hist_add(&r->rec_hist, rec->lat_ns);
+		admin_unit_hist_add(&r->hist, ent->lat_ns);
+	}
+	res->span_ns = last - first;
+}
+
+static int admin_unit_replay_run(const struct admin_unit_trace_buf *tb,
+				 bool fast, struct admin_unit_replay_tgt *tgt,
+				 int nr_tgt)
+{
+	struct admin_unit_replay_res *res;
+	struct admin_unit_replay_ent *ent;
+	struct admin_unit_replay_tgt *t;
+	struct admin_unit_replay *rp;
+	u32 i, n, nr = tb->hdr.nr;
+	u64 due, now, base;
+	ktime_t start;
+	int ret = 0;
+
+	rp = kvzalloc(struct_size(rp, ent, nr), GFP_KERNEL);
+	res = kzalloc(sizeof(*res), GFP_KERNEL);
+	if (!rp || !res) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	init_completion(&rp->done);
+	/* held until every work item is queued */
+	atomic_set(&rp->pending, 1);
+
+	base = nr ? tb->rec[0].ts_ns : 0;
+	n = nr;
+	start = ktime_get();
+	for (i = 0; i < nr; i++) {
+		ent = &rp->ent[i];
+		ent->rp = rp;
+		ent->rec = &tb->rec[i];
+		ent->op = admin_unit_replay_check(ent->rec);
+		t = ent->op < 0 ? NULL :
+		    admin_unit_replay_tgt(tgt, &nr_tgt, ent->rec);
+		if (!t)
+			continue;
+		ent->vf = t->vf;
+
+		/* the write offset follows the trace, not completion order */
+		if (ent->op == REPLAY_MODE_SET || ent->op == REPLAY_DISCARD)
+			t->wr_off = 0;
+		if (ent->op == REPLAY_CTX_WR) {
+			ent->wr_off = t->wr_off;
+			t->wr_off += ent->rec->in_len;
+		}
+
+		if (fast) {
+			ent->status = admin_unit_replay_issue(ent);
+			if (fatal_signal_pending(current)) {
+				n = i + 1;
+				ret = -EINTR;
+				break;
+			}
+			continue;
+		}
+
+		due = ent->rec->ts_ns - base;
+		now = ktime_to_ns(ktime_sub(ktime_get(), start));
+		while (due > now && !fatal_signal_pending(current)) {
+			fsleep(div_u64(min_t(u64, due - now, NSEC_PER_SEC),
+				       NSEC_PER_USEC));
+			now = ktime_to_ns(ktime_sub(ktime_get(), start));
+		}
+		if (fatal_signal_pending(current)) {
+			n = i;
+			ret = -EINTR;
+			break;
+		}
+		res->max_lag_ns = max(res->max_lag_ns, now - due);
+
+		INIT_WORK(&ent->work, admin_unit_replay_work);
+		atomic_inc(&rp->pending);
+		queue_work(admin_unit_wq, &ent->work);
+	}
+	if (!atomic_dec_and_test(&rp->pending))
+		wait_for_completion(&rp->done);
+
+	res->wall_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	res->fast = fast;
+	admin_unit_replay_report(res, rp, n);
+
+	mutex_lock(&admin_unit_replay_lock);
+	g_replay = *res;
+	pr_debug("replay: %u records %u skipped in %lld ns\n",
+		g_replay.nr, g_replay.skipped, g_replay.wall_ns);
+	mutex_unlock(&admin_unit_replay_lock);
+out:
+	kfree(res);
+	kvfree(rp);
+	return ret;
+}
+
+static int admin_unit_replay_cmd(const char *args)
+{
+	struct admin_unit_trace_buf *tb = NULL;
+	struct admin_unit_replay_tgt *tgt;
+	unsigned int pf_idx, vf_id;
+	char *dup, *p, *tok, *eq;
+	bool fast = false;
+	int nr_tgt = 0, ret = 0;
+
+	dup = kstrdup(args, GFP_KERNEL);
+	tgt = kcalloc(ADMIN_UNIT_REPLAY_VFS, sizeof(*tgt), GFP_KERNEL);
+	if (!dup || !tgt) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	p = skip_spaces(dup);
+	while ((tok = strsep(&p, " \t\n"))) {
+		if (!*tok)
+			continue;
+		if (!strcmp(tok, "fast")) {
+			fast = true;
+			continue;
+		}
+		eq = strchr(tok, '=');
+		if (!eq || nr_tgt == ADMIN_UNIT_REPLAY_VFS)
+			goto inval;
+		*eq = '\0';
+		if (sscanf(tok, "%u:%u", &pf_idx, &vf_id) != 2 ||
+		    pf_idx > 0xffff || vf_id > 0xffff)
+			goto inval;
+		tgt[nr_tgt].id = ADMIN_VF_ID(pf_idx, vf_id);
+		tgt[nr_tgt].vf = admin_unit_vf_parse(eq + 1);
+		if (!tgt[nr_tgt].vf) {
+			pr_err("Invalid replay vf %s\n", eq + 1);
+			goto inval;
+		}
+		nr_tgt++;
+	}
+
+	mutex_lock(&admin_unit_trace_mutex);
+	if (g_trace_import) {
+		tb = kvmalloc(struct_size(tb, rec, g_trace_import->hdr.nr),
+			      GFP_KERNEL);
+		if (tb)
+			memcpy(tb, g_trace_import,
+			       struct_size(tb, rec, g_trace_import->hdr.nr));
+	}
+	mutex_unlock(&admin_unit_trace_mutex);
+	if (!tb)
+		tb = admin_unit_trace_snap();
+	if (!tb) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	ret = admin_unit_replay_run(tb, fast, tgt, nr_tgt);
+	goto out;
+inval:
+	ret = -EINVAL;
+out:
+	kvfree(tb);
+	kfree(tgt);
+	kfree(dup);
+	return ret;
+}
+
+static u64 admin_unit_hist_mean(const struct admin_unit_hist *h)
+{
+	return h->n ? div64_u64(h->sum, h->n) : 0;
+}
+
+static int admin_unit_replay_proc_show(struct seq_file *m, void *v)
+{
+	struct admin_unit_replay_op_res *r;
+	int op;
+
+	mutex_lock(&admin_unit_replay_lock);
+	seq_printf(m, "replay %s records %u skipped %u max_lag_ns %llu\n",
+		   g_replay.fast ? "fast" : "timed", g_replay.nr,
+		   g_replay.skipped, g_replay.max_lag_ns);
+	seq_printf(m, "recorded span_ns %llu ops_per_sec %llu\n",
+		   g_replay.span_ns,
+		   g_replay.span_ns ?
+		   div64_u64((u64)g_replay.nr * NSEC_PER_SEC, g_replay.span_ns) : 0);
+	seq_printf(m, "replayed wall_ns %lld ops_per_sec %llu\n",
+		   g_replay.wall_ns,
+		   g_replay.wall_ns > 0 ?
+		   div64_u64((u64)g_replay.nr * NSEC_PER_SEC, g_replay.wall_ns) : 0);
+	for (op = 0; op < REPLAY_MAX; op++) {
+		r = &g_replay.op[op];
+		if (!r->nr)
+			continue;
+		seq_printf(m, "  %-12s nr %llu errors %llu/%llu status_diff %llu p50 %llu/%llu p99 %llu/%llu mean %llu/%llu ns\n",
+			   admin_unit_replay_name[op], r->nr,
+			   r->rec_errs, r->errs, r->status_diff,
+			   admin_unit_hist_pct(&r->rec_hist, 500),
+			   admin_unit_hist_pct(&r->hist, 500),
+			   admin_unit_hist_pct(&r->rec_hist, 990),
+			   admin_unit_hist_pct(&r->hist, 990),
+			   admin_unit_hist_mean(&r->rec_hist),
+			   admin_unit_hist_mean(&r->hist));
+	}
+	mutex_unlock(&admin_unit_replay_lock);
+	return 0;
+}
+
+static int admin_unit_replay_proc_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, admin_unit_replay_proc_show, NULL);
+}
+
+static const struct proc_ops admin_unit_replay_proc_fops = {
+	.proc_open	= admin_unit_replay_proc_open,
+	.proc_read	= seq_read,
+	.proc_lseek	= seq_lseek,
+	.proc_release	= single_release,
+};
+
+/*
+ * In-module selftest, run on two VFs through the fake transport:
+ * functional cases for every command handler, the partial read/write
+ * cursor and the error paths, then per-command microbenchmarks checked
+ * against baselines.  Baselines come from the selftest_base_ns param;
+ * "record" stores the measured times there, and the proc file prints
+ * them as a modprobe option so they survive a reload.  A benchmark
+ * without a baseline is only reported.  Results are in
+ * /proc/admin_unit/selftest.  The core alone is covered by the KUnit
+ * suite in admin_unit_kunit.c.
+ */
+#define ADMIN_UNIT_ST_MAX_CASES	48
+#define ADMIN_UNIT_ST_ITERS	100
+
+enum admin_unit_bench_op {
+	BENCH_MODE_SET,
+	BENCH_MODE_GET,
+	BENCH_CTX_SZ_GET,
+	BENCH_CTX_RD_FULL,
+	BENCH_CTX_WR_FULL,
+	BENCH_MAX
+};
+
+static const char * const admin_unit_bench_name[BENCH_MAX] = {
+	[BENCH_MODE_SET]	= "mode_set",
+	[BENCH_MODE_GET]	= "mode_get",
+	[BENCH_CTX_SZ_GET]	= "ctx_sz_get",
+	[BENCH_CTX_RD_FULL]	= "ctx_rd_full",
+	[BENCH_CTX_WR_FULL]	= "ctx_wr_full",
+};
+
+/* ns per iteration, measured on this machine at the same fake_ctx_kb */
+static unsigned long selftest_base_ns[BENCH_MAX];
+module_param_array(selftest_base_ns, ulong, NULL, 0644);
+MODULE_PARM_DESC(selftest_base_ns,
+		 "Selftest baselines mode_set,mode_get,ctx_sz_get,ctx_rd_full,ctx_wr_full in ns (0: not checked)");
+
+struct admin_unit_st_case {
+	const char *name;
+	int ret;
+	bool pass;
+};
+
+struct admin_unit_selftest {
+	char src[16], dst[16];
+	int nr_cases;
+	int failed;
+	struct admin_unit_st_case cases[ADMIN_UNIT_ST_MAX_CASES];
+	u64 bench_ns[BENCH_MAX];
+};
+
+static struct admin_unit_selftest g_selftest;
+static DEFINE_MUTEX(admin_unit_st_lock);
+
+static void admin_unit_st_check(const char *name, bool pass, int ret)
+{
+	struct admin_unit_st_case *c;
+
+	if (!pass)
+		g_selftest.failed++;
+	if (g_selftest.nr_cases == ADMIN_UNIT_ST_MAX_CASES)
+		return;
+	c = &g_selftest.cases[g_selftest.nr_cases++];
+	c->name = name;
+	c->pass = pass;
+	c->ret = ret;
+}
+
+/* forget all saved and restored ctx of vf */
+static void admin_unit_st_reset_vf(struct admin_vf *vf)
+{
+	struct admin_unit_ctx *ctx, *restored;
+
+	mutex_lock(&vf->lock);
+	ctx = vf->ctx;
+	restored = vf->restored;
+	vf->ctx = NULL;
+	vf->restored = NULL;
+	admin_unit_cursor_init(&vf->cur, 0);
+	mutex_unlock(&vf->lock);
+
+	if (ctx) {
+		admin_unit_mem_uncharge(vf, admin_unit_ctx_charge(ctx));
+		admin_unit_ctx_free(ctx);
+	}
+	if (restored) {
+		atomic64_sub(restored->size, &g_mem.restored);
+		admin_unit_mem_uncharge(vf, admin_unit_ctx_charge(restored));
+		admin_unit_ctx_free(restored);
+	}
+}
+
+/*
+ * Pin the param overrides of a selftest VF to 0, so the run neither
+ * depends on how the module params are set nor changes them, or drop
+ * the overrides again.
+ */
+static void admin_unit_st_opts(struct admin_vf *vf, bool pin)
+{
+	int v = pin ? 0 : -1;
+
+	WRITE_ONCE(vf->opts.fake_fail_every, v);
+	WRITE_ONCE(vf->opts.mem_cap_kb, v);
+	WRITE_ONCE(vf->opts.ctx_dedup, v);
+	WRITE_ONCE(vf->opts.mig_verify, v);
+	WRITE_ONCE(vf->opts.mig_stream, v);
+	WRITE_ONCE(vf->opts.query_cache_ms, v);
+}
+
+static bool admin_unit_st_pattern_ok(struct admin_unit_ctx *ctx, u64 off, u64 len)
+{
+	u8 *p;
+
+	for (; len; off++, len--) {
+		p = page_address(ctx->pages[off >> PAGE_SHIFT]);
+		if (p[offset_in_page(off)] != admin_unit_fake_byte(off))
+			return false;
+	}
+	return true;
+}
+
+static void admin_unit_st_functional(struct admin_vf *src, struct admin_vf *dst)
+{
+	u64 size = (u64)fake_ctx_kb << 10;
+	struct admin_unit_pair_res res = {};
+	struct admin_unit_replay_tgt *tgt;
+	struct admin_unit_trace_buf *tb;
+	struct virtio_admin_cmd_dev_mode mode;
+	u64 bytes, cmds, hits;
+	bool ok;
+	char cmd[48];
+	int i, ret;
+
+	ret = admin_unit_cmd_list_query_proc(src);
+	admin_unit_st_check("list_query", !ret, ret);
+
+	ret = admin_unit_cmd_dev_mode_set_proc(src, VIRTIO_ADMIN_DEV_MODE_STOP);
+	admin_unit_st_check("mode_set",
+		!ret && src->fake.mode == VIRTIO_ADMIN_DEV_MODE_STOP, ret);
+	ret = admin_unit_cmd_dev_mode_get_proc(src);
+	admin_unit_st_check("mode_get", !ret, ret);
+	ret = admin_unit_cmd_dev_mode_set(src->pdev, 7);
+	admin_unit_st_check("mode_set invalid", ret == -EINVAL, ret);
+	ret = admin_unit_cmd_sprt_field_query_proc(src);
+	admin_unit_st_check("field_query", !ret, ret);
+
+	/* a repeated query is answered from the cache until a mode set */
+	WRITE_ONCE(src->opts.query_cache_ms, 60000);
+	admin_unit_query(src, ADMIN_UNIT_Q_MODE, (u8 *)&mode, sizeof(mode));
+	cmds = src->fake.cmds;
+	ret = admin_unit_query(src, ADMIN_UNIT_Q_MODE, (u8 *)&mode, sizeof(mode));
+	admin_unit_st_check("query cached",
+		!ret && src->fake.cmds == cmds &&
+		mode.mode == VIRTIO_ADMIN_DEV_MODE_STOP, ret);
+	admin_unit_cmd_dev_mode_set_proc(src, VIRTIO_ADMIN_DEV_MODE_FREEZE);
+	cmds = src->fake.cmds;
+	ret = admin_unit_query(src, ADMIN_UNIT_Q_MODE, (u8 *)&mode, sizeof(mode));
+	admin_unit_st_check("query invalidated",
+		!ret && src->fake.cmds == cmds + 1 &&
+		mode.mode == VIRTIO_ADMIN_DEV_MODE_FREEZE, ret);
+	WRITE_ONCE(src->opts.query_cache_ms, 0);
+
+	admin_unit_st_reset_vf(src);
+	ret = admin_unit_cmd_dev_ctx_sz_get_proc(src, 1);
+	admin_unit_st_check("ctx_sz_get",
+		!ret && src->cur.size == size && src->cur.left == size, ret);
+	ret = admin_unit_cmd_dev_ctx_rd_proc(src);
+	admin_unit_st_check("ctx_rd",
+		!ret && !src->cur.off && src->cur.left == size &&
+		admin_unit_st_pattern_ok(src->ctx, 0, size), ret);
+
+	/* partial reads move the cursor by the chunk size */
+	admin_unit_st_reset_vf(src);
+	ret = admin_unit_cmd_dev_ctx_sz_get_proc(src, 1);
+	for (i = 1, ok = !ret; ok && i <= 3; i++) {
+		ret = admin_unit_cmd_dev_ctx_rd_partial_proc(src, 1000, false);
+		ok = !ret && src->cur.off == i * 1000 &&
+		     src->cur.left == size - i * 1000;
+	}
+	admin_unit_st_check("ctx_rd partial cursor", ok, ret);
+	ret = admin_unit_cmd_dev_ctx_rd_partial_proc(src, 0, true);
+	admin_unit_st_check("ctx_rd partial left",
+		!ret && !src->cur.off && src->cur.left == size &&
+		admin_unit_st_pattern_ok(src->ctx, 0, size), ret);
+
+	/* restore, then restore again from the kept snapshot */
+	admin_unit_cmd_dev_mode_set_proc(dst, VIRTIO_ADMIN_DEV_MODE_FREEZE);
+	ret = admin_unit_cmd_dev_ctx_wr_proc(dst, src);
+	admin_unit_st_check("ctx_wr",
+		!ret && !src->ctx && src->restored && dst->fake.wr_off == size,
+		ret);
+	admin_unit_cmd_dev_mode_set_proc(dst, VIRTIO_ADMIN_DEV_MODE_FREEZE);
+	ret = admin_unit_cmd_dev_ctx_wr_proc(dst, src);
+	admin_unit_st_check("ctx_wr snapshot",
+		!ret && src->restored && dst->fake.wr_off == size, ret);
+
+	/* partial writes move the source cursor and the device offset */
+	admin_unit_st_reset_vf(src);
+	admin_unit_cmd_dev_ctx_sz_get_proc(src, 1);
+	admin_unit_cmd_dev_ctx_rd_proc(src);
+	admin_unit_cmd_dev_mode_set_proc(dst, VIRTIO_ADMIN_DEV_MODE_FREEZE);
+	for (i = 1, ok = !!src->ctx; ok && i <= 3; i++) {
+		ret = admin_unit_cmd_dev_ctx_wr_partial_proc(dst, src, 1000, false);
+		ok = !ret && src->cur.off == i * 1000 &&
+		     src->cur.left == size - i * 1000 &&
+		     dst->fake.wr_off == i * 1000;
+	}
+	admin_unit_st_check("ctx_wr partial cursor", ok, ret);
+	ret = admin_unit_cmd_dev_ctx_wr_partial_proc(dst, src, 0, true);
+	admin_unit_st_check("ctx_wr partial left",
+		!ret && !src->ctx && src->restored && dst->fake.wr_off == size,
+		ret);
+
+	/* error paths */
+	ret = admin_unit_cmd_dev_ctx_wr_proc(src, src);
+	admin_unit_st_check("ctx_wr same vf", ret == -EINVAL, ret);
+	admin_unit_st_reset_vf(src);
+	ret = admin_unit_cmd_dev_ctx_wr_proc(dst, src);
+	admin_unit_st_check("ctx_wr unsaved", ret == -EINVAL, ret);
+	ret = admin_unit_cmd_dev_ctx_wr_partial_proc(dst, src, 1000, false);
+	admin_unit_st_check("ctx_wr partial unsaved", ret == -EINVAL, ret);
+	ret = admin_unit_cmd_dev_ctx_rd_proc(src);
+	admin_unit_st_check("ctx_rd unsized", ret == -EINVAL, ret);
+	ret = admin_unit_cmd_dev_ctx_rd_partial_proc(src, 1000, false);
+	admin_unit_st_check("ctx_rd partial unsized", ret == -EINVAL, ret);
+	ret = admin_unit_cmd_dev_ctx_rd_proc(NULL);
+	admin_unit_st_check("ctx_rd no vf", ret == -ENODEV, ret);
+
+	admin_unit_cmd_dev_ctx_sz_get_proc(src, 1);
+	WRITE_ONCE(src->opts.fake_fail_every, 1);
+	ret = admin_unit_cmd_dev_ctx_rd_proc(src);
+	WRITE_ONCE(src->opts.fake_fail_every, 0);
+	admin_unit_st_check("ctx_rd device error", ret == -EIO, ret);
+
+	admin_unit_st_reset_vf(src);
+	admin_unit_cmd_dev_ctx_sz_get_proc(src, 1);
+	WRITE_ONCE(src->opts.mem_cap_kb, 1);
+	ret = admin_unit_cmd_dev_ctx_rd_proc(src);
+	WRITE_ONCE(src->opts.mem_cap_kb, 0);
+	admin_unit_st_check("ctx_rd over mem cap",
+		ret == -ENOSPC && !src->ctx, ret);
+
+	/* identical ctx of two VFs share pages, a new read unshares them */
+	admin_unit_st_reset_vf(src);
+	admin_unit_st_reset_vf(dst);
+	WRITE_ONCE(src->opts.ctx_dedup, 1);
+	WRITE_ONCE(dst->opts.ctx_dedup, 1);
+	admin_unit_cmd_dev_ctx_sz_get_proc(src, 1);
+	admin_unit_cmd_dev_ctx_rd_proc(src);
+	admin_unit_cmd_dev_ctx_sz_get_proc(dst, 1);
+	ret = admin_unit_cmd_dev_ctx_rd_proc(dst);
+	admin_unit_st_check("ctx dedup",
+		!ret && src->ctx && dst->ctx &&
+		dst->ctx->nr_shared == dst->ctx->nr_pages &&
+		dst->ctx->pages[0] == src->ctx->pages[0] &&
+		!atomic64_read(&src->mem) && !atomic64_read(&dst->mem), ret);
+	admin_unit_cmd_dev_ctx_sz_get_proc(src, 1);
+	ret = admin_unit_cmd_dev_ctx_rd_partial_proc(src, 1000, false);
+	admin_unit_st_check("ctx dedup cow",
+		!ret && src->ctx->pages[0] != dst->ctx->pages[0] &&
+		src->ctx->nr_shared == src->ctx->nr_pages - 1 &&
+		atomic64_read(&src->mem) ==
+			admin_unit_ctx_page_bytes(src->ctx, 0) &&
+		admin_unit_st_pattern_ok(src->ctx, 0, 1000) &&
+		admin_unit_st_pattern_ok(dst->ctx, 0, size), ret);
+	WRITE_ONCE(src->opts.ctx_dedup, 0);
+	WRITE_ONCE(dst->opts.ctx_dedup, 0);
+
+	/* streamed copy, the destination checks every byte and offset */
+	admin_unit_st_reset_vf(src);
+	admin_unit_st_reset_vf(dst);
+	admin_unit_cmd_dev_mode_set_proc(src, VIRTIO_ADMIN_DEV_MODE_FREEZE);
+	admin_unit_cmd_dev_mode_set_proc(dst, VIRTIO_ADMIN_DEV_MODE_FREEZE);
+	ret = admin_unit_stream_copy(src, dst, &bytes);
+	admin_unit_st_check("stream_copy",
+		!ret && bytes == size && dst->fake.wr_off == size &&
+		!src->ctx && !src->restored && !atomic64_read(&src->mem), ret);
+	admin_unit_cmd_dev_mode_set_proc(dst, VIRTIO_ADMIN_DEV_MODE_FREEZE);
+	/* one of the next two source commands fails */
+	WRITE_ONCE(src->opts.fake_fail_every, 2);
+	ret = admin_unit_stream_copy(src, dst, &bytes);
+	WRITE_ONCE(src->opts.fake_fail_every, 0);
+	admin_unit_st_check("stream_copy device error",
+		ret == -EIO && !atomic64_read(&src->mem), ret);
+	/* the ring does not fit under the cap */
+	WRITE_ONCE(src->opts.mem_cap_kb, 1);
+	ret = admin_unit_stream_copy(src, dst, &bytes);
+	WRITE_ONCE(src->opts.mem_cap_kb, 0);
+	admin_unit_st_check("stream_copy mem cap",
+		ret == -ENOSPC && !atomic64_read(&src->mem), ret);
+
+	/* full src -> dst migration, saved whole and streamed */
+	admin_unit_st_reset_vf(src);
+	admin_unit_st_reset_vf(dst);
+	WRITE_ONCE(src->opts.mig_verify, 1);
+	ret = admin_unit_mig_pair(src, dst, &res);
+	admin_unit_st_check("mig_pair",
+		!ret && res.bytes == size && res.downtime_ns > 0 &&
+		!res.diff_bytes, ret);
+	WRITE_ONCE(src->opts.mig_verify, 0);
+	/* the source of a mig_pair decides how it runs */
+	WRITE_ONCE(dst->opts.mig_verify, 1);
+	WRITE_ONCE(dst->opts.mig_stream, 1);
+	memset(&res, 0, sizeof(res));
+	ret = admin_unit_mig_pair(dst, src, &res);
+	WRITE_ONCE(dst->opts.mig_stream, 0);
+	WRITE_ONCE(dst->opts.mig_verify, 0);
+	admin_unit_st_check("mig_pair stream",
+		!ret && res.bytes == size && !res.diff_bytes &&
+		!dst->ctx, ret);
+
+	/* a failed restore resumes src and keeps its save for a retry */
+	admin_unit_st_reset_vf(src);
+	admin_unit_st_reset_vf(dst);
+	spin_lock(&dst->fake_lock);
+	dst->fake.cmds = 0;
+	spin_unlock(&dst->fake_lock);
+	/* stop and freeze of dst pass, its first ctx write fails */
+	WRITE_ONCE(dst->opts.fake_fail_every, 3);
+	memset(&res, 0, sizeof(res));
+	ret = admin_unit_mig_pair(src, dst, &res);
+	WRITE_ONCE(dst->opts.fake_fail_every, 0);
+	admin_unit_st_check("mig_pair failed write",
+		ret == -EIO && src->ctx && src->cur.left == size &&
+		src->fake.mode == VIRTIO_ADMIN_DEV_MODE_ACTIVE, ret);
+	admin_unit_cmd_dev_mode_set_proc(dst, VIRTIO_ADMIN_DEV_MODE_FREEZE);
+	ret = admin_unit_cmd_dev_ctx_wr_proc(dst, src);
+	admin_unit_st_check("mig_pair retry",
+		!ret && dst->fake.wr_off == size, ret);
+
+	snprintf(cmd, sizeof(cmd), "%s restored %s device", src->name, dst->name);
+	ret = admin_unit_diff_cmd(cmd);
+	admin_unit_st_check("ctx_diff",
+		!ret && !g_diff.bytes && g_diff.a_size == size, ret);
+
+	ret = admin_unit_cmd_discard_proc(src);
+	admin_unit_st_check("discard", !ret && !src->fake.rd_off, ret);
+
+	/* fan-out of a fresh save, then of the snapshot it keeps */
+	admin_unit_st_reset_vf(src);
+	admin_unit_st_reset_vf(dst);
+	admin_unit_cmd_dev_mode_set_proc(dst, VIRTIO_ADMIN_DEV_MODE_FREEZE);
+	snprintf(cmd, sizeof(cmd), "%s %s", src->name, dst->name);
+	ret = admin_unit_fanout_cmd(cmd);
+	mutex_lock(&admin_unit_fanout_lock);
+	ok = g_fanout.nr == 1 && g_fanout.rd_ns > 0 &&
+	     g_fanout.dst[0].bytes == size;
+	mutex_unlock(&admin_unit_fanout_lock);
+	admin_unit_st_check("fanout",
+		!ret && ok && dst->fake.wr_off == size && src->restored, ret);
+	admin_unit_cmd_dev_mode_set_proc(dst, VIRTIO_ADMIN_DEV_MODE_FREEZE);
+	snprintf(cmd, sizeof(cmd), "%s %s restored", src->name, dst->name);
+	ret = admin_unit_fanout_cmd(cmd);
+	mutex_lock(&admin_unit_fanout_lock);
+	ok = g_fanout.nr == 1 && !g_fanout.rd_ns;
+	mutex_unlock(&admin_unit_fanout_lock);
+	admin_unit_st_check("fanout snapshot",
+		!ret && ok && dst->fake.wr_off == size, ret);
+	/* not while a partial save is part way */
+	admin_unit_st_reset_vf(src);
+	admin_unit_cmd_dev_ctx_sz_get_proc(src, 1);
+	admin_unit_cmd_dev_ctx_rd_partial_proc(src, 1000, false);
+	snprintf(cmd, sizeof(cmd), "%s %s", src->name, dst->name);
+	ret = admin_unit_fanout_cmd(cmd);
+	admin_unit_st_check("fanout partial save",
+		ret == -EBUSY && src->ctx && src->cur.off == 1000, ret);
+
+	/* the pages of a freed ctx back the next save, unzeroed */
+	admin_unit_st_reset_vf(src);
+	admin_unit_cmd_dev_ctx_sz_get_proc(src, 1);
+	admin_unit_cmd_dev_ctx_rd_proc(src);
+	admin_unit_st_reset_vf(src);
+	spin_lock(&src->pf->pool.lock);
+	hits = src->pf->pool.hits;
+	spin_unlock(&src->pf->pool.lock);
+	admin_unit_cmd_dev_ctx_sz_get_proc(src, 1);
+	ret = admin_unit_cmd_dev_ctx_rd_proc(src);
+	spin_lock(&src->pf->pool.lock);
+	hits = src->pf->pool.hits - hits;
+	spin_unlock(&src->pf->pool.lock);
+	admin_unit_st_check("ctx pool",
+		!ret && src->ctx &&
+		(((u64)ctx_pool_kb << 10) < size ||
+		 hits == src->ctx->nr_pages) &&
+		admin_unit_st_pattern_ok(src->ctx, 0, size), ret);
+
+	/* a short soak of both VFs accounts every command it issued */
+	snprintf(cmd, sizeof(cmd), "2 1 %s,%s", src->name, dst->name);
+	ret = admin_unit_soak_cmd(cmd);
+	mutex_lock(&admin_unit_soak_lock);
+	for (i = 0, cmds = 0; i < SOAK_MAX; i++)
+		cmds += g_soak.op[i].hist.n;
+	ok = g_soak.ops && cmds == g_soak.ops;
+	mutex_unlock(&admin_unit_soak_lock);
+	admin_unit_st_check("soak", !ret && ok, ret);
+
+	/* a recorded save and restore replays with the recorded results */
+	admin_unit_st_reset_vf(src);
+	admin_unit_st_reset_vf(dst);
+	ret = admin_unit_trace_start("");
+	admin_unit_cmd_dev_ctx_sz_get_proc(src, 1);
+	admin_unit_cmd_dev_ctx_rd_proc(src);
+	admin_unit_cmd_dev_mode_set_proc(dst, VIRTIO_ADMIN_DEV_MODE_FREEZE);
+	admin_unit_cmd_dev_ctx_wr_proc(dst, src);
+	admin_unit_trace_stop();
+	tb = ret ? NULL : admin_unit_trace_snap();
+	tgt = kcalloc(ADMIN_UNIT_REPLAY_VFS, sizeof(*tgt), GFP_KERNEL);
+	ret = tb && tgt ? admin_unit_replay_run(tb, true, tgt, 0) : -ENOMEM;
+	mutex_lock(&admin_unit_replay_lock);
+	for (i = 0, cmds = 0; i < REPLAY_MAX; i++)
+		cmds += g_replay.op[i].status_diff;
+	ok = tb && g_replay.nr == tb->hdr.nr && !g_replay.skipped && !cmds &&
+	     g_replay.op[REPLAY_CTX_WR].nr;
+	mutex_unlock(&admin_unit_replay_lock);
+	kfree(tgt);
+	kvfree(tb);
+	admin_unit_st_check("trace replay", !ret && ok, ret);
+
+	admin_unit_st_check("sched idle",
+		!src->pf->sched.inflight && !src->pf->sched.depth, 0);
+
+	admin_unit_st_reset_vf(src);
+	admin_unit_st_reset_vf(dst);
+	admin_unit_cmd_dev_mode_set_proc(src, VIRTIO_ADMIN_DEV_MODE_ACTIVE);
+}
+
+/* ns per iteration of one command path, 0 on error */
+static u64 admin_unit_st_bench(struct admin_vf *src, struct admin_vf *dst,
+			       int op, struct admin_unit_ctx *ctx, u8 *buf)
+{
+	u64 size = (u64)fake_ctx_kb << 10;
+	ktime_t start;
+	int i, ret = 0;
+	u64 done;
+
+	start = ktime_get();
+	for (i = 0; !ret && i < ADMIN_UNIT_ST_ITERS; i++) {
+		switch (op) {
+		case BENCH_MODE_SET:
+			ret = admin_unit_cmd_dev_mode_set(src->pdev,
+					VIRTIO_ADMIN_DEV_MODE_STOP);
+			break;
+		case BENCH_MODE_GET:
+			ret = admin_unit_cmd_dev_mode_get(src->pdev, buf,
+					sizeof(struct virtio_admin_cmd_dev_mode));
+			break;
+		case BENCH_CTX_SZ_GET:
+			ret = admin_unit_cmd_dev_ctx_sz_get(src->pdev, 0, buf,
+				sizeof(struct virtio_admin_cmd_dev_ctx_size_get_result));
+			break;
+		case BENCH_CTX_RD_FULL:
+			ret = admin_unit_cmd_dev_ctx_sz_get(src->pdev, 0, buf,
+				sizeof(struct virtio_admin_cmd_dev_ctx_size_get_result));
+			if (!ret)
+				ret = admin_unit_ctx_xfer(src, ctx, 0, size,
+							  false, &done);
+			break;
+		case BENCH_CTX_WR_FULL:
+			ret = admin_unit_cmd_dev_mode_set(dst->pdev,
+					VIRTIO_ADMIN_DEV_MODE_FREEZE);
+			if (!ret)
+				ret = admin_unit_ctx_xfer(dst, ctx, 0, size,
+							  true, &done);
+			break;
+		}
+	}
+	if (ret)
+		return 0;
+	return div64_u64(ktime_to_ns(ktime_sub(ktime_get(), start)),
+			 ADMIN_UNIT_ST_ITERS);
+}
+
+static int admin_unit_selftest(const char *args)
+{
+	struct admin_vf *src, *dst;
+	struct admin_unit_ctx *ctx;
+	bool record;
+	u64 base;
+	u8 *buf;
+	int i, ret;
+
+	if (!READ_ONCE(fake_transport)) {
+		pr_err("selftest needs fake_transport=1\n");
+		return -EPERM;
+	}
+	ret = admin_unit_vf_pair_parse(args, &src, &dst);
+	if (ret)
+		return ret;
+	if (src == dst)
+		return -EINVAL;
+	record = strstr(args, "record");
+
+	ctx = admin_unit_ctx_alloc(src->pf, (u64)fake_ctx_kb << 10, true);
+	buf = kzalloc(PAGE_SIZE, GFP_KERNEL);
+	if (!ctx || !buf) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	mutex_lock(&admin_unit_st_lock);
+	strscpy(g_selftest.src, src->name, sizeof(g_selftest.src));
+	strscpy(g_selftest.dst, dst->name, sizeof(g_selftest.dst));
+	g_selftest.nr_cases = 0;
+	g_selftest.failed = 0;
+	admin_unit_st_opts(src, true);
+	admin_unit_st_opts(dst, true);
+
+	admin_unit_st_functional(src, dst);
+
+	for (i = 0; i < BENCH_MAX; i++) {
+		g_selftest.bench_ns[i] = admin_unit_st_bench(src, dst, i, ctx, buf);
+		if (record && g_selftest.bench_ns[i])
+			WRITE_ONCE(selftest_base_ns[i], g_selftest.bench_ns[i]);
+		base = READ_ONCE(selftest_base_ns[i]);
+		admin_unit_st_check(admin_unit_bench_name[i],
+				    g_selftest.bench_ns[i] &&
+				    (!base || g_selftest.bench_ns[i] <=
+				     div_u64(base * (100 + selftest_slack_pct), 100)),
+				    0);
+	}
+	admin_unit_cmd_dev_mode_set(src->pdev, VIRTIO_ADMIN_DEV_MODE_ACTIVE);
+	admin_unit_cmd_dev_mode_set(dst->pdev, VIRTIO_ADMIN_DEV_MODE_ACTIVE);
+	admin_unit_st_opts(src, false);
+	admin_unit_st_opts(dst, false);
+
+	ret = g_selftest.failed ? -EIO : 0;
+	pr_err("selftest vf %s -> vf %s: %d of %d checks failed\n",
+		src->name, dst->name, g_selftest.failed, g_selftest.nr_cases);
+	mutex_unlock(&admin_unit_st_lock);
+out:
+	kfree(buf);
+	admin_unit_ctx_free(ctx);
+	return ret;
+}
+
+static int admin_unit_selftest_proc_show(struct seq_file *m, void *v)
+{
+	struct admin_unit_st_case *c;
+	int i;
+
+	mutex_lock(&admin_unit_st_lock);
+	seq_printf(m, "transport %s ctx %u KB src %s dst %s failed %d/%d\n",
+		   admin_unit_transport_get()->name, fake_ctx_kb,
+		   g_selftest.src, g_selftest.dst, g_selftest.failed,
+		   g_selftest.nr_cases);
+	for (i = 0; i < g_selftest.nr_cases; i++) {
+		c = &g_selftest.cases[i];
+		seq_printf(m, "  %-4s %-24s ret %d\n", c->pass ? "ok" : "FAIL",
+			   c->name, c->ret);
+	}
+	for (i = 0; i < BENCH_MAX; i++)
+		seq_printf(m, "  bench %-12s ns %llu base %lu slack %u%%\n",
+			   admin_unit_bench_name[i], g_selftest.bench_ns[i],
+			   READ_ONCE(selftest_base_ns[i]), selftest_slack_pct);
+	/* to keep the baselines, e.g. in /etc/modprobe.d */
+	seq_printf(m, "options admin_unit_test fake_ctx_kb=%u selftest_base_ns=",
+		   fake_ctx_kb);
+	for (i = 0; i < BENCH_MAX; i++)
+		seq_printf(m, "%lu%c", READ_ONCE(selftest_base_ns[i]),
+			   i == BENCH_MAX - 1 ? '\n' : ',');
+	mutex_unlock(&admin_unit_st_lock);
+	return 0;
+}
+
+static int admin_unit_selftest_proc_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, admin_unit_selftest_proc_show, NULL);
+}
+
+static const struct proc_ops admin_unit_selftest_proc_fops = {
+	.proc_open	= admin_unit_selftest_proc_open,
+	.proc_read	= seq_read,
+	.proc_lseek	= seq_lseek,
+	.proc_release	= single_release,
+};
+
+/*
+ * /proc/admin_unit/ctx renders a saved ctx only when it is read, as
+ * selected by "ctx_view <vf> [restored] <off> <len>" (hex, 16 bytes a
+ * line) or "ctx_view <vf> [restored] fields" (one line per TLV field,
+ * with its CRC32).  The ctx read path itself does no formatting.
+ */
+#define ADMIN_UNIT_VIEW_LINE	16
+
+struct admin_unit_view {
+	bool set;
+	bool restored;
+	bool fields;
+	u32 vf_id;
+	u64 off;
+	u64 len;
+};
+
+static struct admin_unit_view g_view;
+static DEFINE_MUTEX(admin_unit_view_lock);
+
+/* per open file; vf->lock is held from start to stop */
+struct admin_unit_view_iter {
+	struct admin_unit_view v;
+	int srcu_idx;
+	struct admin_vf *vf;
+	struct admin_unit_ctx *ctx;
+	/* hex: offset of the current line */
+	u64 line_off;
+	/* fields: count, index and header offset of the current field */
+	u32 nr_fields;
+	loff_t field_idx;
+	u64 field_pos;
+	struct admin_unit_tlv f;
+};
+
+static int admin_unit_view_set(const char *args)
+{
+	struct admin_unit_view v = { .set = true };
+	char t[4][24] = {};
+	struct admin_vf *vf;
+	int n, i = 1;
+
+	n = sscanf(args, "%23s %23s %23s %23s", t[0], t[1], t[2], t[3]);
+	if (n < 2)
+		return -EINVAL;
+	vf = admin_unit_vf_parse(t[0]);
+	if (!vf)
+		return -ENODEV;
+	v.vf_id = vf->id;
+
+	if (!strcmp(t[i], "restored")) {
+		v.restored = true;
+		i++;
+	}
+	if (!strcmp(t[i], "fields"))
+		v.fields = true;
+	else if (kstrtou64(t[i], 0, &v.off) || kstrtou64(t[i + 1], 0, &v.len))
+		return -EINVAL;
+
+	mutex_lock(&admin_unit_view_lock);
+	g_view = v;
+	mutex_unlock(&admin_unit_view_lock);
+	return 0;
+}
+
+/* position the iterator at line or field pos - 1, false past the end */
+static bool admin_unit_view_seek(struct admin_unit_view_iter *it, loff_t pos)
+{
+	struct admin_unit_ctx *ctx = it->ctx;
+	u64 end;
+
+	if (!it->v.fields) {
+		end = min(it->v.off + it->v.len, ctx->size);
+		it->line_off = it->v.off + (pos - 1) * ADMIN_UNIT_VIEW_LINE;
+		return it->line_off < end;
+	}
+
+	if (pos - 1 >= it->nr_fields)
+		return false;
+	/* sequential reads continue from the last field */
+	if (pos - 1 < it->field_idx || !it->field_idx) {
+		it->field_idx = 0;
+		it->field_pos = ADMIN_UNIT_CTX_HDR_SZ;
+		if (admin_unit_ctx_field(ctx, it->field_pos, &it->f))
+			return false;
+	}
+	while (it->field_idx < pos - 1) {
+		it->field_pos = it->f.off + it->f.len;
+		if (admin_unit_ctx_field(ctx, it->field_pos, &it->f))
+			return false;
+		it->field_idx++;
+	}
+	return true;
+}
+
+static void *admin_unit_view_start(struct seq_file *m, loff_t *pos)
+{
+	struct admin_unit_view_iter *it = m->private;
+	u8 hdr[ADMIN_UNIT_CTX_HDR_SZ];
+
+	it->srcu_idx = srcu_read_lock(&admin_unit_srcu);
+	it->vf = it->v.set ? admin_unit_vf_get(it->v.vf_id) : NULL;
+	if (!it->vf)
+		return NULL;
+
+	mutex_lock(&it->vf->lock);
+	it->ctx = it->v.restored ? it->vf->restored : it->vf->ctx;
+	if (!it->ctx)
+		return NULL;
+	it->nr_fields = 0;
+	if (it->ctx->size >= sizeof(hdr)) {
+		admin_unit_ctx_copy(it->ctx, 0, hdr, sizeof(hdr));
+		it->nr_fields = admin_unit_core_le32(hdr);
+	}
+	if (!*pos)
+		return SEQ_START_TOKEN;
+	return admin_unit_view_seek(it, *pos) ? it : NULL;
+}
+
+static void *admin_unit_view_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	struct admin_unit_view_iter *it = m->private;
+
+	++*pos;
+	return admin_unit_view_seek(it, *pos) ? it : NULL;
+}
+
+static void admin_unit_view_stop(struct seq_file *m, void *v)
+{
+	struct admin_unit_view_iter *it = m->private;
+
+	if (it->vf)
+		mutex_unlock(&it->vf->lock);
+	it->vf = NULL;
+	srcu_read_unlock(&admin_unit_srcu, it->srcu_idx);
+}
+
+static int admin_unit_view_show(struct seq_file *m, void *v)
+{
+	struct admin_unit_view_iter *it = m->private;
+	struct admin_unit_ctx *ctx = it->ctx;
+	u8 line[ADMIN_UNIT_VIEW_LINE];
+	u32 n;
+
+	if (v == SEQ_START_TOKEN) {
+		seq_printf(m, "vf %s %s size %llu", it->vf->name,
+			   it->v.restored ? "restored" : "saved", ctx->size);
+		if (it->v.fields) {
+			seq_printf(m, " fields %u crc32 %08x", it->nr_fields,
+				   admin_unit_ctx_crc(ctx, 0, ctx->size));
+		} else {
+			seq_printf(m, " off %#llx len %#llx", it->v.off,
+				   it->v.len);
+		}
+		seq_putc(m, '\n');
+		return 0;
+	}
+
+	if (it->v.fields) {
+		seq_printf(m, "field %lld type %#x off %#llx len %llu crc32 %08x\n",
+			   it->field_idx, it->f.type, it->f.off, it->f.len,
+			   admin_unit_ctx_crc(ctx, it->f.off, it->f.len));
+		return 0;
+	}
+
+	n = min_t(u64, ADMIN_UNIT_VIEW_LINE,
+		  min(it->v.off + it->v.len, ctx->size) - it->line_off);
+	admin_unit_ctx_copy(ctx, it->line_off, line, n);
+	seq_printf(m, "%08llx: %*ph\n", it->line_off, n, line);
+	return 0;
+}
+
+static const struct seq_operations admin_unit_view_seq_ops = {
+	.start	= admin_unit_view_start,
+	.next	= admin_unit_view_next,
+	.stop	= admin_unit_view_stop,
+	.show	= admin_unit_view_show,
+};
+
+static int admin_unit_view_proc_open(struct inode *inode, struct file *file)
+{
+	struct admin_unit_view_iter *it;
+
+	it = __seq_open_private(file, &admin_unit_view_seq_ops, sizeof(*it));
+	if (!it)
+		return -ENOMEM;
+
+	mutex_lock(&admin_unit_view_lock);
+	it->v = g_view;
+	mutex_unlock(&admin_unit_view_lock);
+	return 0;
+}
+
+static const struct proc_ops admin_unit_view_proc_fops = {
+	.proc_open	= admin_unit_view_proc_open,
+	.proc_read	= seq_read,
+	.proc_lseek	= seq_lseek,
+	.proc_release	= seq_release_private,
+};
+
+static int admin_unit_cmd_process(const char *buf, int len)
+{
+	struct admin_vf *src, *dst;
+	int ret = 0;
+
+	if (!strncmp(buf, ADMIN_CMD_LIST_USE, strlen(ADMIN_CMD_LIST_USE))) {
+		pr_err("%s:%d: list_use %s\n",__func__, __LINE__, buf);
+		//TOOD
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_LIST_QUERY, strlen(ADMIN_CMD_LIST_QUERY))) {
+		ret = admin_unit_cmd_list_query_proc(admin_unit_vf_get(ADMIN_UNIT_LEGACY_VF0));
+		if(ret)
+			pr_err("Failed to run list query %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_DEV_MODE_GET_VF0, strlen(ADMIN_CMD_DEV_MODE_GET_VF0))) {
+		ret = admin_unit_cmd_dev_mode_get_proc(admin_unit_vf_get(ADMIN_UNIT_LEGACY_VF0));
+		if(ret)
+			pr_err("Failed to run list query %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_DEV_MODE_GET_VF1, strlen(ADMIN_CMD_DEV_MODE_GET_VF1))) {
+		ret = admin_unit_cmd_dev_mode_get_proc(admin_unit_vf_get(ADMIN_UNIT_LEGACY_VF1));
+		if(ret)
+			pr_err("Failed to run list query %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_DEV_MODE_SET_VF0_ACTIVE, strlen(ADMIN_CMD_DEV_MODE_SET_VF0_ACTIVE))) {
+		ret = admin_unit_cmd_dev_mode_set_proc(admin_unit_vf_get(ADMIN_UNIT_LEGACY_VF0), VIRTIO_ADMIN_DEV_MODE_ACTIVE);
+		if(ret)
+			pr_err("Failed to run list query %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_DEV_MODE_SET_VF0_STOP, strlen(ADMIN_CMD_DEV_MODE_SET_VF0_STOP))) {
+		ret = admin_unit_cmd_dev_mode_set_proc(admin_unit_vf_get(ADMIN_UNIT_LEGACY_VF0), VIRTIO_ADMIN_DEV_MODE_STOP);
+		if(ret)
+			pr_err("Failed to run list query %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_DEV_MODE_SET_VF0_FREEZE, strlen(ADMIN_CMD_DEV_MODE_SET_VF0_FREEZE))) {
+		ret = admin_unit_cmd_dev_mode_set_proc(admin_unit_vf_get(ADMIN_UNIT_LEGACY_VF0), VIRTIO_ADMIN_DEV_MODE_FREEZE);
+		if(ret)
+			pr_err("Failed to run list query %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_DEV_MODE_SET_VF1_ACTIVE, strlen(ADMIN_CMD_DEV_MODE_SET_VF1_ACTIVE))) {
+		ret = admin_unit_cmd_dev_mode_set_proc(admin_unit_vf_get(ADMIN_UNIT_LEGACY_VF1), VIRTIO_ADMIN_DEV_MODE_ACTIVE);
+		if(ret)
+			pr_err("Failed to run list query %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_DEV_MODE_SET_VF1_STOP, strlen(ADMIN_CMD_DEV_MODE_SET_VF1_STOP))) {
+		ret = admin_unit_cmd_dev_mode_set_proc(admin_unit_vf_get(ADMIN_UNIT_LEGACY_VF1), VIRTIO_ADMIN_DEV_MODE_STOP);
+		if(ret)
+			pr_err("Failed to run list query %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_DEV_MODE_SET_VF1_FREEZE, strlen(ADMIN_CMD_DEV_MODE_SET_VF1_FREEZE))) {
+		ret = admin_unit_cmd_dev_mode_set_proc(admin_unit_vf_get(ADMIN_UNIT_LEGACY_VF1), VIRTIO_ADMIN_DEV_MODE_FREEZE);
+		if(ret)
+			pr_err("Failed to run list query %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_DEV_CTX_SZ_GET_VF0_NOFREEZE, strlen(ADMIN_CMD_DEV_CTX_SZ_GET_VF0_NOFREEZE))) {
+		ret = admin_unit_cmd_dev_ctx_sz_get_proc(admin_unit_vf_get(ADMIN_UNIT_LEGACY_VF0), 0);
+		if(ret)
+			pr_err("Failed to run list query %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_DEV_CTX_SZ_GET_VF0_FREEZE, strlen(ADMIN_CMD_DEV_CTX_SZ_GET_VF0_FREEZE))) {
+		ret = admin_unit_cmd_dev_ctx_sz_get_proc(admin_unit_vf_get(ADMIN_UNIT_LEGACY_VF0), 1);
+		if(ret)
+			pr_err("Failed to run list query %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_DEV_CTX_SZ_GET_VF1_NOFREEZE, strlen(ADMIN_CMD_DEV_CTX_SZ_GET_VF1_NOFREEZE))) {
+		ret = admin_unit_cmd_dev_ctx_sz_get_proc(admin_unit_vf_get(ADMIN_UNIT_LEGACY_VF1), 0);
+		if(ret)
+			pr_err("Failed to run list query %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_DEV_CTX_SZ_GET_VF1_FREEZE, strlen(ADMIN_CMD_DEV_CTX_SZ_GET_VF1_FREEZE))) {
+		ret = admin_unit_cmd_dev_ctx_sz_get_proc(admin_unit_vf_get(ADMIN_UNIT_LEGACY_VF1), 1);
+		if(ret)
+			pr_err("Failed to run list query %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_DEV_CTX_RD_VF0, strlen(ADMIN_CMD_DEV_CTX_RD_VF0))) {
+		ret = admin_unit_cmd_dev_ctx_rd_proc(admin_unit_vf_get(ADMIN_UNIT_LEGACY_VF0));
+		if(ret)
+			pr_err("Failed to run list query %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_DEV_CTX_RD_VF1, strlen(ADMIN_CMD_DEV_CTX_RD_VF1))) {
+		ret = admin_unit_cmd_dev_ctx_rd_proc(admin_unit_vf_get(ADMIN_UNIT_LEGACY_VF1));
+		if(ret)
+			pr_err("Failed to run list query %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_DEV_CTX_RD_200B_VF0, strlen(ADMIN_CMD_DEV_CTX_RD_200B_VF0))) {
+		ret = admin_unit_cmd_dev_ctx_rd_partial_proc(admin_unit_vf_get(ADMIN_UNIT_LEGACY_VF0), ADMIN_UNIT_CHUNK_AUTO, false);
+		if(ret)
+			pr_err("Failed to run list query %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_DEV_CTX_RD_200B_VF1, strlen(ADMIN_CMD_DEV_CTX_RD_200B_VF1))) {
+		ret = admin_unit_cmd_dev_ctx_rd_partial_proc(admin_unit_vf_get(ADMIN_UNIT_LEGACY_VF1), ADMIN_UNIT_CHUNK_AUTO, false);
+		if(ret)
+			pr_err("Failed to run list query %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_DEV_CTX_RD_LEFT_VF0, strlen(ADMIN_CMD_DEV_CTX_RD_LEFT_VF0))) {
+		ret = admin_unit_cmd_dev_ctx_rd_partial_proc(admin_unit_vf_get(ADMIN_UNIT_LEGACY_VF0), ADMIN_UNIT_CHUNK_AUTO, true);
+		if(ret)
+			pr_err("Failed to run rd 200 on vf0 %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_DEV_CTX_RD_LEFT_VF1, strlen(ADMIN_CMD_DEV_CTX_RD_LEFT_VF1))) {
+		ret = admin_unit_cmd_dev_ctx_rd_partial_proc(admin_unit_vf_get(ADMIN_UNIT_LEGACY_VF1), ADMIN_UNIT_CHUNK_AUTO, true);
+		if(ret)
+			pr_err("Failed to run rd 200 on vf1 %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_DEV_CTX_WR_VF0, strlen(ADMIN_CMD_DEV_CTX_WR_VF0))) {
+		ret = admin_unit_cmd_dev_ctx_wr_proc(admin_unit_vf_get(ADMIN_UNIT_LEGACY_VF0), admin_unit_vf_get(ADMIN_UNIT_LEGACY_VF1));
+		if(ret)
+			pr_err("Failed to run rd left on vf0 %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_DEV_CTX_WR_VF1, strlen(ADMIN_CMD_DEV_CTX_WR_VF1))) {
+		ret = admin_unit_cmd_dev_ctx_wr_proc(admin_unit_vf_get(ADMIN_UNIT_LEGACY_VF1), admin_unit_vf_get(ADMIN_UNIT_LEGACY_VF0));
+		if(ret)
+			pr_err("Failed to run rd left on vf1 %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_DEV_CTX_WR_200B_VF0, strlen(ADMIN_CMD_DEV_CTX_WR_200B_VF0))) {
+		ret = admin_unit_cmd_dev_ctx_wr_partial_proc(admin_unit_vf_get(ADMIN_UNIT_LEGACY_VF0), admin_unit_vf_get(ADMIN_UNIT_LEGACY_VF1), ADMIN_UNIT_CHUNK_AUTO, false);
+		if(ret)
+			pr_err("Failed to run wr 200B on vf0 %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_DEV_CTX_WR_200B_VF1, strlen(ADMIN_CMD_DEV_CTX_WR_200B_VF1))) {
+		ret = admin_unit_cmd_dev_ctx_wr_partial_proc(admin_unit_vf_get(ADMIN_UNIT_LEGACY_VF1), admin_unit_vf_get(ADMIN_UNIT_LEGACY_VF0), ADMIN_UNIT_CHUNK_AUTO, false);
+		if(ret)
+			pr_err("Failed to run wr 200B on vf1 %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_DEV_CTX_WR_LEFT_VF0, strlen(ADMIN_CMD_DEV_CTX_WR_LEFT_VF0))) {
+		ret = admin_unit_cmd_dev_ctx_wr_partial_proc(admin_unit_vf_get(ADMIN_UNIT_LEGACY_VF0), admin_unit_vf_get(ADMIN_UNIT_LEGACY_VF1), ADMIN_UNIT_CHUNK_AUTO, true);
+		if(ret)
+			pr_err("Failed to run wr left on vf0 %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_DEV_CTX_WR_LEFT_VF1, strlen(ADMIN_CMD_DEV_CTX_WR_LEFT_VF1))) {
+		ret = admin_unit_cmd_dev_ctx_wr_partial_proc(admin_unit_vf_get(ADMIN_UNIT_LEGACY_VF1), admin_unit_vf_get(ADMIN_UNIT_LEGACY_VF0), ADMIN_UNIT_CHUNK_AUTO, true);
+		if(ret)
+			pr_err("Failed to run wr left on vf1 %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_FIELDS_QUERY_VF0, strlen(ADMIN_CMD_FIELDS_QUERY_VF0))) {
+		ret = admin_unit_cmd_sprt_field_query_proc(admin_unit_vf_get(ADMIN_UNIT_LEGACY_VF0));
+		if(ret)
+			pr_err("Failed to supported fld query %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_FIELDS_QUERY_VF1, strlen(ADMIN_CMD_FIELDS_QUERY_VF1))) {
+		ret = admin_unit_cmd_sprt_field_query_proc(admin_unit_vf_get(ADMIN_UNIT_LEGACY_VF1));
+		if(ret)
+			pr_err("Failed to supported fld query %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_DISCARD_VF0, strlen(ADMIN_CMD_DISCARD_VF0))) {
+		ret = admin_unit_cmd_discard_proc(admin_unit_vf_get(ADMIN_UNIT_LEGACY_VF0));
+		if(ret)
+			pr_err("Failed to discard %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_DISCARD_VF1, strlen(ADMIN_CMD_DISCARD_VF1))) {
+		ret = admin_unit_cmd_discard_proc(admin_unit_vf_get(ADMIN_UNIT_LEGACY_VF1));
+		if(ret)
+			pr_err("Failed to discard %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_DEV_CTX_WR_PAIR_200B, strlen(ADMIN_CMD_DEV_CTX_WR_PAIR_200B))) {
+		ret = admin_unit_vf_pair_parse(buf + strlen(ADMIN_CMD_DEV_CTX_WR_PAIR_200B), &src, &dst);
+		if (ret)
+			return ret;
+		ret = admin_unit_cmd_dev_ctx_wr_partial_proc(dst, src, ADMIN_UNIT_CHUNK_AUTO, false);
+		if(ret)
+			pr_err("Failed to run wr 200B vf %s -> vf %s %d", src->name, dst->name, ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_DEV_CTX_WR_PAIR_LEFT, strlen(ADMIN_CMD_DEV_CTX_WR_PAIR_LEFT))) {
+		ret = admin_unit_vf_pair_parse(buf + strlen(ADMIN_CMD_DEV_CTX_WR_PAIR_LEFT), &src, &dst);
+		if (ret)
+			return ret;
+		ret = admin_unit_cmd_dev_ctx_wr_partial_proc(dst, src, ADMIN_UNIT_CHUNK_AUTO, true);
+		if(ret)
+			pr_err("Failed to run wr left vf %s -> vf %s %d", src->name, dst->name, ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_DEV_CTX_WR_PAIR, strlen(ADMIN_CMD_DEV_CTX_WR_PAIR))) {
+		ret = admin_unit_vf_pair_parse(buf + strlen(ADMIN_CMD_DEV_CTX_WR_PAIR), &src, &dst);
+		if (ret)
+			return ret;
+		ret = admin_unit_cmd_dev_ctx_wr_proc(dst, src);
+		if(ret)
+			pr_err("Failed to run wr vf %s -> vf %s %d", src->name, dst->name, ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_VF, strlen(ADMIN_CMD_VF))) {
+		ret = admin_unit_vf_cmd_process(buf + strlen(ADMIN_CMD_VF));
+		if(ret)
+			pr_err("Failed to run vf cmd %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_MIG_PAIRS, strlen(ADMIN_CMD_MIG_PAIRS))) {
+		ret = admin_unit_mig_pairs_parse(buf + strlen(ADMIN_CMD_MIG_PAIRS));
+		if(ret)
+			pr_err("Failed to run mig pairs %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_MIG_TIMELINE_RESET, strlen(ADMIN_CMD_MIG_TIMELINE_RESET))) {
+		admin_unit_tl_reset();
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_STREAM_COPY, strlen(ADMIN_CMD_STREAM_COPY))) {
+		u64 bytes;
+
+		ret = admin_unit_vf_pair_parse(buf + strlen(ADMIN_CMD_STREAM_COPY), &src, &dst);
+		if (ret)
+			return ret;
+		ret = admin_unit_stream_copy(src, dst, &bytes);
+		if(ret)
+			pr_err("Failed to stream vf %s -> vf %s %d", src->name, dst->name, ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_FANOUT, strlen(ADMIN_CMD_FANOUT))) {
+		ret = admin_unit_fanout_cmd(buf + strlen(ADMIN_CMD_FANOUT));
+		if(ret)
+			pr_err("Failed to fan out ctx %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_CTX_DIFF, strlen(ADMIN_CMD_CTX_DIFF))) {
+		ret = admin_unit_diff_cmd(buf + strlen(ADMIN_CMD_CTX_DIFF));
+		if(ret)
+			pr_err("Failed to diff ctx %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_CTX_VIEW, strlen(ADMIN_CMD_CTX_VIEW))) {
+		ret = admin_unit_view_set(buf + strlen(ADMIN_CMD_CTX_VIEW));
+		if(ret)
+			pr_err("Failed to set ctx view %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_SELFTEST, strlen(ADMIN_CMD_SELFTEST))) {
+		ret = admin_unit_selftest(buf + strlen(ADMIN_CMD_SELFTEST));
+		if(ret)
+			pr_err("Failed to run selftest %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_SOAK, strlen(ADMIN_CMD_SOAK))) {
+		ret = admin_unit_soak_cmd(buf + strlen(ADMIN_CMD_SOAK));
+		if(ret)
+			pr_err("Failed to run soak %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_TRACE_START, strlen(ADMIN_CMD_TRACE_START))) {
+		ret = admin_unit_trace_start(buf + strlen(ADMIN_CMD_TRACE_START));
+		if(ret)
+			pr_err("Failed to start trace %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_TRACE_STOP, strlen(ADMIN_CMD_TRACE_STOP))) {
+		admin_unit_trace_stop();
+		return 0;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_TRACE_REPLAY, strlen(ADMIN_CMD_TRACE_REPLAY))) {
+		ret = admin_unit_replay_cmd(buf + strlen(ADMIN_CMD_TRACE_REPLAY));
+		if(ret)
+			pr_err("Failed to replay trace %d", ret);
+		return ret;
+	}
+
+	if (!strncmp(buf, ADMIN_CMD_CHUNK_TUNE, strlen(ADMIN_CMD_CHUNK_TUNE))) {
+		ret = admin_unit_chunk_tune(admin_unit_vf_parse(skip_spaces(buf + strlen(ADMIN_CMD_CHUNK_TUNE))));
+		if(ret)
+			pr_err("Failed to run chunk tune %d", ret);
+		return ret;
+	}
+
+	pr_err("Unknow admin cmd %s \n", buf);
+	return -EINVAL;
+}
+
+static ssize_t admin_unit_cmd_proc_write(struct file *file,
+		const char __user *buffer, size_t count, loff_t *pos)
+{
+	char *buf;
+	int idx, ret;
+
+	buf = memdup_user_nul(buffer, count);
+	if (IS_ERR(buf))
+		return PTR_ERR(buf);
+
+	idx = srcu_read_lock(&admin_unit_srcu);
+	ret = admin_unit_cmd_process(buf, count);
+	srcu_read_unlock(&admin_unit_srcu, idx);
+	if(ret)
+		pr_err("%s,%d: process cmd(%s) failed %d\n",
+			__func__, __LINE__, buf, ret);
+
+	kfree(buf);
+	return count;
+}
+
+static const struct proc_ops admin_unit_cmd_proc_fops = {
+	.proc_open	= admin_unit_cmd_proc_open,
+	.proc_read	= seq_read,
+	.proc_write	= admin_unit_cmd_proc_write,
+	.proc_lseek	= seq_lseek,
+	.proc_release	= single_release,
+};
+
+/* the /proc function: allocate everything to allow concurrency */
+static int jit_timer_proc_show(struct seq_file *m, void *v)
+{
+    return 0;
+}
+
+static int jit_timer_proc_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, jit_timer_proc_show, NULL);
+}
+
+static const struct proc_ops jit_timer_proc_fops = {
+	.proc_open	= jit_timer_proc_open,
+	.proc_read	= seq_read,
+	.proc_lseek	= seq_lseek,
+	.proc_release	= single_release,
+};
+
+
+static int admin_unit_devices_proc_show(struct seq_file *m, void *v)
+{
+	unsigned long pi, vi;
+	struct admin_pf *pf;
+	struct admin_vf *vf;
+	int nr;
+
+	mutex_lock(&admin_unit_dev_lock);
+	xa_for_each(&g_dev_mgr.pfs, pi, pf) {
+		nr = 0;
+		xa_for_each(&pf->vfs, vi, vf)
+			nr++;
+		seq_printf(m, "pf %d %s num_vfs %d active %d\n", pf->idx,
+			   pci_name(pf->pdev), pci_num_vf(pf->pdev), nr);
+		xa_for_each(&pf->vfs, vi, vf)
+			seq_printf(m, "  vf %s %s mem %lld\n", vf->name,
+				   pci_name(vf->pdev),
+				   atomic64_read(&vf->mem));
+	}
+	mutex_unlock(&admin_unit_dev_lock);
+	return 0;
+}
+
+static int admin_unit_devices_proc_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, admin_unit_devices_proc_show, NULL);
+}
+
+static const struct proc_ops admin_unit_devices_proc_fops = {
+	.proc_open	= admin_unit_devices_proc_open,
+	.proc_read	= seq_read,
+	.proc_lseek	= seq_lseek,
+	.proc_release	= single_release,
+};
+
+static int admin_unit_stats_proc_show(struct seq_file *m, void *v)
+{
+	struct admin_unit_chunk_res *r;
+	struct admin_unit_prio_stats *ps;
+	s64 dpages, dunique;
+	struct admin_pf *pf;
+	unsigned long pi;
+	u64 ratio;
+	int i, idx;
+	u32 rem;
+
+	seq_printf(m, "mem total %lld cap %llu restored %lld pooled %lld reclaimed %lld cap_fails %lld\n",
+		   atomic64_read(&g_mem.total), (u64)mem_cap_kb << 10,
+		   atomic64_read(&g_mem.restored),
+		   atomic64_read(&g_mem.pooled),
+		   atomic64_read(&g_mem.reclaimed),
+		   atomic64_read(&g_mem.cap_fails));
+	seq_printf(m, "query cmds %lld cached %lld shared %lld invalidated %lld\n",
+		   atomic64_read(&g_query.cmds),
+		   atomic64_read(&g_query.cached),
+		   atomic64_read(&g_query.shared),
+		   atomic64_read(&g_query.invalidated));
+	spin_lock(&admin_unit_trace_lock);
+	seq_printf(m, "trace on %d recorded %llu size %u\n",
+		   g_trace.on, g_trace.total, g_trace.size);
+	spin_unlock(&admin_unit_trace_lock);
+	dpages = atomic64_read(&g_mem.dedup_pages);
+	dunique = atomic64_read(&g_mem.dedup_unique);
+	/* logical pages per distinct page, in hundredths */
+	ratio = dunique > 0 ? div64_u64(dpages * 100, dunique) : 100;
+	ratio = div_u64_rem(ratio, 100, &rem);
+	seq_printf(m, "dedup pages %lld unique %lld saved_bytes %lld ratio %llu.%02u\n",
+		   dpages, dunique, (dpages - dunique) * PAGE_SIZE, ratio, rem);
+
+	idx = srcu_read_lock(&admin_unit_srcu);
+	xa_for_each(&g_dev_mgr.pfs, pi, pf) {
+		seq_printf(m, "pf %d %s node %d\n", pf->idx,
+			   pci_name(pf->pdev), pf->node);
+		seq_printf(m, "  numa local_bytes %lld remote_bytes %lld remote_cmds %lld remote_allocs %lld\n",
+			   atomic64_read(&pf->numa.local_bytes),
+			   atomic64_read(&pf->numa.remote_bytes),
+			   atomic64_read(&pf->numa.remote_cmds),
+			   atomic64_read(&pf->numa.remote_allocs));
+
+		spin_lock(&pf->pool.lock);
+		seq_printf(m, "  pool pages %lu max_pages %lu hits %llu misses %llu hit_pct %llu released %llu\n",
+			   pf->pool.nr, pf->pool.max_nr, pf->pool.hits,
+			   pf->pool.misses,
+			   pf->pool.hits + pf->pool.misses ?
+			   div64_u64(pf->pool.hits * 100,
+				     pf->pool.hits + pf->pool.misses) : 0,
+			   pf->pool.released);
+		spin_unlock(&pf->pool.lock);
+
+		spin_lock(&pf->sched.lock);
+		seq_printf(m, "  sched inflight %d depth %u max_depth %u cmds %llu waited %llu avg_wait_ns %llu max_wait_ns %llu\n",
+			   pf->sched.inflight, pf->sched.depth,
+			   pf->sched.max_depth, pf->sched.cmds,
+			   pf->sched.waited,
+			   pf->sched.waited ?
+			   div64_u64(pf->sched.wait_ns, pf->sched.waited) : 0,
+			   pf->sched.max_wait_ns);
+		for (i = 0; i < ADMIN_UNIT_PRIO_MAX; i++) {
+			ps = &pf->sched.prio[i];
+			seq_printf(m, "  prio %-6s cmds %llu avg_lat_ns %llu max_lat_ns %llu\n",
+				   admin_unit_prio_name[i], ps->cmds,
+				   ps->cmds ? div64_u64(ps->lat_ns, ps->cmds) : 0,
+				   ps->max_lat_ns);
+		}
+		spin_unlock(&pf->sched.lock);
+
+		mutex_lock(&admin_unit_tune_lock);
+		seq_printf(m, "  chunk_sz %d%s\n", admin_unit_chunk_sz(pf),
+			   pf->chunk_sz ? "" : " (default)");
+		for (i = 0; i < pf->nr_chunk_res; i++) {
+			r = &pf->chunk_res[i];
+			seq_printf(m, "  chunk %6u cmds %u MB/s %llu ns/cmd %llu\n",
+				   r->size, r->cmds,
+				   div64_u64(r->bytes * 1000, r->ns),
+				   div64_u64(r->ns, r->cmds));
+		}
+		mutex_unlock(&admin_unit_tune_lock);
+	}
+	srcu_read_unlock(&admin_unit_srcu, idx);
+	return 0;
+}
+
+static int admin_unit_stats_proc_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, admin_unit_stats_proc_show, NULL);
+}
+
+static const struct proc_ops admin_unit_stats_proc_fops = {
+	.proc_open	= admin_unit_stats_proc_open,
+	.proc_read	= seq_read,
+	.proc_lseek	= seq_lseek,
+	.proc_release	= single_release,
+};
+
+/*
+ * /dev/admin_unit: binary control path.  One ioctl carries a vector of
+ * fixed-layout descriptors; each is run against the device in order and
+ * gets its status and latency written back, so no string parsing and no
+ * syscall per command.
+ *
+ * A descriptor goes through prep (task context: copy in), run (may be a
+ * worker, inside an SRCU read section) and finish (task context: copy
+ * out), which lets the io_uring path below run the blocking admin
+ * command off the submitter.
+ *
+ * CTX_WR and CTX_RD do not copy: prep pins the user buffer and the
+ * device reads the ctx straight out of, or writes it straight into, those
+ * pages.  CTX_RD is one admin command, so it is bounded by one window.
+ * The queries left on the bounce buffer return a few dozen bytes.
+ */
+#define ADMIN_UNIT_CTX_WR_MAX		(1ULL << 30)
+
+struct admin_unit_ioc_req {
+	struct admin_unit_cmd_desc d;
+	u8 *buf;
+	/* CTX_WR/CTX_RD: the pinned user pages, the ctx at user_off of the first */
+	struct admin_unit_ctx *user;
+	u32 user_off;
+};
+
+static int admin_unit_ioc_pin(struct admin_unit_ioc_req *req,
+			      struct admin_vf *vf)
+{
+	struct admin_unit_cmd_desc *d = &req->d;
+	bool rd = d->opcode == ADMIN_UNIT_OP_CTX_RD;
+	struct admin_unit_ctx *ctx;
+	long pinned;
+
+	if (d->len > (rd ? vf->pf->win : ADMIN_UNIT_CTX_WR_MAX))
+		return -E2BIG;
+
+	ctx = kzalloc_node(sizeof(*ctx), GFP_KERNEL, vf->pf->node);
+	if (!ctx)
+		return -ENOMEM;
+	req->user = ctx;
+	req->user_off = offset_in_page(d->addr);
+	ctx->size = req->user_off + d->len;
+	ctx->pages = kvmalloc_array(DIV_ROUND_UP_ULL(ctx->size, PAGE_SIZE),
+				    sizeof(*ctx->pages), GFP_KERNEL);
+	if (!ctx->pages)
+		return -ENOMEM;
+
+	/* CTX_WR: the device only reads them */
+	pinned = pin_user_pages_fast(d->addr & PAGE_MASK,
+				     DIV_ROUND_UP_ULL(ctx->size, PAGE_SIZE),
+				     rd ? FOLL_WRITE : 0, ctx->pages);
+	if (pinned < 0)
+		return pinned;
+	ctx->nr_pages = pinned;
+	if (ctx->nr_pages != DIV_ROUND_UP_ULL(ctx->size, PAGE_SIZE))
+		return -EFAULT;
+	return 0;
+}
+
+static void admin_unit_ioc_release(struct admin_unit_ioc_req *req)
+{
+	struct admin_unit_ctx *ctx = req->user;
+
+	kfree(req->buf);
+	req->buf = NULL;
+	if (!ctx)
+		return;
+	unpin_user_pages_dirty_lock(ctx->pages, ctx->nr_pages,
+				    req->d.opcode == ADMIN_UNIT_OP_CTX_RD);
+	kvfree(ctx->pages);
+	kfree(ctx);
+	req->user = NULL;
+}
+
+static int admin_unit_ioc_prep(struct admin_unit_ioc_req *req)
+{
+	struct admin_unit_cmd_desc *d = &req->d;
+	struct admin_vf *vf;
+
+	req->buf = NULL;
+	req->user = NULL;
+	if (!d->len)
+		return 0;
+
+	vf = admin_unit_vf_get(d->vf);
+	if (!vf)
+		return -ENODEV;
+
+	if (d->opcode == ADMIN_UNIT_OP_CTX_WR ||
+	    d->opcode == ADMIN_UNIT_OP_CTX_RD)
+		return admin_unit_ioc_pin(req, vf);
+
+	if (d->len > KMALLOC_MAX_SIZE)
+		return -E2BIG;
+	req->buf = kzalloc_node(d->len, GFP_KERNEL, vf->pf->node);
+	if (!req->buf)
+		return -ENOMEM;
+	return 0;
+}
+
+static int admin_unit_ioc_run(struct admin_unit_ioc_req *req)
+{
+	struct virtio_admin_cmd_dev_ctx_size_get_result *res;
+	struct admin_unit_cmd_desc *d = &req->d;
+	u32 rd_sz = 0, remaining_sz = 0;
+	struct scatterlist *sgl;
+	u8 *buf = req->buf;
+	struct admin_vf *vf;
+	ktime_t start;
+	u64 done;
+	int ret;
+
+	vf = admin_unit_vf_get(d->vf);
+	if (!vf)
+		return -ENODEV;
+
+	start = ktime_get();
+	switch (d->opcode) {
+	case ADMIN_UNIT_OP_LIST_QUERY:
+		ret = buf ? admin_unit_query(vf, ADMIN_UNIT_Q_LIST, buf, d->len) :
+			    -EINVAL;
+		break;
+	case ADMIN_UNIT_OP_MODE_GET:
+		ret = buf ? admin_unit_query(vf, ADMIN_UNIT_Q_MODE, buf, d->len) :
+			    -EINVAL;
+		break;
+	case ADMIN_UNIT_OP_MODE_SET:
+		if (d->arg > VIRTIO_ADMIN_DEV_MODE_FREEZE) {
+			ret = -EINVAL;
+			break;
+		}
+		ret = admin_unit_cmd_dev_mode_set(vf->pdev, d->arg);
+		break;
+	case ADMIN_UNIT_OP_CTX_SZ_GET:
+		res = kzalloc_node(sizeof(*res), GFP_KERNEL, vf->pf->node);
+		if (!res) {
+			ret = -ENOMEM;
+			break;
+		}
+		ret = admin_unit_cmd_dev_ctx_sz_get(vf->pdev,
+				!!(d->flags & ADMIN_UNIT_DESC_F_FREEZE),
+				(u8 *)res, sizeof(*res));
+		if (!ret)
+			d->arg = le64_to_cpu(res->size);
+		kfree(res);
+		break;
+	case ADMIN_UNIT_OP_CTX_RD:
+		if (!req->user) {
+			ret = -EINVAL;
+			break;
+		}
+		sgl = kmalloc_array_node(req->user->nr_pages, sizeof(*sgl),
+					 GFP_KERNEL, vf->pf->node);
+		if (!sgl) {
+			ret = -ENOMEM;
+			break;
+		}
+		admin_unit_ctx_sg(req->user, req->user_off, d->len, sgl);
+		ret = admin_unit_cmd_dev_ctx_rd_sg(vf->pdev, sgl, &rd_sz,
+						   &remaining_sz);
+		kfree(sgl);
+		/* never report more than the user buffer holds */
+		if (!ret && rd_sz > d->len)
+			ret = -EIO;
+		if (ret)
+			break;
+		admin_unit_numa_account(vf->pf, rd_sz);
+		d->arg = remaining_sz;
+		break;
+	case ADMIN_UNIT_OP_CTX_WR:
+		ret = req->user ? admin_unit_ctx_xfer(vf, req->user,
+						      req->user_off, d->len,
+						      true, &done) :
+				  -EINVAL;
+		admin_unit_numa_account(vf->pf, d->len);
+		break;
+	case ADMIN_UNIT_OP_FIELD_QUERY:
+		ret = buf ? admin_unit_query(vf, ADMIN_UNIT_Q_FIELDS, buf,
+					     d->len) :
+			    -EINVAL;
+		break;
+	case ADMIN_UNIT_OP_DISCARD:
+		ret = admin_unit_cmd_discard(vf->pdev);
+		break;
+	default:
+		ret = -EOPNOTSUPP;
+		break;
+	}
+	d->latency_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	if (!ret && d->opcode == ADMIN_UNIT_OP_CTX_RD)
+		d->len = rd_sz;
+	return ret;
+}
+
+static int admin_unit_ioc_finish(struct admin_unit_ioc_req *req, int ret)
+{
+	struct admin_unit_cmd_desc *d = &req->d;
+
+	if (!ret && req->buf &&
+	    copy_to_user(u64_to_user_ptr(d->addr), req->buf, d->len))
+		ret = -EFAULT;
+
+	admin_unit_ioc_release(req);
+	d->status = ret;
+	return ret;
+}
+
+static long admin_unit_ioc_submit(struct admin_unit_cmd_vec __user *uvec)
+{
+	struct admin_unit_cmd_desc __user *udescs;
+	struct admin_unit_ioc_req req;
+	struct admin_unit_cmd_desc *descs;
+	struct admin_unit_cmd_vec vec;
+	int i, idx, ret;
+	size_t size;
+
+	if (copy_from_user(&vec, uvec, sizeof(vec)))
+		return -EFAULT;
+	if (!vec.nr || vec.nr > ADMIN_UNIT_VEC_MAX)
+		return -EINVAL;
+
+	udescs = u64_to_user_ptr(vec.descs);
+	size = array_size(vec.nr, sizeof(*descs));
+	descs = memdup_user(udescs, size);
+	if (IS_ERR(descs))
+		return PTR_ERR(descs);
+
+	idx = srcu_read_lock(&admin_unit_srcu);
+	for (i = 0; i < vec.nr; i++) {
+		req.d = descs[i];
+		ret = admin_unit_ioc_prep(&req);
+		if (!ret)
+			ret = admin_unit_ioc_run(&req);
+		admin_unit_ioc_finish(&req, ret);
+		descs[i] = req.d;
+		if (ret && (vec.flags & ADMIN_UNIT_VEC_F_STOP_ON_ERR)) {
+			i++;
+			break;
+		}
+	}
+	srcu_read_unlock(&admin_unit_srcu, idx);
+
+	ret = i;
+	if (copy_to_user(udescs, descs, size))
+		ret = -EFAULT;
+
+	kfree(descs);
+	return ret;
+}
+
+/*
+ * IORING_OP_URING_CMD: the SQE carries the address of one descriptor in
+ * the same layout as the ioctl.  The admin command runs on an unbound
+ * worker, so one event loop can keep many VFs busy; the descriptor and
+ * its buffer are updated from the submitter's task before the CQE is
+ * posted with the status in res.
+ */
+struct admin_unit_uring_req {
+	struct admin_unit_ioc_req req;
+	struct work_struct work;
+	struct io_uring_cmd *ioucmd;
+	/* the SQE is not stable past issue, so keep where the desc lives */
+	u64 udesc;
+	int ret;
+};
+
+struct admin_unit_uring_pdu {
+	struct admin_unit_uring_req *ureq;
+};
+
+static void admin_unit_uring_done(struct io_uring_cmd *ioucmd,
+				  unsigned int issue_flags)
+{
+	struct admin_unit_uring_pdu *pdu =
+		io_uring_cmd_to_pdu(ioucmd, struct admin_unit_uring_pdu);
+	struct admin_unit_uring_req *ureq = pdu->ureq;
+	struct admin_unit_cmd_desc __user *udesc;
+	int ret;
+
+	udesc = u64_to_user_ptr(ureq->udesc);
+	ret = admin_unit_ioc_finish(&ureq->req, ureq->ret);
+	if (copy_to_user(udesc, &ureq->req.d, sizeof(*udesc)))
+		ret = -EFAULT;
+
+	kfree(ureq);
+	io_uring_cmd_done(ioucmd, ret, 0, issue_flags);
+}
+
+static void admin_unit_uring_work(struct work_struct *work)
+{
+	struct admin_unit_uring_req *ureq =
+		container_of(work, struct admin_unit_uring_req, work);
+	int idx;
+
+	idx = srcu_read_lock(&admin_unit_srcu);
+	ureq->ret = admin_unit_ioc_run(&ureq->req);
+	srcu_read_unlock(&admin_unit_srcu, idx);
+
+	io_uring_cmd_complete_in_task(ureq->ioucmd, admin_unit_uring_done);
+}
+
+static int admin_unit_uring_cmd(struct io_uring_cmd *ioucmd,
+				unsigned int issue_flags)
+{
+	struct admin_unit_uring_pdu *pdu =
+		io_uring_cmd_to_pdu(ioucmd, struct admin_unit_uring_pdu);
+	const struct admin_unit_uring_sqe *usqe;
+	struct admin_unit_uring_req *ureq;
+	int idx, ret;
+
+	if (ioucmd->cmd_op != ADMIN_UNIT_URING_CMD_DESC)
+		return -ENOTTY;
+
+	usqe = io_uring_sqe_cmd(ioucmd->sqe);
+	ureq = kzalloc(sizeof(*ureq), GFP_KERNEL);
+	if (!ureq)
+		return -ENOMEM;
+
+	ureq->udesc = READ_ONCE(usqe->desc);
+	if (copy_from_user(&ureq->req.d, u64_to_user_ptr(ureq->udesc),
+			   sizeof(ureq->req.d))) {
+		kfree(ureq);
+		return -EFAULT;
+	}
+
+	idx = srcu_read_lock(&admin_unit_srcu);
+	ret = admin_unit_ioc_prep(&ureq->req);
+	srcu_read_unlock(&admin_unit_srcu, idx);
+	if (ret) {
+		admin_unit_ioc_release(&ureq->req);
+		kfree(ureq);
+		return ret;
+	}
+
+	ureq->ioucmd = ioucmd;
+	pdu->ureq = ureq;
+	INIT_WORK(&ureq->work, admin_unit_uring_work);
+	queue_work(admin_unit_wq, &ureq->work);
+
+	return -EIOCBQUEUED;
+}
+
+static long admin_unit_ioctl(struct file *file, unsigned int cmd,
+			     unsigned long arg)
+{
+	switch (cmd) {
+	case ADMIN_UNIT_IOC_SUBMIT:
+		return admin_unit_ioc_submit((void __user *)arg);
+	default:
+		return -ENOTTY;
+	}
+}
+
+static const struct file_operations admin_unit_misc_fops = {
+	.owner		= THIS_MODULE,
+	.unlocked_ioctl	= admin_unit_ioctl,
+	.compat_ioctl	= compat_ptr_ioctl,
+	.uring_cmd	= admin_unit_uring_cmd,
+};
+
+static struct miscdevice admin_unit_misc = {
+	.minor	= MISC_DYNAMIC_MINOR,
+	.name	= "admin_unit",
+	.fops	= &admin_unit_misc_fops,
+	.mode	= 0600,
+};
+static bool admin_unit_misc_registered;
+
+/*
+ * Fleet sweep: opening /proc/admin_unit/sweep queries the mode (cached
+ * like any mode query) and issues a non-freeze DEV_CTX_SIZE_GET to every
+ * VF of every PF at once, one work item per VF, and reads back one line
+ * per VF.  Each PF's scheduler still bounds what reaches its admin vq.
+ * The size get restarts the device side read stream of the VF, so it is
+ * sent under vf->lock and a VF that is busy or halfway through a partial
+ * save reports -EBUSY.
+ */
+struct admin_unit_sweep_ent {
+	struct work_struct work;
+	struct admin_unit_sweep *sw;
+	struct admin_vf *vf;
+	char name[16];
+	int mode_ret;
+	int sz_ret;
+	u8 mode;
+	u64 ctx_sz;
+	s64 ns;
+};
+
+struct admin_unit_sweep {
+	atomic_t pending;
+	struct completion done;
+	s64 ns;
+	int nr;
+	struct admin_unit_sweep_ent ent[];
+};
+
+static void admin_unit_sweep_work(struct work_struct *work)
+{
+	struct admin_unit_sweep_ent *ent =
+		container_of(work, struct admin_unit_sweep_ent, work);
+	struct virtio_admin_cmd_dev_ctx_size_get_result *res;
+	struct virtio_admin_cmd_dev_mode *mode;
+	struct admin_vf *vf = ent->vf;
+	ktime_t start = ktime_get();
+
+	mode = kzalloc_node(sizeof(*mode), GFP_KERNEL, vf->pf->node);
+	res = kzalloc_node(sizeof(*res), GFP_KERNEL, vf->pf->node);
+	if (mode && res) {
+		ent->mode_ret = admin_unit_query(vf, ADMIN_UNIT_Q_MODE,
+						 (u8 *)mode, sizeof(*mode));
+		ent->mode = mode->mode;
+		if (!mutex_trylock(&vf->lock)) {
+			ent->sz_ret = -EBUSY;
+		} else {
+			if (vf->cur.off)
+				ent->sz_ret = -EBUSY;
+			else
+				ent->sz_ret = admin_unit_cmd_dev_ctx_sz_get(
+					vf->pdev, 0, (u8 *)res, sizeof(*res));
+			mutex_unlock(&vf->lock);
+		}
+		ent->ctx_sz = le64_to_cpu(res->size);
+	} else {
+		ent->mode_ret = ent->sz_ret = -ENOMEM;
+	}
+	kfree(res);
+	kfree(mode);
+	ent->ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	if (atomic_dec_and_test(&ent->sw->pending))
+		complete(&ent->sw->done);
+}
+
+static struct admin_unit_sweep *admin_unit_sweep_run(void)
+{
+	struct admin_unit_sweep *sw;
+	struct admin_pf *pf;
+	struct admin_vf *vf;
+	ktime_t start = ktime_get();
+	unsigned long pi;
+	int i, n = 0;
+
+	xa_for_each(&g_dev_mgr.pfs, pi, pf)
+		n += pci_num_vf(pf->pdev);
+
+	sw = kvzalloc(struct_size(sw, ent, n), GFP_KERNEL);
+	if (!sw)
+		return NULL;
+	init_completion(&sw->done);
+	/* held until every work item is queued */
+	atomic_set(&sw->pending, 1);
+
+	xa_for_each(&g_dev_mgr.pfs, pi, pf) {
+		for (i = 0; i < pci_num_vf(pf->pdev) && sw->nr < n; i++) {
+			vf = admin_unit_vf_get(ADMIN_VF_ID(pf->idx, i));
+			if (!vf)
+				continue;
+			sw->ent[sw->nr].sw = sw;
+			sw->ent[sw->nr].vf = vf;
+			strscpy(sw->ent[sw->nr].name, vf->name,
+				sizeof(sw->ent[sw->nr].name));
+			INIT_WORK(&sw->ent[sw->nr].work, admin_unit_sweep_work);
+			atomic_inc(&sw->pending);
+			queue_work(admin_unit_wq, &sw->ent[sw->nr].work);
+			sw->nr++;
+		}
+	}
+
+	if (!atomic_dec_and_test(&sw->pending))
+		wait_for_completion(&sw->done);
+	sw->ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	return sw;
+}
+
+static int admin_unit_sweep_proc_show(struct seq_file *m, void *v)
+{
+	struct admin_unit_sweep *sw = m->private;
+	struct admin_unit_sweep_ent *ent;
+	int i;
+
+	seq_printf(m, "sweep vfs %d ns %lld\n", sw->nr, sw->ns);
+	seq_puts(m, "vf         mode ctx_sz       ret   lat_ns\n");
+	for (i = 0; i < sw->nr; i++) {
+		ent = &sw->ent[i];
+		seq_printf(m, "%-10s %-4u %-12llu %-5d %lld\n", ent->name,
+			   ent->mode, ent->ctx_sz,
+			   ent->mode_ret ? ent->mode_ret : ent->sz_ret,
+			   ent->ns);
+	}
+	return 0;
+}
+
+static int admin_unit_sweep_proc_open(struct inode *inode, struct file *file)
+{
+	struct admin_unit_sweep *sw;
+	int idx, ret;
+
+	/* VFs stay valid while the sweep runs */
+	idx = srcu_read_lock(&admin_unit_srcu);
+	sw = admin_unit_sweep_run();
+	srcu_read_unlock(&admin_unit_srcu, idx);
+	if (!sw)
+		return -ENOMEM;
+
+	ret = single_open(file, admin_unit_sweep_proc_show, sw);
+	if (ret)
+		kvfree(sw);
+	return ret;
+}
+
+static int admin_unit_sweep_proc_release(struct inode *inode, struct file *file)
+{
+	kvfree(((struct seq_file *)file->private_data)->private);
+	return single_release(inode, file);
+}
+
+static const struct proc_ops admin_unit_sweep_proc_fops = {
+	.proc_open	= admin_unit_sweep_proc_open,
+	.proc_read	= seq_read,
+	.proc_lseek	= seq_lseek,
+	.proc_release	= admin_unit_sweep_proc_release,
+};
+
+/* a PF is usable when virtio_pci drives it and it negotiated the admin vq */
+static struct virtio_device *admin_unit_pf_vdev(struct pci_dev *pdev)
+{
+	const struct pci_driver *drv = pci_dev_driver(pdev);
+	struct virtio_device *vdev;
+
+	if (!pdev->is_physfn || !drv || strcmp(drv->name, "virtio-pci"))
+		return NULL;
+
+	vdev = virtio_pci_dev_get_vdev(pdev);
+	if (!vdev || !virtio_has_feature(vdev, VIRTIO_F_ADMIN_VQ))
+		return NULL;
+	return vdev;
+}
+
+/*
+ * Ctx bytes one admin command of pf may carry.  Each page of the window
+ * is an sg entry and a descriptor chain may not be longer than the admin
+ * vq, so a 1 MB window only fits a queue of 260 entries or more.
+ */
+static u32 admin_unit_pf_win(struct admin_pf *pf)
+{
+	struct virtqueue *vq;
+	unsigned int num;
+
+	if (!pf->vdev)
+		return ADMIN_UNIT_CTX_WIN;
+	list_for_each_entry(vq, &pf->vdev->vqs, list) {
+		/* virtio_pci names its admin vq "avq.<index>" */
+		if (strncmp(vq->name, "avq", 3))
+			continue;
+		num = virtqueue_get_vring_size(vq);
+		/* one sg entry more than the window for a ctx not page aligned */
+		if (num < ADMIN_UNIT_AVQ_HDR_SG + 2)
+			return PAGE_SIZE;
+		return min_t(u64, ADMIN_UNIT_CTX_WIN,
+			     (u64)(num - ADMIN_UNIT_AVQ_HDR_SG - 1) * PAGE_SIZE);
+	}
+	return ADMIN_UNIT_CTX_WIN;
+}
+
+static int admin_unit_add_pf(struct pci_dev *pdev, struct virtio_device *vdev)
+{
+	struct admin_pf *pf;
+	int ret;
+
+	lockdep_assert_held(&admin_unit_dev_lock);
+	if (admin_unit_pf_find(pdev))
+		return -EEXIST;
+
+	pf = kzalloc_node(sizeof(*pf), GFP_KERNEL, dev_to_node(&pdev->dev));
+	if (!pf)
+		return -ENOMEM;
+
+	pf->idx = g_dev_mgr.nr_pfs;
+	pf->node = dev_to_node(&pdev->dev);
+	pf->pdev = pci_dev_get(pdev);
+	pf->vdev = vdev;
+	pf->win = admin_unit_pf_win(pf);
+	xa_init(&pf->vfs);
+	spin_lock_init(&pf->sched.lock);
+	INIT_LIST_HEAD(&pf->sched.crit);
+	INIT_LIST_HEAD(&pf->sched.active);
+	spin_lock_init(&pf->pool.lock);
+	INIT_LIST_HEAD(&pf->pool.pages);
+
+	ret = xa_insert(&g_dev_mgr.pfs, pf->idx, pf, GFP_KERNEL);
+	if (ret) {
+		pci_dev_put(pf->pdev);
+		kfree(pf);
+		return ret;
+	}
+	g_dev_mgr.nr_pfs++;
+
+	dev_info(&pdev->dev,
+		"pf %d pdev(%s) domain %d bus %#x devfn %#x node %d num_vfs %d ctx_win %u",
+		pf->idx, pci_name(pdev), pci_domain_nr(pdev->bus),
+		pdev->bus->number, pdev->devfn, pf->node, pci_num_vf(pdev),
+		pf->win);
+	return 0;
+}
+
+static void admin_unit_remove_vf(struct admin_pf *pf, int vf_id)
+{
+	struct admin_vf *vf;
+
+	mutex_lock(&admin_unit_dev_lock);
+	vf = xa_erase(&pf->vfs, vf_id);
+	mutex_unlock(&admin_unit_dev_lock);
+	if (!vf)
+		return;
+
+	synchronize_srcu(&admin_unit_srcu);
+	dev_info(&pf->pdev->dev, "vf %s removed\n", vf->name);
+	admin_unit_vf_free(vf);
+}
+
+static void admin_unit_remove_pf(struct pci_dev *pdev)
+{
+	struct admin_pf *pf;
+	struct admin_vf *vf;
+	unsigned long vi;
+
+	mutex_lock(&admin_unit_dev_lock);
+	pf = admin_unit_pf_find(pdev);
+	if (pf)
+		xa_erase(&g_dev_mgr.pfs, pf->idx);
+	mutex_unlock(&admin_unit_dev_lock);
+	if (!pf)
+		return;
+
+	synchronize_srcu(&admin_unit_srcu);
+	dev_info(&pdev->dev, "pf %d removed\n", pf->idx);
+	xa_for_each(&pf->vfs, vi, vf)
+		admin_unit_vf_free(vf);
+	xa_destroy(&pf->vfs);
+	admin_unit_pool_drain(pf, ULONG_MAX);
+	pci_dev_put(pf->pdev);
+	kfree(pf);
+}
+
+/*
+ * Keep the registry in sync with the PCI bus: a PF shows up once
+ * virtio-pci has bound it, and goes away before it is unbound; a VF
+ * only needs its lazily created state dropped once it is gone, since
+ * new VFs are picked up on first use.  Nothing else is touched, so
+ * saved ctx of other VFs survives sriov_numvfs changes.
+ */
+static int admin_unit_pci_notify(struct notifier_block *nb,
+				 unsigned long action, void *data)
+{
+	struct pci_dev *pdev = to_pci_dev(data);
+	struct virtio_device *vdev;
+	struct admin_pf *pf;
+	int idx;
+
+	if (pdev->vendor != PCI_VENDOR_ID_REDHAT_QUMRANET)
+		return NOTIFY_DONE;
+
+	switch (action) {
+	case BUS_NOTIFY_BOUND_DRIVER:
+		vdev = admin_unit_pf_vdev(pdev);
+		if (!vdev)
+			break;
+		mutex_lock(&admin_unit_dev_lock);
+		admin_unit_add_pf(pdev, vdev);
+		mutex_unlock(&admin_unit_dev_lock);
+		break;
+	case BUS_NOTIFY_UNBIND_DRIVER:
+		if (pdev->is_physfn)
+			admin_unit_remove_pf(pdev);
+		break;
+	case BUS_NOTIFY_REMOVED_DEVICE:
+		if (!pdev->is_virtfn)
+			break;
+		idx = srcu_read_lock(&admin_unit_srcu);
+		mutex_lock(&admin_unit_dev_lock);
+		pf = admin_unit_pf_find(pci_physfn(pdev));
+		mutex_unlock(&admin_unit_dev_lock);
+		srcu_read_unlock(&admin_unit_srcu, idx);
+		/* the PF itself can only go away from this same notifier chain */
+		if (pf)
+			admin_unit_remove_vf(pf, pci_iov_vf_id(pdev));
+		break;
+	}
+
+	return NOTIFY_OK;
+}
+
+static struct notifier_block admin_unit_pci_nb = {
+	.notifier_call = admin_unit_pci_notify,
+};
+
+/* register every virtio PF with an admin vq; VFs are set up on first use */
+void admin_unit_prepare_dev(void)
+{
+	struct virtio_device *vdev;
+	struct pci_dev *pdev = NULL;
+
+	mutex_lock(&admin_unit_dev_lock);
+	while ((pdev = pci_get_device(PCI_VENDOR_ID_REDHAT_QUMRANET,
+				      PCI_ANY_ID, pdev))) {
+		vdev = admin_unit_pf_vdev(pdev);
+		if (vdev)
+			admin_unit_add_pf(pdev, vdev);
+	}
+	mutex_unlock(&admin_unit_dev_lock);
+
+	if (!g_dev_mgr.nr_pfs)
+		pr_err("Cannot find any virtio pf with admin vq\n");
+}
+
+int __init admin_unit_init(void)
+{
+	char * depmods[DEP_MOD_NUM] = {"virtio_pci", "virtio_net"};
+	umode_t mode = 0644;
+	int i, ret;
+
+	for(i = 0; i < DEP_MOD_NUM; i++) {
+		ret = request_module(depmods[i]);
+		if (ret < 0) {
+			pr_err("Failed to load %s: %d\n", depmods[i], ret);
+			return ret;
+		} else
+			pr_info("Loaded %s successfully \n", depmods[i]);
+	}
+
+	xa_init(&g_dev_mgr.pfs);
+
+	/* the sweep and trace replay run on admin_unit_wq */
+	admin_unit_wq = alloc_workqueue("admin_unit", WQ_UNBOUND, 0);
+	if (!admin_unit_wq)
+		return -ENOMEM;
+
+	admin_unit_dir = proc_mkdir("admin_unit", NULL);
+	if (!admin_unit_dir) {
+		ret = -ENOENT;
+		goto err_wq;
+	}
+
+	proc_create("cmd_ops", mode, admin_unit_dir, &admin_unit_cmd_proc_fops);
+	proc_create("mig_timeline", 0444, admin_unit_dir,
+		    &admin_unit_mig_tl_proc_fops);
+	proc_create("devices", 0444, admin_unit_dir,
+		    &admin_unit_devices_proc_fops);
+	proc_create("stats", 0444, admin_unit_dir,
+		    &admin_unit_stats_proc_fops);
+	proc_create("selftest", 0444, admin_unit_dir,
+		    &admin_unit_selftest_proc_fops);
+	proc_create("ctx", 0444, admin_unit_dir,
+		    &admin_unit_view_proc_fops);
+	proc_create("diff", 0444, admin_unit_dir,
+		    &admin_unit_diff_proc_fops);
+	proc_create("soak", 0444, admin_unit_dir,
+		    &admin_unit_soak_proc_fops);
+	proc_create("sweep", 0444, admin_unit_dir,
+		    &admin_unit_sweep_proc_fops);
+	proc_create("trace", 0644, admin_unit_dir,
+		    &admin_unit_trace_proc_fops);
+	proc_create("replay", 0444, admin_unit_dir,
+		    &admin_unit_replay_proc_fops);
+	proc_create("fanout", 0444, admin_unit_dir,
+		    &admin_unit_fanout_proc_fops);
+
+	ret = misc_register(&admin_unit_misc);
+	if (ret)
+		pr_err("Failed to register /dev/admin_unit %d\n", ret);
+	else
+		admin_unit_misc_registered = true;
+
+	admin_unit_shrinker = shrinker_alloc(0, "admin_unit-ctx");
+	if (admin_unit_shrinker) {
+		admin_unit_shrinker->count_objects = admin_unit_shrink_count;
+		admin_unit_shrinker->scan_objects = admin_unit_shrink_scan;
+		shrinker_register(admin_unit_shrinker);
+	} else {
+		pr_err("Failed to alloc shrinker\n");
+	}
+
+	/* before the scan, so that no PF bound meanwhile is missed */
+	ret = bus_register_notifier(&pci_bus_type, &admin_unit_pci_nb);
+	if (ret)
+		pr_err("Failed to register pci notifier %d\n", ret);
+
+	admin_unit_prepare_dev();
+
+	return 0; /* success */
+
+err_wq:
+	destroy_workqueue(admin_unit_wq);
+	return ret;
+}
+
+void __exit admin_unit_cleanup(void)
+{
+	unsigned long pi, vi;
+	struct admin_pf *pf;
+	struct admin_vf *vf;
+
+	bus_unregister_notifier(&pci_bus_type, &admin_unit_pci_nb);
+	shrinker_free(admin_unit_shrinker);
+	if (admin_unit_misc_registered)
+		misc_deregister(&admin_unit_misc);
+	remove_proc_entry("fanout", admin_unit_dir);
+	remove_proc_entry("replay", admin_unit_dir);
+	remove_proc_entry("trace", admin_unit_dir);
+	remove_proc_entry("sweep", admin_unit_dir);
+	destroy_workqueue(admin_unit_wq);
+	kvfree(g_trace_import);
+	kvfree(g_trace.rec);
+
+	remove_proc_entry("soak", admin_unit_dir);
+	remove_proc_entry("diff", admin_unit_dir);
+	remove_proc_entry("ctx", admin_unit_dir);
+	remove_proc_entry("selftest", admin_unit_dir);
+	remove_proc_entry("stats", admin_unit_dir);
+	remove_proc_entry("devices", admin_unit_dir);
+	remove_proc_entry("mig_timeline", admin_unit_dir);
+	remove_proc_entry("cmd_ops", admin_unit_dir);
+	proc_remove(admin_unit_dir);
+
+	xa_for_each(&g_dev_mgr.pfs, pi, pf) {
+		xa_for_each(&pf->vfs, vi, vf)
+			admin_unit_vf_free(vf);
+		xa_destroy(&pf->vfs);
+		admin_unit_pool_drain(pf, ULONG_MAX);
+		pci_dev_put(pf->pdev);
+		kfree(pf);
+	}
+	xa_destroy(&g_dev_mgr.pfs);
+}
+
+module_init(admin_unit_init);
+module_exit(admin_unit_cleanup);